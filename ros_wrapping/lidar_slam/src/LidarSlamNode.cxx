@@ -74,8 +74,18 @@ LidarSlamNode::LidarSlamNode(ros::NodeHandle& nh, ros::NodeHandle& priv_nh)
   std::string mapsPathPrefix = priv_nh.param<std::string>("maps/initial_maps", "");
   if (!mapsPathPrefix.empty())
   {
-    ROS_INFO_STREAM("Loading initial keypoints maps from PCD.");
-    this->LidarSlam.LoadMapsFromPCD(mapsPathPrefix);
+    if (priv_nh.param("maps/initial_maps_as_prior", false))
+    {
+      ROS_INFO_STREAM("Loading initial keypoints maps from PCD as prior maps.");
+      double tileResolution = priv_nh.param("maps/prior_tile_resolution", 10.);
+      bool cacheIndices = priv_nh.param("maps/cache_prior_indices", true);
+      this->LidarSlam.SetPriorMaps(LidarSlam::LoadPriorMapsFromPCD(mapsPathPrefix, tileResolution, cacheIndices));
+    }
+    else
+    {
+      ROS_INFO_STREAM("Loading initial keypoints maps from PCD.");
+      this->LidarSlam.LoadMapsFromPCD(mapsPathPrefix);
+    }
   }
 
   // Load initial Landmarks poses if requested
@@ -98,6 +108,16 @@ LidarSlamNode::LidarSlamNode(ros::NodeHandle& nh, ros::NodeHandle& priv_nh)
     ROS_INFO_STREAM("Setting initial SLAM pose to:\n" << poseTransform.matrix());
   }
 
+  // Restore SLAM state from last checkpoint if requested
+  this->CheckpointPrefix = priv_nh.param<std::string>("maps/checkpoint/path_prefix", "");
+  this->CheckpointPeriod = priv_nh.param("maps/checkpoint/period", 0.);
+  if (!this->CheckpointPrefix.empty() && priv_nh.param("maps/checkpoint/restore", false))
+  {
+    ROS_INFO_STREAM("Restoring SLAM state from checkpoint.");
+    if (!this->LidarSlam.LoadCheckpoint(this->CheckpointPrefix))
+      ROS_WARN_STREAM("No valid checkpoint found, starting from scratch.");
+  }
+
   // Use GPS data for GPS/SLAM calibration or Pose Graph Optimization.
   priv_nh.getParam("external_sensors/gps/use_gps", this->UseGps);
   // Use tags data for local optimization.
@@ -215,6 +235,19 @@ void LidarSlamNode::ScanCallback(const CloudS::Ptr cloudS_ptr)
 
   // Publish SLAM output as requested by user
   this->PublishOutput();
+
+  // Periodically save SLAM state in background
+  if (!this->CheckpointPrefix.empty() && this->CheckpointPeriod > 0.)
+  {
+    // The first checkpoint is saved one period after the first frame
+    double now = ros::Time::now().toSec();
+    if (this->LastCheckpointTime <= 0.)
+      this->LastCheckpointTime = now;
+    // If the previous checkpoint is still being written, retry at next frame
+    else if (now - this->LastCheckpointTime > this->CheckpointPeriod &&
+             this->LidarSlam.SaveCheckpoint(this->CheckpointPrefix, true))
+      this->LastCheckpointTime = now;
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -597,6 +630,29 @@ void LidarSlamNode::SlamCommandCallback(const lidar_slam::SlamCommand& msg)
       this->LidarSlam.OptimizeGraph();
       break;
 
+    case lidar_slam::SlamCommand::SAVE_CHECKPOINT:
+    {
+      std::string prefix = msg.string_arg.empty() ? this->CheckpointPrefix : msg.string_arg;
+      if (prefix.empty())
+      {
+        ROS_ERROR_STREAM("Cannot save checkpoint : no path prefix given.");
+        break;
+      }
+      ROS_INFO_STREAM("Saving SLAM state checkpoint.");
+      if (!this->LidarSlam.SaveCheckpoint(prefix, true))
+        ROS_ERROR_STREAM("Failed to save checkpoint '" << prefix << "'.");
+      break;
+    }
+
+    case lidar_slam::SlamCommand::LOAD_CHECKPOINT:
+    {
+      std::string prefix = msg.string_arg.empty() ? this->CheckpointPrefix : msg.string_arg;
+      ROS_INFO_STREAM("Loading SLAM state checkpoint.");
+      if (!this->LidarSlam.LoadCheckpoint(prefix))
+        ROS_ERROR_STREAM("Failed to load checkpoint '" << prefix << "'.");
+      break;
+    }
+
     // Unknown command
     default:
       ROS_ERROR_STREAM("Unknown SLAM command : " << (unsigned int) msg.command);
@@ -896,10 +952,35 @@ void LidarSlamNode::SetSlamParameters()
 
   // General
   SetSlamParam(bool,   "slam/2d_mode", TwoDMode)
+  SetSlamParam(bool,   "slam/batched_lidar_residuals", BatchedLidarResiduals)
   SetSlamParam(bool,   "slam/use_blobs", UseBlobs)
   SetSlamParam(int,    "slam/verbosity", Verbosity)
   SetSlamParam(int,    "slam/n_threads", NbThreads)
   SetSlamParam(double, "slam/logging_timeout", LoggingTimeout)
+  int optimizationSolver;
+  if (this->PrivNh.getParam("slam/optimization_solver", optimizationSolver))
+  {
+    LidarSlam::PoseSolver solver = static_cast<LidarSlam::PoseSolver>(optimizationSolver);
+    if (solver != LidarSlam::PoseSolver::CERES &&
+        solver != LidarSlam::PoseSolver::DENSE_LM)
+    {
+      ROS_ERROR_STREAM("Invalid optimization solver (" << optimizationSolver << "). Setting it to 'CERES'.");
+      solver = LidarSlam::PoseSolver::CERES;
+    }
+    this->LidarSlam.SetOptimizationSolver(solver);
+  }
+  int optimizationParameterization;
+  if (this->PrivNh.getParam("slam/optimization_parameterization", optimizationParameterization))
+  {
+    LidarSlam::PoseParameterization parameterization = static_cast<LidarSlam::PoseParameterization>(optimizationParameterization);
+    if (parameterization != LidarSlam::PoseParameterization::EULER_ANGLES &&
+        parameterization != LidarSlam::PoseParameterization::QUATERNION)
+    {
+      ROS_ERROR_STREAM("Invalid optimization parameterization (" << optimizationParameterization << "). Setting it to 'EULER_ANGLES'.");
+      parameterization = LidarSlam::PoseParameterization::EULER_ANGLES;
+    }
+    this->LidarSlam.SetOptimizationParameterization(parameterization);
+  }
   int egoMotionMode;
   if (this->PrivNh.getParam("slam/ego_motion", egoMotionMode))
   {
@@ -942,6 +1023,23 @@ void LidarSlamNode::SetSlamParameters()
     }
     LidarSlam.SetLoggingStorage(storage);
   }
+  SetSlamParam(double, "slam/memory_budget", MemoryBudget)
+  std::vector<int> evictionPolicies;
+  if (this->PrivNh.getParam("slam/memory_eviction_policies", evictionPolicies))
+  {
+    std::vector<LidarSlam::MemoryEvictionPolicy> policies;
+    for (int p : evictionPolicies)
+    {
+      LidarSlam::MemoryEvictionPolicy policy = static_cast<LidarSlam::MemoryEvictionPolicy>(p);
+      if (policy != LidarSlam::MemoryEvictionPolicy::COMPRESS_OLD_STATES &&
+          policy != LidarSlam::MemoryEvictionPolicy::DROP_NON_KEYFRAME_CLOUDS &&
+          policy != LidarSlam::MemoryEvictionPolicy::DROP_FAR_MAP_VOXELS)
+        ROS_ERROR_STREAM("Invalid memory eviction policy (" << p << "). Ignoring it.");
+      else
+        policies.push_back(policy);
+    }
+    LidarSlam.SetMemoryEvictionPolicies(policies);
+  }
 
   // Frame Ids
   this->PrivNh.param("odometry_frame", this->OdometryFrameId, this->OdometryFrameId);
@@ -952,6 +1050,9 @@ void LidarSlamNode::SetSlamParameters()
   // Ego motion
   SetSlamParam(int,    "slam/ego_motion_registration/ICP_max_iter", EgoMotionICPMaxIter)
   SetSlamParam(int,    "slam/ego_motion_registration/LM_max_iter", EgoMotionLMMaxIter)
+  SetSlamParam(double, "slam/ego_motion_registration/convergence_translation", EgoMotionConvergenceTranslation)
+  SetSlamParam(double, "slam/ego_motion_registration/convergence_rotation", EgoMotionConvergenceRotation)
+  SetSlamParam(double, "slam/ego_motion_registration/convergence_matches_ratio", EgoMotionConvergenceMatchesRatio)
   SetSlamParam(double, "slam/ego_motion_registration/max_neighbors_distance", EgoMotionMaxNeighborsDistance)
   SetSlamParam(int,    "slam/ego_motion_registration/edge_nb_neighbors", EgoMotionEdgeNbNeighbors)
   SetSlamParam(int,    "slam/ego_motion_registration/edge_min_nb_neighbors", EgoMotionEdgeMinNbNeighbors)
@@ -961,10 +1062,17 @@ void LidarSlamNode::SetSlamParameters()
   SetSlamParam(double, "slam/ego_motion_registration/plane_max_model_error", EgoMotionPlaneMaxModelError)
   SetSlamParam(double, "slam/ego_motion_registration/init_saturation_distance", EgoMotionInitSaturationDistance)
   SetSlamParam(double, "slam/ego_motion_registration/final_saturation_distance", EgoMotionFinalSaturationDistance)
+  SetSlamParam(double, "slam/ego_motion_registration/neighborhood_reuse_ratio", EgoMotionNeighborhoodReuseRatio)
+  SetSlamParam(double, "slam/ego_motion_registration/init_knn_epsilon", EgoMotionInitKnnEpsilon)
+  SetSlamParam(int,    "slam/ego_motion_registration/nb_exact_knn_iterations", EgoMotionNbExactKnnIterations)
+  SetSlamParam(int,    "slam/ego_motion_registration/warm_start_azimuth_bins", EgoMotionWarmStartAzimuthBins)
 
   // Localization
   SetSlamParam(int,    "slam/localization/ICP_max_iter", LocalizationICPMaxIter)
   SetSlamParam(int,    "slam/localization/LM_max_iter", LocalizationLMMaxIter)
+  SetSlamParam(double, "slam/localization/convergence_translation", LocalizationConvergenceTranslation)
+  SetSlamParam(double, "slam/localization/convergence_rotation", LocalizationConvergenceRotation)
+  SetSlamParam(double, "slam/localization/convergence_matches_ratio", LocalizationConvergenceMatchesRatio)
   SetSlamParam(double, "slam/localization/max_neighbors_distance", LocalizationMaxNeighborsDistance)
   SetSlamParam(int,    "slam/localization/edge_nb_neighbors", LocalizationEdgeNbNeighbors)
   SetSlamParam(int,    "slam/localization/edge_min_nb_neighbors", LocalizationEdgeMinNbNeighbors)
@@ -975,6 +1083,27 @@ void LidarSlamNode::SetSlamParameters()
   SetSlamParam(int,    "slam/localization/blob_nb_neighbors", LocalizationBlobNbNeighbors)
   SetSlamParam(double, "slam/localization/init_saturation_distance", LocalizationInitSaturationDistance)
   SetSlamParam(double, "slam/localization/final_saturation_distance", LocalizationFinalSaturationDistance)
+  SetSlamParam(bool,   "slam/localization/map_model_cache", LocalizationMapModelCache)
+  SetSlamParam(double, "slam/localization/neighborhood_reuse_ratio", LocalizationNeighborhoodReuseRatio)
+  SetSlamParam(double, "slam/localization/init_knn_epsilon", LocalizationInitKnnEpsilon)
+  SetSlamParam(int,    "slam/localization/nb_exact_knn_iterations", LocalizationNbExactKnnIterations)
+  SetSlamParam(int,    "slam/localization/warm_start_azimuth_bins", LocalizationWarmStartAzimuthBins)
+  std::vector<double> samplingRatios;
+  if (this->PrivNh.getParam("slam/localization/sampling_ratios", samplingRatios))
+    LidarSlam.SetLocalizationSamplingRatios(samplingRatios);
+  SetSlamParam(int,    "slam/localization/residuals_budget", LocalizationResidualsBudget)
+  int localizationEngine;
+  if (this->PrivNh.getParam("slam/localization/engine", localizationEngine))
+  {
+    LidarSlam::RegistrationEngine engine = static_cast<LidarSlam::RegistrationEngine>(localizationEngine);
+    if (engine != LidarSlam::RegistrationEngine::KNN_PCA &&
+        engine != LidarSlam::RegistrationEngine::VOXEL_GAUSSIAN)
+    {
+      ROS_ERROR_STREAM("Invalid localization engine (" << localizationEngine << "). Setting it to 'KNN_PCA'.");
+      engine = LidarSlam::RegistrationEngine::KNN_PCA;
+    }
+    this->LidarSlam.SetLocalizationEngine(engine);
+  }
 
   // External sensors
   SetSlamParam(float,  "external_sensors/max_measures", SensorMaxMeasures)
@@ -992,6 +1121,18 @@ void LidarSlamNode::SetSlamParameters()
   // Confidence estimators
   // Overlap
   SetSlamParam(float,  "slam/confidence/overlap/sampling_ratio", OverlapSamplingRatio)
+  int overlapMethod;
+  if (this->PrivNh.getParam("slam/confidence/overlap/method", overlapMethod))
+  {
+    LidarSlam::OverlapEstimator method = static_cast<LidarSlam::OverlapEstimator>(overlapMethod);
+    if (method != LidarSlam::OverlapEstimator::NEAREST_NEIGHBOR &&
+        method != LidarSlam::OverlapEstimator::VOXEL_OCCUPANCY)
+    {
+      ROS_ERROR_STREAM("Invalid overlap estimation method (" << overlapMethod << "). Setting it to 'NEAREST_NEIGHBOR'.");
+      method = LidarSlam::OverlapEstimator::NEAREST_NEIGHBOR;
+    }
+    this->LidarSlam.SetOverlapMethod(method);
+  }
   // Motion limitations (hard constraints to detect failure)
   std::vector<float> acc;
   if (this->PrivNh.getParam("slam/confidence/motion_limits/acceleration", acc) && acc.size() == 2)
@@ -1004,6 +1145,9 @@ void LidarSlamNode::SetSlamParameters()
   // Keyframes
   SetSlamParam(double, "slam/keyframes/distance_threshold", KfDistanceThreshold)
   SetSlamParam(double, "slam/keyframes/angle_threshold", KfAngleThreshold)
+  SetSlamParam(bool,   "slam/keyframes/anchored_maps", KfAnchoredMaps)
+  SetSlamParam(double, "slam/keyframes/anchor_distance_tolerance", KfAnchorDistanceTolerance)
+  SetSlamParam(double, "slam/keyframes/anchor_angle_tolerance", KfAnchorAngleTolerance)
 
   // Maps
   int mapUpdateMode;
@@ -1055,6 +1199,27 @@ void LidarSlamNode::SetSlamParameters()
   SetSamplingMode("slam/voxel_grid/sampling_mode_planes", LidarSlam::Keypoint::PLANE);
   SetSamplingMode("slam/voxel_grid/sampling_mode_blobs", LidarSlam::Keypoint::BLOB);
 
+  // Helper lambda function to set the neighbors search backend for each map
+  auto SetSearchBackend = [&](std::string paramName, LidarSlam::Keypoint k)
+  {
+    int searchBackend;
+    if (this->PrivNh.getParam(paramName, searchBackend))
+    {
+      LidarSlam::NeighborSearchBackend backend = static_cast<LidarSlam::NeighborSearchBackend>(searchBackend);
+      if (backend != LidarSlam::NeighborSearchBackend::KD_TREE &&
+          backend != LidarSlam::NeighborSearchBackend::HASHED_VOXELS)
+      {
+        ROS_ERROR_STREAM("Invalid search backend (" << searchBackend << ") for " << paramName << ". Setting it to 'KD_TREE'.");
+        backend = LidarSlam::NeighborSearchBackend::KD_TREE;
+      }
+      this->LidarSlam.SetVoxelGridSearchBackend(k, backend);
+    }
+  };
+
+  SetSearchBackend("slam/voxel_grid/search_backend_edges", LidarSlam::Keypoint::EDGE);
+  SetSearchBackend("slam/voxel_grid/search_backend_planes", LidarSlam::Keypoint::PLANE);
+  SetSearchBackend("slam/voxel_grid/search_backend_blobs", LidarSlam::Keypoint::BLOB);
+
   // Keypoint extractors
   auto InitKeypointsExtractor = [this](auto& ke, const std::string& prefix)
   {
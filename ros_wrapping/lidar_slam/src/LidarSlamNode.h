@@ -186,6 +186,11 @@ protected:
   LidarSlam::Slam LidarSlam;
   std::vector<CloudS::Ptr> Frames;
 
+  // Periodic checkpoints of the SLAM state for crash recovery
+  std::string CheckpointPrefix;     ///< Path prefix of the checkpoint (disabled if empty).
+  double CheckpointPeriod = 0.;     ///< [s] Period of the background checkpoints (disabled if 0).
+  double LastCheckpointTime = 0.;   ///< [s] Time of the last checkpoint (or of the first frame).
+
   // ROS node handles, subscribers and publishers
   ros::NodeHandle &Nh, &PrivNh;
   std::vector<ros::Subscriber> CloudSubs;
@@ -0,0 +1,303 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-16
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+#pragma once
+
+#include "LidarSlam/Utilities.h"
+
+#include <Eigen/Dense>
+#include <pcl/point_cloud.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace LidarSlam
+{
+namespace Utils
+{
+
+/*!
+ * @brief Centroids and PCA of a batch of neighborhoods, stored as structure of arrays.
+ *
+ * Each coefficient is stored in its own contiguous array, so that the
+ * eigen decompositions of consecutive neighborhoods can be computed in
+ * parallel in SIMD lanes (cf. ComputeEigen33Batch()).
+ * The buffers only grow, to avoid reallocations when reused for several batches.
+ */
+template<typename Scalar>
+struct PCABatch
+{
+  //! Resize the batch to store n neighborhoods
+  void Resize(unsigned int n)
+  {
+    this->Size = n;
+    for (auto& v : this->Mean)    v.resize(n);
+    for (auto& v : this->Cov)     v.resize(n);
+    for (auto& v : this->EigVals) v.resize(n);
+    for (auto& v : this->EigVecs) v.resize(n);
+  }
+
+  //! Get the centroid of the i-th neighborhood
+  Eigen::Matrix<Scalar, 3, 1> GetMean(unsigned int i) const
+  {
+    return {this->Mean[0][i], this->Mean[1][i], this->Mean[2][i]};
+  }
+
+  //! Get the eigen values (sorted by ascending order) of the i-th neighborhood
+  Eigen::Matrix<Scalar, 3, 1> GetEigenValues(unsigned int i) const
+  {
+    return {this->EigVals[0][i], this->EigVals[1][i], this->EigVals[2][i]};
+  }
+
+  //! Get the eigen vectors (stored in columns) of the i-th neighborhood
+  Eigen::Matrix<Scalar, 3, 3> GetEigenVectors(unsigned int i) const
+  {
+    Eigen::Matrix<Scalar, 3, 3> eigVecs;
+    for (int c = 0; c < 3; ++c)
+      for (int r = 0; r < 3; ++r)
+        eigVecs(r, c) = this->EigVecs[3 * c + r][i];
+    return eigVecs;
+  }
+
+  unsigned int Size = 0;                 ///< Number of neighborhoods
+  std::vector<Scalar> Mean[3];           ///< Centroids coordinates x, y, z
+  std::vector<Scalar> Cov[6];            ///< Covariance coefficients xx, xy, xz, yy, yz, zz
+  std::vector<Scalar> EigVals[3];        ///< Eigen values, by ascending order
+  std::vector<Scalar> EigVecs[9];        ///< Eigen vectors : EigVecs[3 * c + r] is the r-th coordinate of the c-th eigen vector
+};
+
+namespace Internal
+{
+//------------------------------------------------------------------------------
+//! Unit eigen vector of the symmetric matrix C for eigen value mu.
+//! It is the largest cross product of the rows of (C - mu * I).
+//! Returns the squared norm of this cross product, which vanishes if mu is a
+//! multiple eigen value (in which case the eigen vector is not defined).
+template<typename Scalar>
+inline Scalar Eigen33Vector(Scalar c00, Scalar c01, Scalar c02, Scalar c11, Scalar c12, Scalar c22, Scalar mu,
+                            Scalar& x, Scalar& y, Scalar& z)
+{
+  const Scalar m00 = c00 - mu, m11 = c11 - mu, m22 = c22 - mu;
+  // r0 x r1
+  const Scalar ax = c01 * c12 - c02 * m11, ay = c02 * c01 - m00 * c12, az = m00 * m11 - c01 * c01;
+  // r0 x r2
+  const Scalar bx = c01 * m22 - c02 * c12, by = c02 * c02 - m00 * m22, bz = m00 * c12 - c01 * c02;
+  // r1 x r2
+  const Scalar cx = m11 * m22 - c12 * c12, cy = c12 * c02 - c01 * m22, cz = c01 * c12 - m11 * c02;
+  const Scalar na = ax * ax + ay * ay + az * az;
+  const Scalar nb = bx * bx + by * by + bz * bz;
+  const Scalar nc = cx * cx + cy * cy + cz * cz;
+  // Select the largest one (branchless)
+  const bool aIsMax = na >= nb && na >= nc;
+  const bool bIsMax = !aIsMax && nb >= nc;
+  x = aIsMax ? ax : (bIsMax ? bx : cx);
+  y = aIsMax ? ay : (bIsMax ? by : cy);
+  z = aIsMax ? az : (bIsMax ? bz : cz);
+  const Scalar n = aIsMax ? na : (bIsMax ? nb : nc);
+  const Scalar invNorm = n > Scalar(0) ? Scalar(1) / std::sqrt(n) : Scalar(0);
+  x *= invNorm; y *= invNorm; z *= invNorm;
+  return n;
+}
+
+//------------------------------------------------------------------------------
+//! Make (x, y, z) unit and orthogonal to the unit vector (ux, uy, uz).
+//! If it is (nearly) colinear to u, any unit vector orthogonal to u is used instead.
+template<typename Scalar>
+inline void Eigen33Orthogonalize(Scalar ux, Scalar uy, Scalar uz, Scalar& x, Scalar& y, Scalar& z)
+{
+  const Scalar d = x * ux + y * uy + z * uz;
+  x -= d * ux; y -= d * uy; z -= d * uz;
+  Scalar n = x * x + y * y + z * z;
+  const bool degenerate = !(n > Scalar(1e-6));
+  // Any vector orthogonal to u, built from its 2 largest coordinates
+  const bool useXY = std::abs(ux) > std::abs(uz);
+  const Scalar ox = useXY ? -uy : Scalar(0);
+  const Scalar oy = useXY ? ux : -uz;
+  const Scalar oz = useXY ? Scalar(0) : uy;
+  x = degenerate ? ox : x;
+  y = degenerate ? oy : y;
+  z = degenerate ? oz : z;
+  n = x * x + y * y + z * z;
+  const Scalar invNorm = Scalar(1) / std::sqrt(n);
+  x *= invNorm; y *= invNorm; z *= invNorm;
+}
+} // end of Internal namespace
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Compute the centroid and covariance of a batch of pointcloud subsets.
+ * @param[in] cloud The input pointcloud
+ * @param[in] indices The points to consider from cloud. The indices of the
+ *                    i-th subset are stored from indices + i * stride.
+ * @param[in] sizes The number of points of each subset (0 to skip it).
+ * @param[in] stride The offset between 2 subsets in indices.
+ * @param[in] n The number of subsets.
+ * @param[out] batch The means and covariances, resized to n subsets.
+ * @param[in] nbThreads The number of threads to use to process the subsets.
+ */
+template<typename PointT, typename Scalar>
+void ComputeMeanAndCovarianceBatch(const pcl::PointCloud<PointT>& cloud, const int* indices,
+                                   const unsigned int* sizes, unsigned int stride, unsigned int n,
+                                   PCABatch<Scalar>& batch, int nbThreads = 1)
+{
+  batch.Resize(n);
+  #pragma omp parallel for num_threads(nbThreads) schedule(static)
+  for (int i = 0; i < static_cast<int>(n); ++i)
+  {
+    // Accumulate first and second order moments, as pcl::computeMeanAndCovarianceMatrix.
+    // The points are taken relatively to the first one of the subset, to avoid
+    // catastrophic cancellation in E[xx] - E[x]^2 far from the origin.
+    Scalar accu[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    const int* subsetIndices = indices + static_cast<size_t>(i) * stride;
+    Scalar ref[3] = {0, 0, 0};
+    if (sizes[i])
+    {
+      const PointT& p0 = cloud[subsetIndices[0]];
+      ref[0] = p0.x; ref[1] = p0.y; ref[2] = p0.z;
+    }
+    for (unsigned int k = 0; k < sizes[i]; ++k)
+    {
+      const PointT& p = cloud[subsetIndices[k]];
+      const Scalar x = p.x - ref[0], y = p.y - ref[1], z = p.z - ref[2];
+      accu[0] += x * x;
+      accu[1] += x * y;
+      accu[2] += x * z;
+      accu[3] += y * y;
+      accu[4] += y * z;
+      accu[5] += z * z;
+      accu[6] += x;
+      accu[7] += y;
+      accu[8] += z;
+    }
+    const Scalar invSize = sizes[i] ? Scalar(1) / sizes[i] : Scalar(0);
+    for (Scalar& a : accu)
+      a *= invSize;
+    batch.Mean[0][i] = accu[6] + ref[0];
+    batch.Mean[1][i] = accu[7] + ref[1];
+    batch.Mean[2][i] = accu[8] + ref[2];
+    batch.Cov[0][i] = accu[0] - accu[6] * accu[6];
+    batch.Cov[1][i] = accu[1] - accu[6] * accu[7];
+    batch.Cov[2][i] = accu[2] - accu[6] * accu[8];
+    batch.Cov[3][i] = accu[3] - accu[7] * accu[7];
+    batch.Cov[4][i] = accu[4] - accu[7] * accu[8];
+    batch.Cov[5][i] = accu[5] - accu[8] * accu[8];
+  }
+}
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Compute the eigen decompositions of a batch of symmetric 3x3 matrices.
+ *
+ * The covariance matrices stored in batch.Cov are decomposed in closed form,
+ * without any data-dependent branch, so that consecutive matrices can be
+ * processed in SIMD lanes (SSE, AVX2 or AVX-512 depending on the target
+ * instruction set, cf. SLAM_NATIVE_ARCH CMake option).
+ *
+ * Each matrix is first shifted by its mean eigen value and scaled, then:
+ *  - the eigen values are the roots of the characteristic polynomial,
+ *    computed with the trigonometric method,
+ *  - the extreme eigen vectors are computed as cross products of the rows of
+ *    (C - lambda * I). The most reliable one is kept, the other one is made
+ *    orthogonal to it (handling multiple eigen values), and the middle one
+ *    completes the direct orthonormal basis.
+ * The results match pcl::eigen33 (up to the eigen vectors signs) within
+ * floating point accuracy, as long as the covariances are computed relatively
+ * to a point of each neighborhood (cf. ComputeMeanAndCovarianceBatch()).
+ * @param[in,out] batch The batch of matrices to decompose. The eigen values
+ *                      and vectors are filled.
+ */
+template<typename Scalar>
+void ComputeEigen33Batch(PCABatch<Scalar>& batch)
+{
+  const Scalar* a00 = batch.Cov[0].data(); const Scalar* a01 = batch.Cov[1].data(); const Scalar* a02 = batch.Cov[2].data();
+  const Scalar* a11 = batch.Cov[3].data(); const Scalar* a12 = batch.Cov[4].data(); const Scalar* a22 = batch.Cov[5].data();
+  Scalar* l0 = batch.EigVals[0].data(); Scalar* l1 = batch.EigVals[1].data(); Scalar* l2 = batch.EigVals[2].data();
+  Scalar* v[9];
+  for (int k = 0; k < 9; ++k)
+    v[k] = batch.EigVecs[k].data();
+
+  const Scalar twoThirdsPi = Scalar(2. * M_PI / 3.);
+  const int n = batch.Size;
+  #pragma omp simd
+  for (int i = 0; i < n; ++i)
+  {
+    // Shift the matrix by the mean of its eigen values, and scale it to unit
+    // Frobenius norm (up to a constant factor) : C = (A - q * I) / p
+    const Scalar q = (a00[i] + a11[i] + a22[i]) / Scalar(3);
+    const Scalar b00 = a00[i] - q, b11 = a11[i] - q, b22 = a22[i] - q;
+    const Scalar p1 = a01[i] * a01[i] + a02[i] * a02[i] + a12[i] * a12[i];
+    const Scalar p = std::sqrt((b00 * b00 + b11 * b11 + b22 * b22 + Scalar(2) * p1) / Scalar(6));
+    const Scalar invP = p > Scalar(0) ? Scalar(1) / p : Scalar(0);
+    const Scalar c00 = b00 * invP, c01 = a01[i] * invP, c02 = a02[i] * invP;
+    const Scalar c11 = b11 * invP, c12 = a12[i] * invP, c22 = b22 * invP;
+
+    // Eigen values of C are 2 * cos(phi + 2k * pi / 3), with cos(3 * phi) = det(C) / 2
+    const Scalar detC = c00 * (c11 * c22 - c12 * c12) - c01 * (c01 * c22 - c12 * c02) + c02 * (c01 * c12 - c11 * c02);
+    const Scalar r = std::min(std::max(detC / Scalar(2), Scalar(-1)), Scalar(1));
+    const Scalar phi = std::acos(r) / Scalar(3);
+    const Scalar mu2 = Scalar(2) * std::cos(phi);
+    const Scalar mu0 = Scalar(2) * std::cos(phi + twoThirdsPi);
+    const Scalar mu1 = -mu0 - mu2;
+    l0[i] = q + p * mu0;
+    l1[i] = q + p * mu1;
+    l2[i] = q + p * mu2;
+
+    // Extreme eigen vectors
+    Scalar x0, y0, z0, x2, y2, z2;
+    const Scalar n0 = Internal::Eigen33Vector(c00, c01, c02, c11, c12, c22, mu0, x0, y0, z0);
+    const Scalar n2 = Internal::Eigen33Vector(c00, c01, c02, c11, c12, c22, mu2, x2, y2, z2);
+
+    // Keep the most reliable one, and make the other one orthogonal to it.
+    // If all eigen values are equal, any basis is valid : use the canonical one.
+    const bool isotropic = !(n0 > Scalar(1e-12) || n2 > Scalar(1e-12));
+    const bool keep2 = n2 >= n0;
+    Scalar ux = keep2 ? x2 : x0, uy = keep2 ? y2 : y0, uz = keep2 ? z2 : z0;
+    Scalar wx = keep2 ? x0 : x2, wy = keep2 ? y0 : y2, wz = keep2 ? z0 : z2;
+    ux = isotropic ? Scalar(0) : ux; uy = isotropic ? Scalar(0) : uy; uz = isotropic ? Scalar(1) : uz;
+    Internal::Eigen33Orthogonalize(ux, uy, uz, wx, wy, wz);
+    x2 = keep2 ? ux : wx; y2 = keep2 ? uy : wy; z2 = keep2 ? uz : wz;
+    x0 = keep2 ? wx : ux; y0 = keep2 ? wy : uy; z0 = keep2 ? wz : uz;
+
+    // Middle eigen vector : v1 = v2 x v0
+    v[0][i] = x0; v[1][i] = y0; v[2][i] = z0;
+    v[3][i] = y2 * z0 - z2 * y0;
+    v[4][i] = z2 * x0 - x2 * z0;
+    v[5][i] = x2 * y0 - y2 * x0;
+    v[6][i] = x2; v[7][i] = y2; v[8][i] = z2;
+  }
+}
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Compute the centroid and PCA of a batch of pointcloud subsets.
+ *
+ * Batched version of ComputeMeanAndPCA(), cf. ComputeMeanAndCovarianceBatch()
+ * and ComputeEigen33Batch() for details.
+ */
+template<typename PointT, typename Scalar>
+void ComputeMeanAndPCABatch(const pcl::PointCloud<PointT>& cloud, const int* indices,
+                            const unsigned int* sizes, unsigned int stride, unsigned int n,
+                            PCABatch<Scalar>& batch, int nbThreads = 1)
+{
+  ComputeMeanAndCovarianceBatch(cloud, indices, sizes, stride, n, batch, nbThreads);
+  ComputeEigen33Batch(batch);
+}
+
+} // end of Utils namespace
+} // end of LidarSlam namespace
@@ -20,6 +20,7 @@
 #pragma once
 
 // LOCAL
+#include "LidarSlam/Enums.h"
 #include "LidarSlam/MotionModel.h"
 // CERES
 #include <ceres/ceres.h>
@@ -39,6 +40,25 @@
   static std::shared_ptr<ceres::CostFunction> Create(Args&& ...args) \
   { return std::make_shared<ceres::AutoDiffCostFunction<Type, ResidualSize, __VA_ARGS__>>(new Type(args...));}
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Factory to ease the construction of the auto-diff residual objects
+ *        depending on a single pose parameters block (cf. PoseParameterization)
+ *
+ * Type: the residual functor type, with a public Parameterization member
+ * ResidualSize: int, the size of the output residual block
+ */
+#define POSE_RESIDUAL_FACTORY(Type, ResidualSize) \
+  template<typename ...Args> \
+  static std::shared_ptr<ceres::CostFunction> Create(PoseParameterization parameterization, Args&& ...args) \
+  { \
+    Type* residual = new Type(args...); \
+    residual->Parameterization = parameterization; \
+    if (parameterization == PoseParameterization::QUATERNION) \
+      return std::make_shared<ceres::AutoDiffCostFunction<Type, ResidualSize, 7>>(residual); \
+    return std::make_shared<ceres::AutoDiffCostFunction<Type, ResidualSize, 6>>(residual); \
+  }
+
 
 namespace LidarSlam
 {
@@ -49,6 +69,22 @@ struct Residual
   std::shared_ptr<ceres::CostFunction> Cost;
   std::shared_ptr<ceres::LossFunction> Robustifier;
 };
+
+//! Number of parameters of a pose parameters block
+inline int PoseParametersSize(PoseParameterization parameterization)
+{
+  return parameterization == PoseParameterization::QUATERNION ? 7 : 6;
+}
+
+//! Parameters of a robustified point-to-model match (cf. MahalanobisDistanceAffineIsometryResidual and ScaledTukeyLoss)
+struct PointToModelMatch
+{
+  Eigen::Matrix3d A = Eigen::Matrix3d::Zero();  ///< Distance operator
+  Eigen::Vector3d P = Eigen::Vector3d::Zero();  ///< Point laying on the target model
+  Eigen::Vector3d X = Eigen::Vector3d::Zero();  ///< Source point to transform
+  double SaturationDistance = 1.;               ///< Tukey loss scaling parameter
+  double Weight = 0.;                           ///< Weight of the match (0 if not matched)
+};
 }
 namespace CeresCostFunctions
 {
@@ -78,6 +114,45 @@ Eigen::Matrix<T, 3, 3> RotationMatrixFromRPY(const T& rx, const T& ry, const T&
   return R;
 }
 
+//------------------------------------------------------------------------------
+/**
+ * \brief Build rotation matrix from a unit quaternion (qx, qy, qz, qw).
+ */
+template <typename T>
+Eigen::Matrix<T, 3, 3> RotationMatrixFromQuaternion(const T* q)
+{
+  const T& x = q[0];  const T& y = q[1];  const T& z = q[2];  const T& w = q[3];
+
+  Eigen::Matrix<T, 3, 3> R;
+  R << T(1.) - T(2.)*(y*y + z*z),          T(2.)*(x*y - z*w),          T(2.)*(x*z + y*w),
+                T(2.)*(x*y + z*w),  T(1.) - T(2.)*(x*x + z*z),          T(2.)*(y*z - x*w),
+                T(2.)*(x*z - y*w),          T(2.)*(y*z + x*w),  T(1.) - T(2.)*(x*x + y*y);
+  return R;
+}
+
+//------------------------------------------------------------------------------
+/**
+ * \brief Build the rotation matrix of a pose parameters block, encoding the
+ *        rotation with Euler angles or quaternion (cf. PoseParameterization).
+ */
+template <typename T>
+Eigen::Matrix<T, 3, 3> PoseRotation(const T* w, PoseParameterization parameterization)
+{
+  if (parameterization == PoseParameterization::QUATERNION)
+    return RotationMatrixFromQuaternion(w + 3);
+  return RotationMatrixFromRPY(w[3], w[4], w[5]);
+}
+
+//------------------------------------------------------------------------------
+template <typename T>
+Eigen::Transform<T, 3, Eigen::Isometry> PoseToIsometry(const T* w, PoseParameterization parameterization)
+{
+  Eigen::Transform<T, 3, Eigen::Isometry> transform = Eigen::Transform<T, 3, Eigen::Isometry>::Identity();
+  transform.linear() = PoseRotation(w, parameterization);
+  transform.translation() << w[0], w[1], w[2];
+  return transform;
+}
+
 //------------------------------------------------------------------------------
 template <typename T>
 Eigen::Transform<T, 3, Eigen::Isometry> XYZRPYtoIsometry(const T& x, const T& y, const T& z, const T& rx, const T& ry, const T& rz)
@@ -127,9 +202,10 @@ Eigen::Matrix<T, 6, 1> IsometryToXYZRPY(const Eigen::Transform<T, 3, Eigen::Isom
  * then A = C^{-1/2}, i.e the matrix A is the square root of the inverse of the
  * covariance, also known as the stiffness matrix.
  *
- * This function takes one 6D parameters block :
+ * This function takes one pose parameters block (cf. PoseParameterization) :
  *   - 3 first parameters to encode translation : X, Y, Z
  *   - 3 last parameters to encode rotation with euler angles : rX, rY, rZ
+ *     (or 4 last parameters to encode rotation with quaternion : qX, qY, qZ, qW)
  *
  * It outputs a 3D residual block.
  */
@@ -156,11 +232,12 @@ struct MahalanobisDistanceAffineIsometryResidual
     // The idea is that all residual functions will need to evaluate those
     // sin/cos so we only compute them once each time the parameters change.
     static Matrix3T rot = Matrix3T::Identity();
-    static T lastRot[3] = {T(-1.), T(-1.), T(-1.)};
-    if (!std::equal(w + 3, w + 6, lastRot))
+    static T lastRot[4] = {T(-1.), T(-1.), T(-1.), T(-1.)};
+    const int rotSize = CeresTools::PoseParametersSize(this->Parameterization) - 3;
+    if (!std::equal(w + 3, w + 3 + rotSize, lastRot))
     {
-      rot = Utils::RotationMatrixFromRPY(w[3], w[4], w[5]);
-      std::copy(w + 3, w + 6, lastRot);
+      rot = Utils::PoseRotation(w, this->Parameterization);
+      std::copy(w + 3, w + 3 + rotSize, lastRot);
     }
 
     // Transform point with rotation and translation
@@ -173,13 +250,318 @@ struct MahalanobisDistanceAffineIsometryResidual
     return true;
   }
 
+  // Re-parameterize the residual in place (used to recycle it for another match)
+  void SetParameters(const Eigen::Matrix3d& argA, const Eigen::Vector3d& argP, const Eigen::Vector3d& argX)
+  {
+    this->A = argA;
+    this->P = argP;
+    this->X = argX;
+  }
+
   // Factory to ease the construction of the auto-diff residual object
-  RESIDUAL_FACTORY(MahalanobisDistanceAffineIsometryResidual, 3, 6)
+  POSE_RESIDUAL_FACTORY(MahalanobisDistanceAffineIsometryResidual, 3)
+
+  // Parameterization of the pose parameters block
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
 
 private:
-  const Eigen::Matrix3d A;
-  const Eigen::Vector3d P;
-  const Eigen::Vector3d X;
+  Eigen::Matrix3d A;
+  Eigen::Vector3d P;
+  Eigen::Vector3d X;
+};
+
+//------------------------------------------------------------------------------
+/**
+ * \class BatchedMahalanobisDistanceAffineIsometryResidual
+ * \brief Batch of robustified MahalanobisDistanceAffineIsometryResidual, to
+ *        optimize all point-to-model matches within a single residual block.
+ *
+ * For each match, the residual A (R X + T - P) and its jacobian are computed
+ * analytically, the rotation and its derivatives being computed only once for
+ * all matches. The matches are stored as structures of arrays, and evaluated
+ * in parallel with SIMD instructions.
+ *
+ * As the Ceres robustifiers apply to a whole residual block, the Tukey loss
+ * of each match (cf. CeresTools::ScaledTukeyLoss) is applied here the same way
+ * Ceres does (cf. ceres::Corrector, as the Tukey loss is concave, the residual
+ * and jacobian of a match are scaled by sqrt(rho')). As Ceres would compute the
+ * cost of a robustified match with rho instead, a last residual (with null
+ * jacobian) corrects the total cost : the cost, gradient and Gauss-Newton
+ * system are the same as with one robustified residual block per match.
+ *
+ * This function takes one pose parameters block (cf. PoseParameterization) :
+ *   - 3 first parameters to encode translation : X, Y, Z
+ *   - 3 last parameters to encode rotation with euler angles : rX, rY, rZ
+ *     (or 4 last parameters to encode rotation with quaternion : qX, qY, qZ, qW)
+ *
+ * It outputs a (3 * N + 1)D residual block.
+ */
+class BatchedMahalanobisDistanceAffineIsometryResidual : public ceres::CostFunction
+{
+public:
+
+  BatchedMahalanobisDistanceAffineIsometryResidual()
+  {
+    this->mutable_parameter_block_sizes()->push_back(6);
+    this->set_num_residuals(1);
+  }
+
+  // Remove all matches
+  void Clear()
+  {
+    for (auto& values : this->Data)
+      values.clear();
+    this->set_num_residuals(1);
+  }
+
+  // Add a match
+  void Add(const CeresTools::PointToModelMatch& match)
+  {
+    for (int i = 0; i < 9; ++i)
+      this->Data[A00 + i].push_back(match.A(i / 3, i % 3));
+    for (int i = 0; i < 3; ++i)
+    {
+      this->Data[P0 + i].push_back(match.P(i));
+      this->Data[X0 + i].push_back(match.X(i));
+    }
+    this->Data[SQ_SATURATION].push_back(match.SaturationDistance * match.SaturationDistance);
+    this->Data[WEIGHT].push_back(match.Weight);
+    this->set_num_residuals(3 * this->Size() + 1);
+  }
+
+  // Get the number of matches
+  int Size() const { return this->Data[WEIGHT].size(); }
+
+  // Max number of threads to use to evaluate the residuals
+  void SetNbThreads(int nbThreads) { this->NbThreads = nbThreads; }
+
+  // Set the parameterization of the pose parameters block
+  void SetPoseParameterization(PoseParameterization parameterization)
+  {
+    this->Parameterization = parameterization;
+    (*this->mutable_parameter_block_sizes())[0] = CeresTools::PoseParametersSize(parameterization);
+  }
+
+  bool Evaluate(double const* const* parameters, double* residuals, double** jacobians) const override
+  {
+    const double* w = parameters[0];
+
+    // Rotation R and its derivatives wrt the rotation parameters.
+    // Row-major matrices, to be used in the vectorized loop.
+    using RowMatrix3d = Eigen::Matrix<double, 3, 3, Eigen::RowMajor>;
+    RowMatrix3d R, dR[4];
+    int nbRotParams;
+    if (this->Parameterization == PoseParameterization::QUATERNION)
+    {
+      // R(q) (cf. Utils::RotationMatrixFromQuaternion), derivatives are linear in q
+      const double x = w[3], y = w[4], z = w[5], qw = w[6];
+      R = Utils::RotationMatrixFromQuaternion(w + 3);
+      dR[0] <<  0.,      2.*y,    2.*z,     2.*y,   -4.*x,   -2.*qw,   2.*z,    2.*qw,  -4.*x;
+      dR[1] << -4.*y,    2.*x,    2.*qw,    2.*x,    0.,      2.*z,   -2.*qw,   2.*z,   -4.*y;
+      dR[2] << -4.*z,   -2.*qw,   2.*x,     2.*qw,  -4.*z,    2.*y,    2.*x,    2.*y,    0.;
+      dR[3] <<  0.,     -2.*z,    2.*y,     2.*z,    0.,     -2.*x,   -2.*y,    2.*x,    0.;
+      nbRotParams = 4;
+    }
+    else
+    {
+      // R = Rz(rz) * Ry(ry) * Rx(rx) (cf. Utils::RotationMatrixFromRPY)
+      const double cx = std::cos(w[3]);  const double sx = std::sin(w[3]);
+      const double cy = std::cos(w[4]);  const double sy = std::sin(w[4]);
+      const double cz = std::cos(w[5]);  const double sz = std::sin(w[5]);
+      Eigen::Matrix3d Rx, Ry, Rz, dRx, dRy, dRz;
+      Rx  << 1.,  0.,  0.,   0.,  cx, -sx,   0.,  sx,  cx;
+      dRx << 0.,  0.,  0.,   0., -sx, -cx,   0.,  cx, -sx;
+      Ry  <<  cy, 0.,  sy,   0.,  1.,  0.,  -sy,  0.,  cy;
+      dRy << -sy, 0.,  cy,   0.,  0.,  0.,  -cy,  0., -sy;
+      Rz  <<  cz, -sz, 0.,   sz,  cz,  0.,   0.,  0.,  1.;
+      dRz << -sz, -cz, 0.,   cz, -sz,  0.,   0.,  0.,  0.;
+      R = Rz * Ry * Rx;
+      dR[0] = Rz * Ry * dRx;
+      dR[1] = Rz * dRy * Rx;
+      dR[2] = dRz * Ry * Rx;
+      dR[3].setZero();
+      nbRotParams = 3;
+    }
+    const double* r = R.data();
+    const double* d0 = dR[0].data();
+    const double* d1 = dR[1].data();
+    const double* d2 = dR[2].data();
+    const double* d3 = dR[3].data();
+    const double tx = w[0], ty = w[1], tz = w[2];
+    // Number of parameters, i.e. row size of the jacobian
+    const int nbParams = 3 + nbRotParams;
+
+    const int n = this->Size();
+    const double* data[NB_FIELDS];
+    for (int f = 0; f < NB_FIELDS; ++f)
+      data[f] = this->Data[f].data();
+    double* jacobian = (jacobians && jacobians[0]) ? jacobians[0] : nullptr;
+
+    double costCorrection = 0.;
+    #pragma omp parallel for simd num_threads(this->NbThreads) schedule(static) reduction(+:costCorrection)
+    for (int i = 0; i < n; ++i)
+    {
+      const double x = data[X0][i], y = data[X0 + 1][i], z = data[X0 + 2][i];
+      const double a00 = data[A00][i], a01 = data[A00 + 1][i], a02 = data[A00 + 2][i];
+      const double a10 = data[A00 + 3][i], a11 = data[A00 + 4][i], a12 = data[A00 + 5][i];
+      const double a20 = data[A00 + 6][i], a21 = data[A00 + 7][i], a22 = data[A00 + 8][i];
+
+      // Residual A (R X + T - P)
+      const double e0 = r[0] * x + r[1] * y + r[2] * z + tx - data[P0][i];
+      const double e1 = r[3] * x + r[4] * y + r[5] * z + ty - data[P0 + 1][i];
+      const double e2 = r[6] * x + r[7] * y + r[8] * z + tz - data[P0 + 2][i];
+      const double res0 = a00 * e0 + a01 * e1 + a02 * e2;
+      const double res1 = a10 * e0 + a11 * e1 + a12 * e2;
+      const double res2 = a20 * e0 + a21 * e1 + a22 * e2;
+
+      // Scaled Tukey loss
+      const double sqRes = res0 * res0 + res1 * res1 + res2 * res2;
+      const double sqA = data[SQ_SATURATION][i];
+      const double weight = data[WEIGHT][i];
+      const double v = sqRes <= sqA ? 1. - sqRes / sqA : 0.;
+      const double rho0 = weight * sqA / 3. * (1. - v * v * v);
+      const double rho1 = weight * v * v;
+      costCorrection += rho0 - rho1 * sqRes;
+
+      // Robustified residual
+      const double scale = std::sqrt(rho1);
+      residuals[3 * i]     = scale * res0;
+      residuals[3 * i + 1] = scale * res1;
+      residuals[3 * i + 2] = scale * res2;
+
+      if (jacobian)
+      {
+        // Derivatives of R X wrt the rotation parameters
+        const double dx0 = d0[0] * x + d0[1] * y + d0[2] * z;
+        const double dy0 = d0[3] * x + d0[4] * y + d0[5] * z;
+        const double dz0 = d0[6] * x + d0[7] * y + d0[8] * z;
+        const double dx1 = d1[0] * x + d1[1] * y + d1[2] * z;
+        const double dy1 = d1[3] * x + d1[4] * y + d1[5] * z;
+        const double dz1 = d1[6] * x + d1[7] * y + d1[8] * z;
+        const double dx2 = d2[0] * x + d2[1] * y + d2[2] * z;
+        const double dy2 = d2[3] * x + d2[4] * y + d2[5] * z;
+        const double dz2 = d2[6] * x + d2[7] * y + d2[8] * z;
+        const double dx3 = d3[0] * x + d3[1] * y + d3[2] * z;
+        const double dy3 = d3[3] * x + d3[4] * y + d3[5] * z;
+        const double dz3 = d3[6] * x + d3[7] * y + d3[8] * z;
+
+        // Row-major (3 x nbParams) jacobian block of the match
+        double* J0 = jacobian + 3 * nbParams * i;
+        double* J1 = J0 + nbParams;
+        double* J2 = J1 + nbParams;
+        J0[0] = scale * a00;  J0[1] = scale * a01;  J0[2] = scale * a02;
+        J0[3] = scale * (a00 * dx0 + a01 * dy0 + a02 * dz0);
+        J0[4] = scale * (a00 * dx1 + a01 * dy1 + a02 * dz1);
+        J0[5] = scale * (a00 * dx2 + a01 * dy2 + a02 * dz2);
+        J1[0] = scale * a10;  J1[1] = scale * a11;  J1[2] = scale * a12;
+        J1[3] = scale * (a10 * dx0 + a11 * dy0 + a12 * dz0);
+        J1[4] = scale * (a10 * dx1 + a11 * dy1 + a12 * dz1);
+        J1[5] = scale * (a10 * dx2 + a11 * dy2 + a12 * dz2);
+        J2[0] = scale * a20;  J2[1] = scale * a21;  J2[2] = scale * a22;
+        J2[3] = scale * (a20 * dx0 + a21 * dy0 + a22 * dz0);
+        J2[4] = scale * (a20 * dx1 + a21 * dy1 + a22 * dz1);
+        J2[5] = scale * (a20 * dx2 + a21 * dy2 + a22 * dz2);
+        if (nbRotParams == 4)
+        {
+          J0[6] = scale * (a00 * dx3 + a01 * dy3 + a02 * dz3);
+          J1[6] = scale * (a10 * dx3 + a11 * dy3 + a12 * dz3);
+          J2[6] = scale * (a20 * dx3 + a21 * dy3 + a22 * dz3);
+        }
+      }
+    }
+
+    // Cost correction residual : 0.5 * sum(rho) = 0.5 * sum(rho' * res^2) + 0.5 * correction
+    residuals[3 * n] = std::sqrt(std::max(costCorrection, 0.));
+    if (jacobian)
+      std::fill(jacobian + 3 * nbParams * n, jacobian + 3 * nbParams * n + nbParams, 0.);
+    return true;
+  }
+
+  // Evaluate the robustified cost of all matches for the pose (R, T), and
+  // optionally the planar normal equations H = J^T J and g = J^T r, J being the
+  // jacobian wrt the 2D pose increment (dX, dY, rZ), rZ being a rotation about
+  // the world Z axis. Z, roll and pitch are held constant, so only 3 jacobian
+  // columns are computed and accumulated, without any trigonometric function.
+  double EvaluatePlanar(const Eigen::Matrix3d& R, const Eigen::Vector3d& T,
+                        Eigen::Matrix3d* H, Eigen::Vector3d* g) const
+  {
+    const int n = this->Size();
+    const double* data[NB_FIELDS];
+    for (int f = 0; f < NB_FIELDS; ++f)
+      data[f] = this->Data[f].data();
+    const double r0 = R(0, 0), r1 = R(0, 1), r2 = R(0, 2);
+    const double r3 = R(1, 0), r4 = R(1, 1), r5 = R(1, 2);
+    const double r6 = R(2, 0), r7 = R(2, 1), r8 = R(2, 2);
+    const double tx = T.x(), ty = T.y(), tz = T.z();
+    const bool normalEquations = H && g;
+
+    double cost = 0.;
+    double h00 = 0., h01 = 0., h02 = 0., h11 = 0., h12 = 0., h22 = 0.;
+    double g0 = 0., g1 = 0., g2 = 0.;
+    #pragma omp parallel for simd num_threads(this->NbThreads) schedule(static) \
+      reduction(+:cost, h00, h01, h02, h11, h12, h22, g0, g1, g2)
+    for (int i = 0; i < n; ++i)
+    {
+      const double x = data[X0][i], y = data[X0 + 1][i], z = data[X0 + 2][i];
+      const double a00 = data[A00][i], a01 = data[A00 + 1][i], a02 = data[A00 + 2][i];
+      const double a10 = data[A00 + 3][i], a11 = data[A00 + 4][i], a12 = data[A00 + 5][i];
+      const double a20 = data[A00 + 6][i], a21 = data[A00 + 7][i], a22 = data[A00 + 8][i];
+
+      // Residual A (R X + T - P)
+      const double yx = r0 * x + r1 * y + r2 * z;
+      const double yy = r3 * x + r4 * y + r5 * z;
+      const double e0 = yx + tx - data[P0][i];
+      const double e1 = yy + ty - data[P0 + 1][i];
+      const double e2 = r6 * x + r7 * y + r8 * z + tz - data[P0 + 2][i];
+      const double res0 = a00 * e0 + a01 * e1 + a02 * e2;
+      const double res1 = a10 * e0 + a11 * e1 + a12 * e2;
+      const double res2 = a20 * e0 + a21 * e1 + a22 * e2;
+
+      // Scaled Tukey loss
+      const double sqRes = res0 * res0 + res1 * res1 + res2 * res2;
+      const double sqA = data[SQ_SATURATION][i];
+      const double weight = data[WEIGHT][i];
+      const double v = sqRes <= sqA ? 1. - sqRes / sqA : 0.;
+      cost += 0.5 * weight * sqA / 3. * (1. - v * v * v);
+
+      if (normalEquations)
+      {
+        // Jacobian columns wrt dX, dY, and rZ (d(R X)/drZ = (-RX.y, RX.x, 0))
+        const double rho1 = weight * v * v;
+        const double jz0 = a01 * yx - a00 * yy;
+        const double jz1 = a11 * yx - a10 * yy;
+        const double jz2 = a21 * yx - a20 * yy;
+        h00 += rho1 * (a00 * a00 + a10 * a10 + a20 * a20);
+        h01 += rho1 * (a00 * a01 + a10 * a11 + a20 * a21);
+        h02 += rho1 * (a00 * jz0 + a10 * jz1 + a20 * jz2);
+        h11 += rho1 * (a01 * a01 + a11 * a11 + a21 * a21);
+        h12 += rho1 * (a01 * jz0 + a11 * jz1 + a21 * jz2);
+        h22 += rho1 * (jz0 * jz0 + jz1 * jz1 + jz2 * jz2);
+        g0 += rho1 * (a00 * res0 + a10 * res1 + a20 * res2);
+        g1 += rho1 * (a01 * res0 + a11 * res1 + a21 * res2);
+        g2 += rho1 * (jz0 * res0 + jz1 * res1 + jz2 * res2);
+      }
+    }
+
+    if (normalEquations)
+    {
+      *H << h00, h01, h02,
+            h01, h11, h12,
+            h02, h12, h22;
+      *g << g0, g1, g2;
+    }
+    return cost;
+  }
+
+private:
+
+  // Fields of the matches, stored as structure of arrays
+  enum Field { A00 = 0, P0 = 9, X0 = 12, SQ_SATURATION = 15, WEIGHT = 16, NB_FIELDS = 17 };
+  std::vector<double> Data[NB_FIELDS];
+
+  int NbThreads = 1;
+
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
 };
 
 //------------------------------------------------------------------------------
@@ -289,9 +671,9 @@ private:
  *        transformation (rotation and translation) so that the distance
  *        from a previous known pose corresponds to an external sensor odometry measure.
  *
- * This function takes one 6D parameters block :
+ * This function takes one pose parameters block (cf. PoseParameterization) :
  *   - 3 first parameters to encode translation : X, Y, Z
- *   - [unused] 3 last parameters to encode rotation with euler angles : rX, rY, rZ
+ *   - [unused] last parameters to encode rotation
  *
  * It outputs a 1D residual block.
  */
@@ -318,7 +700,10 @@ struct OdometerDistanceResidual
   }
 
   // Factory to ease the construction of the auto-diff residual object
-  RESIDUAL_FACTORY(OdometerDistanceResidual, 1, 6)
+  POSE_RESIDUAL_FACTORY(OdometerDistanceResidual, 1)
+
+  // Parameterization of the pose parameters block
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
 
 private:
   const Eigen::Vector3d PreviousPos;
@@ -333,9 +718,10 @@ private:
  *        that the gravity vector corresponds to a reference.
  *        This gravity vector is usually supplied by an IMU.
  *
- * This function takes one 6D parameters block :
+ * This function takes one pose parameters block (cf. PoseParameterization) :
  *   - [unused] 3 first parameters to encode translation : X, Y, Z
  *   - 3 last parameters to encode rotation with euler angles : rX, rY, rZ
+ *     (or 4 last parameters to encode rotation with quaternion : qX, qY, qZ, qW)
  *
  * It outputs a 3D residual block.
  */
@@ -354,7 +740,7 @@ struct ImuGravityAlignmentResidual
     using Vector3T = Eigen::Matrix<T, 3, 1>;
 
     // Get rotation part
-    Matrix3T rot = Utils::RotationMatrixFromRPY(w[3], w[4], w[5]);
+    Matrix3T rot = Utils::PoseRotation(w, this->Parameterization);
 
     // Compute residual
     Eigen::Map<Vector3T> residualVec(residual);
@@ -364,7 +750,10 @@ struct ImuGravityAlignmentResidual
   }
 
   // Factory to ease the construction of the auto-diff residual object
-  RESIDUAL_FACTORY(ImuGravityAlignmentResidual, 3, 6)
+  POSE_RESIDUAL_FACTORY(ImuGravityAlignmentResidual, 3)
+
+  // Parameterization of the pose parameters block
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
 
 private:
   const Eigen::Vector3d ReferenceGravityDirection;
@@ -378,9 +767,10 @@ private:
  *        (rotation and translation) so that it is consistent
  *        with a landmark detection (knowing its absolute position)
  *
- * This function takes one 6D parameters block :
+ * This function takes one pose parameters block (cf. PoseParameterization) :
  *   - 3 parameters to encode translation : X, Y, Z
  *   - 3 last parameters to encode rotation with Euler angles : rX, rY, rZ
+ *     (or 4 last parameters to encode rotation with quaternion : qX, qY, qZ, qW)
  *
  * It outputs a 3D residual block.
  */
@@ -405,11 +795,12 @@ struct LandmarkPositionResidual
     // The idea is that all landmark residual functions will need to evaluate those
     // sin/cos so we only compute them once each time the parameters change.
     static Isometry3T currentPoseTransfo = Isometry3T::Identity();
-    static T lastT[6] = {T(-1.)};
-    if (!std::equal(w, w + 6, lastT))
+    static T lastT[7] = {T(-1.)};
+    const int poseSize = CeresTools::PoseParametersSize(this->Parameterization);
+    if (!std::equal(w, w + poseSize, lastT))
     {
-      currentPoseTransfo = Utils::XYZRPYtoIsometry(w[0], w[1], w[2], w[3], w[4], w[5]);
-      std::copy(w, w + 6, lastT);
+      currentPoseTransfo = Utils::PoseToIsometry(w, this->Parameterization);
+      std::copy(w, w + poseSize, lastT);
     }
 
     // Compute absolute pose
@@ -423,7 +814,10 @@ struct LandmarkPositionResidual
   }
 
   // Factory to ease the construction of the auto-diff residual object
-  RESIDUAL_FACTORY(LandmarkPositionResidual, 3, 6)
+  POSE_RESIDUAL_FACTORY(LandmarkPositionResidual, 3)
+
+  // Parameterization of the pose parameters block
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
 
 private:
   const Eigen::Isometry3d RelativeTransform;
@@ -437,9 +831,10 @@ private:
  *        (rotation and translation) so that the absolute pose is consistent
  *        with a landmark detection (knowing its absolute pose)
  *
- * This function takes one 6D parameters block :
+ * This function takes one pose parameters block (cf. PoseParameterization) :
  *   - 3 first parameters to encode translation : X, Y, Z
  *   - 3 last parameters to encode rotation with Euler angles : rX, rY, rZ
+ *     (or 4 last parameters to encode rotation with quaternion : qX, qY, qZ, qW)
  *
  * It outputs a 6D residual block.
  */
@@ -464,11 +859,12 @@ struct LandmarkResidual
     // The idea is that all landmark residual functions will need to evaluate those
     // sin/cos so we only compute them once each time the parameters change.
     static Isometry3T currentPoseTransfo = Isometry3T::Identity();
-    static T lastT[6] = {T(-1.)};
-    if (!std::equal(w, w + 6, lastT))
+    static T lastT[7] = {T(-1.)};
+    const int poseSize = CeresTools::PoseParametersSize(this->Parameterization);
+    if (!std::equal(w, w + poseSize, lastT))
     {
-      currentPoseTransfo = Utils::XYZRPYtoIsometry(w[0], w[1], w[2], w[3], w[4], w[5]);
-      std::copy(w, w + 6, lastT);
+      currentPoseTransfo = Utils::PoseToIsometry(w, this->Parameterization);
+      std::copy(w, w + poseSize, lastT);
     }
 
     // Compute absolute pose
@@ -483,7 +879,10 @@ struct LandmarkResidual
   }
 
   // Factory to ease the construction of the auto-diff residual object
-  RESIDUAL_FACTORY(LandmarkResidual, 6, 6)
+  POSE_RESIDUAL_FACTORY(LandmarkResidual, 6)
+
+  // Parameterization of the pose parameters block
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
 
 private:
   const Eigen::Isometry3d RelativeTransform;
@@ -532,6 +931,196 @@ private:
 
 namespace CeresTools
 {
+//------------------------------------------------------------------------------
+/*!
+ * @brief Tukey loss scaled by a weight, which can be re-parameterized in place.
+ *
+ * It is equivalent to ceres::ScaledLoss(ceres::TukeyLoss(a), weight) with
+ * Ceres >= 2.0.0, applied on residual square:
+ *   rho(residual^2) = weight * a^2 / 3 * ( 1 - (1 - residual^2 / a^2)^3 )   for residual^2 <= a^2,
+ *   rho(residual^2) = weight * a^2 / 3                                      for residual^2 >  a^2.
+ * NOTE: In Ceres versions < 2.0.0, ceres::TukeyLoss is badly implemented (half
+ * of this value), see https://github.com/ceres-solver/ceres-solver/commit/6da364713f5b78ddf15b0e0ad92c76362c7c7683
+ * This implementation does not depend on the Ceres version.
+ */
+class ScaledTukeyLoss : public ceres::LossFunction
+{
+public:
+  ScaledTukeyLoss(double a = 1., double weight = 1.) { this->SetParameters(a, weight); }
+
+  void SetParameters(double a, double weight)
+  {
+    this->SqA = a * a;
+    this->Weight = weight;
+  }
+
+  void Evaluate(double sqResidual, double rho[3]) const override
+  {
+    // Inlier region
+    if (sqResidual <= this->SqA)
+    {
+      const double value = 1. - sqResidual / this->SqA;
+      const double sqValue = value * value;
+      rho[0] = this->Weight * this->SqA / 3. * (1. - sqValue * value);
+      rho[1] = this->Weight * sqValue;
+      rho[2] = this->Weight * -2. / this->SqA * value;
+    }
+    // Outlier region
+    else
+    {
+      rho[0] = this->Weight * this->SqA / 3.;
+      rho[1] = 0.;
+      rho[2] = 0.;
+    }
+  }
+
+private:
+  double SqA;
+  double Weight;
+};
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Pool of robustified point-to-model residuals, recycled from one
+ *        matching step to the next one to avoid allocating new cost and loss
+ *        functions for each match.
+ *
+ * The n-th residual is re-parameterized in place at each Get(n, ...) call :
+ * all residuals previously got from the pool (e.g. added to a Ceres problem)
+ * then refer to the new matches parameters.
+ * Different indices can be got concurrently, as long as Reserve() has been
+ * called beforehand to allocate enough residuals.
+ */
+class ResidualsPool
+{
+public:
+
+  //! Make sure that at least n residuals are allocated, for a given pose parameterization
+  void Reserve(size_t n, PoseParameterization parameterization = PoseParameterization::EULER_ANGLES)
+  {
+    // The residuals of another parameterization can not be recycled
+    if (parameterization != this->Parameterization)
+    {
+      this->Entries.clear();
+      this->Parameterization = parameterization;
+    }
+
+    using Functor = CeresCostFunctions::MahalanobisDistanceAffineIsometryResidual;
+    while (this->Entries.size() < n)
+    {
+      Entry entry;
+      entry.Functor = new Functor(Eigen::Matrix3d::Zero(), Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero());
+      entry.Functor->Parameterization = parameterization;
+      entry.Loss = std::make_shared<ScaledTukeyLoss>();
+      // The cost function takes ownership of the functor
+      if (parameterization == PoseParameterization::QUATERNION)
+        entry.Res.Cost = std::make_shared<ceres::AutoDiffCostFunction<Functor, 3, 7>>(entry.Functor);
+      else
+        entry.Res.Cost = std::make_shared<ceres::AutoDiffCostFunction<Functor, 3, 6>>(entry.Functor);
+      entry.Res.Robustifier = entry.Loss;
+      this->Entries.push_back(std::move(entry));
+    }
+  }
+
+  //! Get the number of allocated residuals
+  size_t Size() const { return this->Entries.size(); }
+
+  //! Re-parameterize the n-th residual (cf. MahalanobisDistanceAffineIsometryResidual
+  //! and ScaledTukeyLoss) and return it. n must be lower than Size().
+  const Residual& Get(size_t n, const Eigen::Matrix3d& A, const Eigen::Vector3d& P, const Eigen::Vector3d& X,
+                      double saturationDistance, double weight)
+  {
+    Entry& entry = this->Entries[n];
+    entry.Functor->SetParameters(A, P, X);
+    entry.Loss->SetParameters(saturationDistance, weight);
+    return entry.Res;
+  }
+
+private:
+
+  struct Entry
+  {
+    Residual Res;
+    CeresCostFunctions::MahalanobisDistanceAffineIsometryResidual* Functor = nullptr;  ///< Owned by Res.Cost
+    std::shared_ptr<ScaledTukeyLoss> Loss;                                               ///< Shared with Res.Robustifier
+  };
+
+  std::vector<Entry> Entries;
+
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
+};
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Local parameterization of a pose parameters block with quaternion
+ * (X, Y, Z, qX, qY, qZ, qW, cf. PoseParameterization::QUATERNION).
+ *
+ * The pose is updated in its tangent space, with a translation increment and
+ * a rotation vector increment w expressed in world frame :
+ *   T <- T + dT,  q <- exp(w) * q
+ * In 2D mode, only X, Y and the rotation around world Z axis are updated, so
+ * that Z, roll and pitch are held constant.
+ */
+class PoseQuaternionParameterization : public ceres::LocalParameterization
+{
+public:
+
+  PoseQuaternionParameterization(bool twoDMode = false)
+    : TwoDMode(twoDMode)
+  {}
+
+  bool Plus(const double* x, const double* delta, double* xPlusDelta) const override
+  {
+    // Full 6D increment (dX, dY, dZ, wX, wY, wZ)
+    Eigen::Matrix<double, 6, 1> d;
+    if (this->TwoDMode)
+      d << delta[0], delta[1], 0., 0., 0., delta[2];
+    else
+      d = Eigen::Map<const Eigen::Matrix<double, 6, 1>>(delta);
+
+    Eigen::Map<const Eigen::Vector3d> t(x);
+    Eigen::Map<const Eigen::Quaterniond> q(x + 3);
+    Eigen::Map<Eigen::Vector3d> newT(xPlusDelta);
+    Eigen::Map<Eigen::Quaterniond> newQ(xPlusDelta + 3);
+
+    newT = t + d.head<3>();
+    const Eigen::Vector3d w = d.tail<3>();
+    const double angle = w.norm();
+    const Eigen::Quaterniond dq = angle > 1e-12 ? Eigen::Quaterniond(Eigen::AngleAxisd(angle, w / angle))
+                                                : Eigen::Quaterniond(1., 0.5 * w.x(), 0.5 * w.y(), 0.5 * w.z());
+    newQ = (dq * q).normalized();
+    return true;
+  }
+
+  bool ComputeJacobian(const double* x, double* jacobian) const override
+  {
+    // Row-major (7 x LocalSize) jacobian of Plus(x, delta) wrt delta at delta = 0
+    const double qx = x[3], qy = x[4], qz = x[5], qw = x[6];
+    Eigen::Map<Eigen::Matrix<double, 7, Eigen::Dynamic, Eigen::RowMajor>> J(jacobian, 7, this->LocalSize());
+    J.setZero();
+    if (this->TwoDMode)
+    {
+      J(0, 0) = J(1, 1) = 1.;
+      J.block<4, 1>(3, 2) << -0.5 * qy, 0.5 * qx, 0.5 * qw, -0.5 * qz;
+    }
+    else
+    {
+      J.topLeftCorner<3, 3>().setIdentity();
+      J.bottomRightCorner<4, 3>() << 0.5 * qw,  0.5 * qz, -0.5 * qy,
+                                    -0.5 * qz,  0.5 * qw,  0.5 * qx,
+                                     0.5 * qy, -0.5 * qx,  0.5 * qw,
+                                    -0.5 * qx, -0.5 * qy, -0.5 * qz;
+    }
+    return true;
+  }
+
+  int GlobalSize() const override { return 7; }
+  int LocalSize() const override { return this->TwoDMode ? 3 : 6; }
+
+private:
+  bool TwoDMode;
+};
+
 //------------------------------------------------------------------------------
 /*!
  * @brief Rotate a covariance to change the reference frame
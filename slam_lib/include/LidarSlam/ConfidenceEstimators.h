@@ -50,5 +50,20 @@ float LCPEstimator(PointCloud::ConstPtr cloud,
                    float subsamplingRatio = 1.,
                    int nbThreads = 1);
 
+// Compute the LCP estimator (overlap estimator) for the registration of a
+// pointcloud onto some prebuilt maps, by checking the occupancy of the maps voxels.
+// It corresponds to the ratio of points from cloud which fall in an occupied
+// inner voxel (of the maps leaf size) of any of the maps.
+// Contrary to LCPEstimator(), no nearest neighbor is searched, only hash
+// lookups are performed : the overlap can be estimated on all points, and the
+// maps KD-trees are not needed. This estimator is not smoothed by the distance
+// to the neighbors, and the prior maps points are not considered.
+// It returns a valid overlap value between 0 and 1, or -1 if the overlap could
+// not be computed (not enough points).
+float OccupancyLCPEstimator(PointCloud::ConstPtr cloud,
+                            const std::map<Keypoint, std::shared_ptr<RollingGrid>>& maps,
+                            float subsamplingRatio = 1.,
+                            int nbThreads = 1);
+
 } // enf of Confidence namespace
 } // end of LidarSlam namespace
\ No newline at end of file
@@ -141,4 +141,120 @@ enum class SamplingMode
   CENTROID = 4
 };
 
+//------------------------------------------------------------------------------
+//! How to match the current keypoints with the maps during Localization
+enum class RegistrationEngine
+{
+  //! Extract a local sub-map and build its KD-tree, then search the nearest
+  //! neighbors of each keypoint and fit a line/plane/blob model on them.
+  //! Precise, but the KD-tree is rebuilt each time the map is updated.
+  KNN_PCA = 0,
+
+  //! Fit the line/plane/blob model of each keypoint on the statistics (mean
+  //! and covariance) of all the points which fell in the map voxels around it,
+  //! updated incrementally when adding points to the maps (NDT-like).
+  //! No KD-tree is built nor searched, which greatly reduces latency, but the
+  //! models are coarser and the prior maps are not used.
+  VOXEL_GAUSSIAN = 1
+};
+
+//------------------------------------------------------------------------------
+//! How to optimize the pose from the matches and sensors constraints
+enum class PoseSolver
+{
+  //! Generic Ceres Levenberg-Marquardt solver
+  CERES = 0,
+
+  //! Dedicated Levenberg-Marquardt solver of the 6-DoF pose : the 6x6 normal
+  //! equations are accumulated in parallel and solved in closed form.
+  //! In 2D mode, only the 3x3 planar normal equations (X, Y, rZ) are built.
+  //! Ceres is used as a fallback if this solver fails.
+  DENSE_LM = 1
+};
+
+//------------------------------------------------------------------------------
+//! How to parameterize the pose to optimize
+enum class PoseParameterization
+{
+  //! 6 parameters : translation X, Y, Z and Euler angles rX, rY, rZ.
+  //! The rotation is updated additively on the Euler angles, which are
+  //! singular for a pitch of +/-90°.
+  EULER_ANGLES = 0,
+
+  //! 7 parameters : translation X, Y, Z and unit quaternion qX, qY, qZ, qW.
+  //! The rotation is updated on the SO(3) manifold, with a rotation vector
+  //! increment in world frame : no singularity, and no trigonometric functions
+  //! to evaluate in the residuals.
+  QUATERNION = 1
+};
+
+//------------------------------------------------------------------------------
+//! How to search the nearest neighbors of the keypoints in a map
+enum class NeighborSearchBackend
+{
+  //! Build a KD-tree on the sub-map extracted around the current frame.
+  //! Exact search, but the KD-tree is rebuilt each time the map is updated.
+  KD_TREE = 0,
+
+  //! Maintain a hashed voxel grid of the map points (iVox-like), updated
+  //! incrementally when points are added or removed, without any rebuild.
+  //! The search is approximate : only the neighboring voxels are scanned.
+  HASHED_VOXELS = 1
+};
+
+//------------------------------------------------------------------------------
+//! How to estimate the overlap of the registered frame on the maps
+enum class OverlapEstimator
+{
+  //! Search the nearest neighbor of each point in the maps KD-trees, and
+  //! weight it by a gaussian of its distance (smooth LCP estimator).
+  //! Precise, but a KD-tree search is needed for each point.
+  NEAREST_NEIGHBOR = 0,
+
+  //! Check if each point falls in an occupied voxel of the maps (LCP estimator
+  //! at the maps leaf size resolution). Only hash lookups are needed, which
+  //! allows to estimate the overlap on all points of each frame.
+  //! NOTE: The prior maps points are not stored in the voxels : if a prior map
+  //! is used, NEAREST_NEIGHBOR is used instead.
+  VOXEL_OCCUPANCY = 1
+};
+
+//------------------------------------------------------------------------------
+//! How to free memory when the SLAM memory budget is exceeded
+// The policies are applied in the user-defined order, until the memory usage
+// fits the budget again.
+enum class MemoryEvictionPolicy
+{
+  //! Compress the keypoints of the oldest logged states using octree compression
+  //! This reduces about 5 times their memory consumption, but slows down PGO.
+  //! NOTE: The compression is done synchronously, in the frame processing,
+  //! which may delay the frames during which the budget is exceeded.
+  COMPRESS_OLD_STATES = 0,
+
+  //! Drop the keypoints of the oldest logged states that have not been added
+  //! to the maps (non keyframes). Their poses are kept.
+  //! NOTE: This has no effect if the maps are not updated (MappingMode::NONE),
+  //! as all logged states keypoints may then be needed to rebuild the maps.
+  DROP_NON_KEYFRAME_CLOUDS = 1,
+
+  //! Remove the map voxels which are the farthest from the current pose
+  //! The removed areas of the maps are lost (as when rolling the maps)
+  DROP_FAR_MAP_VOXELS = 2
+};
+
+//------------------------------------------------------------------------------
+//! SLAM subsystems which memory usage is monitored
+enum class MemorySubsystem
+{
+  LOGGED_STATES = 0,  ///< keypoints of the logged states
+  MAPS = 1,           ///< voxels of the keypoints maps
+  SUBMAPS = 2,        ///< submaps extracted from the maps and their KD-trees
+  PRIOR_MAPS = 3      ///< read-only prior maps and their KD-trees
+};
+
+static const std::map<MemorySubsystem, std::string> MemorySubsystemNames = { {MemorySubsystem::LOGGED_STATES, "Logged states"},
+                                                                             {MemorySubsystem::MAPS,          "Maps"},
+                                                                             {MemorySubsystem::SUBMAPS,       "Submaps"},
+                                                                             {MemorySubsystem::PRIOR_MAPS,    "Prior maps"} };
+
 } // end of LidarSlam namespace
\ No newline at end of file
@@ -87,6 +87,9 @@ public:
   GetSensorMacro(TimeThreshold, double)
   SetSensorMacro(TimeThreshold, double)
 
+  GetSensorMacro(Parameterization, PoseParameterization)
+  SetSensorMacro(Parameterization, PoseParameterization)
+
   GetSensorMacro(MaxMeasures, unsigned int)
   void SetMaxMeasures(unsigned int maxMeas)
   {
@@ -224,6 +227,8 @@ protected:
   double TimeOffset = 0.;
   // Time threshold between 2 measures to consider they can be interpolated
   double TimeThreshold = 0.5;
+  // Parameterization of the pose optimized by the residual
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
   // Resulting residual
   CeresTools::Residual Residual;
   // Mutex to handle the data from outside the library
@@ -0,0 +1,240 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-16
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+#pragma once
+
+#include "LidarSlam/NeighborSearch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace LidarSlam
+{
+
+/*!
+ * @brief Nearest neighbors search structure based on a hashed voxel grid
+ * (iVox-like), which can be updated incrementally.
+ *
+ * The points are stored in a pointcloud, and each voxel of the hashed grid
+ * holds the small list of the indices of the points lying in it.
+ * Points can be inserted, moved or removed in O(1), without rebuilding
+ * the structure. The indices of the points are stable : the slots of the
+ * removed points are reused by the next inserted points.
+ *
+ * The KNN search is approximate : only the points lying in the voxels up to
+ * SearchRadius voxels away from the query voxel are considered. The result is
+ * exact for neighbors closer than SearchRadius * Resolution.
+ */
+template<typename PointT>
+class HashedVoxelSearch : public NeighborSearch<PointT>
+{
+public:
+
+  using PointCloud = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloud::Ptr;
+
+  //! Create an empty structure with a given voxel size [m] and search radius [voxels]
+  HashedVoxelSearch(double resolution = 1., int searchRadius = 1)
+    : Cloud(new PointCloud)
+    , Resolution(resolution)
+    , SearchRadius(searchRadius)
+  {}
+
+  //! Remove all points
+  void Clear()
+  {
+    this->Cloud->clear();
+    this->Voxels.clear();
+    this->FreeSlots.clear();
+  }
+
+  //! Get the number of points stored
+  size_t Size() const override { return this->Cloud->size() - this->FreeSlots.size(); }
+
+  //! The indices of the removed points are not used until they are reused
+  size_t GetIndicesRange() const override { return this->Cloud->size(); }
+
+  const PointT& GetPoint(int index) const override { return (*this->Cloud)[index]; }
+
+  double GetResolution() const { return this->Resolution; }
+  int GetSearchRadius() const { return this->SearchRadius; }
+
+  //! Insert a point, and return its index
+  int Insert(const PointT& point)
+  {
+    int index;
+    if (this->FreeSlots.empty())
+    {
+      index = this->Cloud->size();
+      this->Cloud->push_back(point);
+    }
+    else
+    {
+      index = this->FreeSlots.back();
+      this->FreeSlots.pop_back();
+      (*this->Cloud)[index] = point;
+    }
+    this->Voxels[this->Key(point.data)].push_back(index);
+    return index;
+  }
+
+  //! Replace the point stored at a given index
+  void Update(int index, const PointT& point)
+  {
+    PointT& previous = (*this->Cloud)[index];
+    uint64_t previousKey = this->Key(previous.data);
+    uint64_t key = this->Key(point.data);
+    if (key != previousKey)
+    {
+      this->RemoveFromVoxel(previousKey, index);
+      this->Voxels[key].push_back(index);
+    }
+    previous = point;
+  }
+
+  //! Remove the point stored at a given index
+  void Remove(int index)
+  {
+    PointT& point = (*this->Cloud)[index];
+    this->RemoveFromVoxel(this->Key(point.data), index);
+    // Invalidate the removed point, its slot will be reused by the next insertion
+    point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN();
+    this->FreeSlots.push_back(index);
+  }
+
+  size_t KnnSearch(const float queryPoint[3], int knearest, int* knnIndices, float* knnSqDistances,
+                   float eps = 0.f) const override
+  {
+    (void)eps;
+    if (knearest <= 0)
+      return 0;
+
+    // Scan the neighboring voxels and keep the k nearest points,
+    // sorted by increasing distance (insertion sort)
+    int count = 0;
+    int center[3];
+    for (int d = 0; d < 3; ++d)
+      center[d] = static_cast<int>(std::floor(queryPoint[d] / this->Resolution));
+    const int r = this->SearchRadius;
+    for (int dz = -r; dz <= r; ++dz)
+    {
+      for (int dy = -r; dy <= r; ++dy)
+      {
+        for (int dx = -r; dx <= r; ++dx)
+        {
+          auto it = this->Voxels.find(this->Key(center[0] + dx, center[1] + dy, center[2] + dz));
+          if (it == this->Voxels.end())
+            continue;
+          for (int index : it->second)
+          {
+            const PointT& p = (*this->Cloud)[index];
+            float sqDist = (p.x - queryPoint[0]) * (p.x - queryPoint[0]) +
+                           (p.y - queryPoint[1]) * (p.y - queryPoint[1]) +
+                           (p.z - queryPoint[2]) * (p.z - queryPoint[2]);
+            if (count == knearest && sqDist >= knnSqDistances[count - 1])
+              continue;
+            int i = (count < knearest) ? count++ : count - 1;
+            for (; i > 0 && knnSqDistances[i - 1] > sqDist; --i)
+            {
+              knnSqDistances[i] = knnSqDistances[i - 1];
+              knnIndices[i] = knnIndices[i - 1];
+            }
+            knnSqDistances[i] = sqDist;
+            knnIndices[i] = index;
+          }
+        }
+      }
+    }
+    return count;
+  }
+
+  //! The removed points are kept as NaN slots in the stored cloud,
+  //! which is therefore not exposed : use GetPoint() on the searched indices.
+  PointCloudPtr GetInputCloud() const override
+  {
+    return PointCloudPtr();
+  }
+
+  size_t GetMemorySize() const override
+  {
+    // Each voxel is stored in a hash map node (key, value and next pointer)
+    // with an additional bucket pointer, and holds a list of indices
+    constexpr size_t nodeSize = sizeof(typename VoxelsMap::value_type) + 2 * sizeof(void*);
+    size_t memory = this->Voxels.size() * nodeSize + this->FreeSlots.capacity() * sizeof(int);
+    for (const auto& voxel : this->Voxels)
+      memory += voxel.second.capacity() * sizeof(int);
+    return memory;
+  }
+
+private:
+
+  using VoxelsMap = std::unordered_map<uint64_t, std::vector<int>>;
+
+  //! Hash key of the voxel of integer coordinates (x, y, z) (21 bits per axis)
+  static uint64_t Key(int x, int y, int z)
+  {
+    constexpr uint64_t mask = (1 << 21) - 1;
+    return ((static_cast<uint64_t>(x) & mask) << 42) | ((static_cast<uint64_t>(y) & mask) << 21) | (static_cast<uint64_t>(z) & mask);
+  }
+
+  //! Hash key of the voxel containing a point
+  uint64_t Key(const float* point) const
+  {
+    return Key(static_cast<int>(std::floor(point[0] / this->Resolution)),
+               static_cast<int>(std::floor(point[1] / this->Resolution)),
+               static_cast<int>(std::floor(point[2] / this->Resolution)));
+  }
+
+  //! Remove an index from the list of a voxel
+  void RemoveFromVoxel(uint64_t key, int index)
+  {
+    auto it = this->Voxels.find(key);
+    if (it == this->Voxels.end())
+      return;
+    std::vector<int>& indices = it->second;
+    auto itIndex = std::find(indices.begin(), indices.end(), index);
+    if (itIndex != indices.end())
+    {
+      *itIndex = indices.back();
+      indices.pop_back();
+    }
+    if (indices.empty())
+      this->Voxels.erase(it);
+  }
+
+  //! Points stored (the removed ones are NaN, their slots are listed in FreeSlots)
+  PointCloudPtr Cloud;
+
+  //! Indices of the points lying in each voxel
+  VoxelsMap Voxels;
+
+  //! Indices of the removed points, to be reused
+  std::vector<int> FreeSlots;
+
+  //! [m] Size of the voxels
+  double Resolution;
+
+  //! [voxels] Number of voxels to scan around the query voxel in each direction
+  int SearchRadius;
+};
+
+} // end of LidarSlam namespace
@@ -19,14 +19,27 @@
 
 #pragma once
 
+#include "LidarSlam/NeighborSearch.h"
+
 #include <nanoflann.hpp>
 #include <pcl/point_cloud.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace LidarSlam
 {
 
 template<typename PointT>
-class KDTreePCLAdaptor
+class KDTreePCLAdaptor : public NeighborSearch<PointT>
 {
   using Point = PointT;
   using PointCloud = pcl::PointCloud<Point>;
@@ -58,27 +71,175 @@ public:
   {
     // Copy the input cloud
     this->Cloud = cloud;
+    this->LeafMaxSize = leafMaxSize;
 
     // Build KD-tree
     this->Index = std::make_unique<index_t>(3, *this, nanoflann::KDTreeSingleIndexAdaptorParams(leafMaxSize));
     this->Index->buildIndex();
   }
 
+  /**
+    * \brief Get the approximate [bytes] memory used by the index
+    * (not including the input pointcloud).
+    */
+  size_t GetMemorySize() const override
+  {
+    return this->Index ? this->Index->usedMemory(*this->Index) : 0;
+  }
+
+  /**
+    * \brief Save the built index to a binary file, to be reloaded later with LoadIndex().
+    * \param path The file to write.
+    * \return true if the index has been successfully written.
+    *
+    * \note The file contains a checksum of the input pointcloud, so that the
+    * index can only be reloaded with the exact same pointcloud, and a checksum
+    * of the serialized index, so that a corrupted index is never loaded.
+    */
+  bool SaveIndex(const std::string& path) const
+  {
+    IndexFileHeader header = this->ComputeHeader(this->LeafMaxSize);
+    IndexPayload payload = {0, FNV_OFFSET_BASIS};
+    try
+    {
+      #if NANOFLANN_VERSION < 0x150
+      FilePtr file(std::fopen(path.c_str(), "wb+"), &std::fclose);
+      if (!file)
+        return false;
+      bool success = std::fwrite(&header, sizeof(header), 1, file.get()) == 1 &&
+                     std::fwrite(&payload, sizeof(payload), 1, file.get()) == 1;
+      const long start = std::ftell(file.get());
+      if (success)
+        this->Index->saveIndex(file.get());
+      const long end = std::ftell(file.get());
+      // Hash the written index, and store its size and checksum before it
+      success = success && start >= 0 && end >= start &&
+                std::fseek(file.get(), start, SEEK_SET) == 0 &&
+                HashFile(file.get(), end - start, payload.Checksum);
+      payload.Size = end - start;
+      success = success && std::fseek(file.get(), sizeof(header), SEEK_SET) == 0 &&
+                std::fwrite(&payload, sizeof(payload), 1, file.get()) == 1;
+      success = success && !std::ferror(file.get());
+      // Close the file explicitly to check that the buffered data has been written
+      return (std::fclose(file.release()) == 0) && success;
+      #else
+      std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!file)
+        return false;
+      file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      file.write(reinterpret_cast<const char*>(&payload), sizeof(payload));
+      const std::streamoff start = file.tellp();
+      this->Index->saveIndex(file);
+      const std::streamoff end = file.tellp();
+      // Hash the written index, and store its size and checksum before it
+      payload.Size = end - start;
+      bool success = file.good() && file.seekg(start) && HashFile(file, payload.Size, payload.Checksum);
+      file.seekp(sizeof(header));
+      file.write(reinterpret_cast<const char*>(&payload), sizeof(payload));
+      return success && file.good();
+      #endif
+    }
+    catch (const std::exception&)
+    {
+      return false;
+    }
+  }
+
+  /**
+    * \brief Init the Kd-tree from a given pointcloud, loading its index from a
+    * file previously written by SaveIndex() instead of building it.
+    * \param cloud The pointcloud to encode in the kd-tree.
+    * \param path The index file to read.
+    * \param leafMaxSize The maximum size of a leaf of the tree.
+    * \return true if the index has been loaded, false if it has been rebuilt
+    * because the file is missing, corrupted or does not match the pointcloud.
+    *
+    * \note In all cases, the kd-tree is valid after this call.
+    */
+  bool LoadIndex(PointCloudPtr cloud, const std::string& path, int leafMaxSize = 16)
+  {
+    this->Cloud = cloud;
+    this->LeafMaxSize = leafMaxSize;
+    IndexFileHeader expectedHeader = this->ComputeHeader(leafMaxSize);
+    IndexFileHeader header;
+    IndexPayload payload;
+    uint64_t checksum = FNV_OFFSET_BASIS;
+    bool success = false;
+    try
+    {
+      // The serialized index is checked before being loaded, as nanoflann
+      // trusts the stored sizes and indices.
+      #if NANOFLANN_VERSION < 0x150
+      FilePtr file(std::fopen(path.c_str(), "rb"), &std::fclose);
+      if (file &&
+          std::fread(&header, sizeof(header), 1, file.get()) == 1 &&
+          std::memcmp(&header, &expectedHeader, sizeof(header)) == 0 &&
+          std::fread(&payload, sizeof(payload), 1, file.get()) == 1)
+      {
+        const long start = std::ftell(file.get());
+        if (start >= 0 &&
+            HashFile(file.get(), payload.Size, checksum) && checksum == payload.Checksum &&
+            std::fseek(file.get(), start, SEEK_SET) == 0)
+        {
+          this->Index = std::make_unique<index_t>(3, *this, nanoflann::KDTreeSingleIndexAdaptorParams(leafMaxSize));
+          this->Index->loadIndex(file.get());
+          // The index must have been read exactly
+          success = !std::ferror(file.get()) && static_cast<uint64_t>(std::ftell(file.get()) - start) == payload.Size;
+        }
+      }
+      #else
+      std::ifstream file(path, std::ios::binary);
+      if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+          std::memcmp(&header, &expectedHeader, sizeof(header)) == 0 &&
+          file.read(reinterpret_cast<char*>(&payload), sizeof(payload)))
+      {
+        const std::streamoff start = file.tellg();
+        if (HashFile(file, payload.Size, checksum) && checksum == payload.Checksum && file.seekg(start))
+        {
+          this->Index = std::make_unique<index_t>(3, *this, nanoflann::KDTreeSingleIndexAdaptorParams(leafMaxSize,
+                                                            nanoflann::KDTreeSingleIndexAdaptorFlags::SkipInitialBuildIndex));
+          this->Index->loadIndex(file);
+          // The index must have been read exactly
+          success = file.good() && static_cast<uint64_t>(file.tellg() - start) == payload.Size;
+        }
+      }
+      #endif
+      success = success && this->HasValidIndices();
+    }
+    catch (const std::exception&)
+    {
+      success = false;
+    }
+
+    // Fallback to standard build
+    if (!success)
+      this->Reset(cloud, leafMaxSize);
+    return success;
+  }
+
   /**
     * \brief Finds the `K` nearest neighbors points in the KD-tree to a given query point.
     * \param[in] queryPoint Input point to look closest neighbors to.
     * \param[in] knearest Number of nearest neighbors to find.
     * \param[out] knnIndices Indices of the NN.
     * \param[out] knnSqDistances Squared distances of the NN to the query point.
+    * \param[in] eps Relative error allowed on the neighbors distances, to speed up
+    * the search (approximate NN). The i-th returned neighbor is at most (1 + eps)
+    * times farther than the exact i-th nearest neighbor. If 0, the search is exact.
     * \return Number `N` of neighbors found.
     *
     * \note Only the first `N` entries in `knnIndices` and `knnSqDistances` will
     * be valid. Return may be less than `knearest` only if the number of
     * elements in the tree is less than `knearest`.
     */
-  inline size_t KnnSearch(const float queryPoint[3], int knearest, int* knnIndices, float* knnSqDistances) const
+  inline size_t KnnSearch(const float queryPoint[3], int knearest, int* knnIndices, float* knnSqDistances, float eps = 0.f) const override
   {
-    return this->Index->knnSearch(queryPoint, knearest, knnIndices, knnSqDistances);
+    if (eps <= 0.f)
+      return this->Index->knnSearch(queryPoint, knearest, knnIndices, knnSqDistances);
+    nanoflann::KNNResultSet<float, int, size_t> resultSet(knearest);
+    resultSet.init(knnIndices, knnSqDistances);
+    this->FindNeighbors(resultSet, queryPoint, eps);
+    return resultSet.size();
   }
   inline size_t KnnSearch(const float queryPoint[3], int knearest, std::vector<int>& knnIndices, std::vector<float>& knnSqDistances) const
   {
@@ -104,15 +265,116 @@ public:
     return this->KnnSearch(queryPoint.data, knearest, knnIndices, knnSqDistances);
   }
 
+  /**
+    * \brief Finds the `K` nearest neighbors of a batch of query points.
+    * \param[in] queryPoints Input points to look closest neighbors to, as a
+    *            flat array [x0, y0, z0, x1, y1, z1, ...] of 3 * nbQueries values.
+    * \param[in] nbQueries Number of query points.
+    * \param[in] knearest Number of nearest neighbors to find for each query.
+    * \param[out] knnIndices Preallocated flat array of nbQueries * knearest
+    *             indices. The NN of query i are stored from i * knearest.
+    * \param[out] knnSqDistances Preallocated flat array of nbQueries * knearest
+    *             squared distances, with the same layout as knnIndices.
+    * \param[out] knnCounts Preallocated array of nbQueries numbers of neighbors found.
+    * \param[in] nbThreads Max number of threads to use.
+    * \param[in] eps Relative error allowed on the neighbors distances (cf. KnnSearch()).
+    * \param[in] maxDistances Optional array of nbQueries upper bounds of the
+    *            distance to the k-th neighbor of each query (e.g. guessed from
+    *            a previous search). Non-positive values are ignored.
+    *
+    * The results are the same as calling KnnSearch() on each query point, but:
+    *  - The queries are processed in Morton (Z-order) order, so that successive
+    *    queries traverse the same branches of the tree.
+    *  - The search of each query is bounded by the result of the previous one:
+    *    by triangle inequality, the k neighbors of query i-1 all lie within
+    *    d(i-1, k-th neighbor) + d(i-1, i) from query i, so the tree branches
+    *    farther than this bound can be pruned from the start. If the bounded
+    *    search fails, a standard search is performed.
+    *  - If given, the maxDistances bounds are used the same way.
+    */
+  void BatchKnnSearch(const float* queryPoints, size_t nbQueries, int knearest,
+                      int* knnIndices, float* knnSqDistances, size_t* knnCounts, int nbThreads = 1,
+                      float eps = 0.f, const float* maxDistances = nullptr) const override
+  {
+    if (!nbQueries || knearest <= 0)
+      return;
+
+    // Sort queries according to their Morton code
+    std::vector<size_t> order = MortonOrder(queryPoints, nbQueries);
+
+    // Process contiguous chunks of sorted queries, to keep spatial locality
+    // within each thread while balancing the load
+    const int chunkSize = 64;
+    const int nbChunks = (nbQueries + chunkSize - 1) / chunkSize;
+    #pragma omp parallel for num_threads(nbThreads) schedule(dynamic)
+    for (int chunk = 0; chunk < nbChunks; ++chunk)
+    {
+      const size_t begin = chunk * chunkSize;
+      const size_t end = std::min(begin + chunkSize, nbQueries);
+      const float* previousQuery = nullptr;
+      float previousDist = 0.f;
+      for (size_t i = begin; i < end; ++i)
+      {
+        const size_t q = order[i];
+        const float* query = queryPoints + 3 * q;
+        int* indices = knnIndices + q * knearest;
+        float* sqDists = knnSqDistances + q * knearest;
+
+        // Try a search bounded by previous query result or by the given bound
+        size_t count = 0;
+        float radius = std::numeric_limits<float>::infinity();
+        if (previousQuery)
+        {
+          float shift = std::sqrt((query[0] - previousQuery[0]) * (query[0] - previousQuery[0]) +
+                                  (query[1] - previousQuery[1]) * (query[1] - previousQuery[1]) +
+                                  (query[2] - previousQuery[2]) * (query[2] - previousQuery[2]));
+          radius = previousDist + shift;
+        }
+        if (maxDistances && maxDistances[q] > 0.f)
+          radius = std::min(radius, maxDistances[q]);
+        if (radius < std::numeric_limits<float>::infinity())
+        {
+          // Slightly inflate the bound to be robust to float rounding
+          BoundedKnnResultSet resultSet(knearest, radius * radius * 1.0001f + 1e-6f, indices, sqDists);
+          this->FindNeighbors(resultSet, query, eps);
+          count = resultSet.size();
+        }
+
+        // Standard search if no bound is available or if the bounded search failed
+        if (count < static_cast<size_t>(knearest))
+          count = this->KnnSearch(query, knearest, indices, sqDists, eps);
+
+        knnCounts[q] = count;
+        previousQuery = (count == static_cast<size_t>(knearest)) ? query : nullptr;
+        previousDist = count ? std::sqrt(sqDists[count - 1]) : 0.f;
+      }
+    }
+  }
+
   /**
     * \brief Get the input pointcloud.
     * \return The input pointcloud used to build KD-tree.
     */
-  inline PointCloudPtr GetInputCloud() const
+  inline PointCloudPtr GetInputCloud() const override
   {
     return this->Cloud;
   }
 
+  inline size_t Size() const override
+  {
+    return this->Cloud->size();
+  }
+
+  inline size_t GetIndicesRange() const override
+  {
+    return this->Cloud->size();
+  }
+
+  inline const Point& GetPoint(int index) const override
+  {
+    return this->Cloud->points[index];
+  }
+
   // ---------------------------------------------------------------------------
   //   Methods required by nanoflann adaptor design
   // ---------------------------------------------------------------------------
@@ -163,13 +425,217 @@ public:
     return false;
   }
 
+  //! Compute the order of points sorted along the Morton (Z-order) curve
+  //! (10 bits per axis, relatively to the bounding box of the points)
+  static std::vector<size_t> MortonOrder(const float* points, size_t nbPoints)
+  {
+    // Bounding box of the points
+    float minPt[3], maxPt[3];
+    for (int d = 0; d < 3; ++d)
+      minPt[d] = maxPt[d] = points[d];
+    for (size_t i = 1; i < nbPoints; ++i)
+    {
+      for (int d = 0; d < 3; ++d)
+      {
+        minPt[d] = std::min(minPt[d], points[3 * i + d]);
+        maxPt[d] = std::max(maxPt[d], points[3 * i + d]);
+      }
+    }
+    float scale = 0.f;
+    for (int d = 0; d < 3; ++d)
+      scale = std::max(scale, maxPt[d] - minPt[d]);
+    scale = scale > 0.f ? 1023.f / scale : 0.f;
+
+    // Spread the 10 bits of x over 30 bits, with 2 zeros between each bit
+    auto spreadBits = [](uint32_t x)
+    {
+      x = (x | (x << 16)) & 0x030000FF;
+      x = (x | (x <<  8)) & 0x0300F00F;
+      x = (x | (x <<  4)) & 0x030C30C3;
+      x = (x | (x <<  2)) & 0x09249249;
+      return x;
+    };
+    std::vector<std::pair<uint32_t, size_t>> codes(nbPoints);
+    for (size_t i = 0; i < nbPoints; ++i)
+    {
+      uint32_t code = 0;
+      for (int d = 0; d < 3; ++d)
+        code |= spreadBits(static_cast<uint32_t>((points[3 * i + d] - minPt[d]) * scale)) << d;
+      codes[i] = {code, i};
+    }
+    std::sort(codes.begin(), codes.end());
+
+    std::vector<size_t> order(nbPoints);
+    for (size_t i = 0; i < nbPoints; ++i)
+      order[i] = codes[i].second;
+    return order;
+  }
+
 protected:
 
+  //! KNN result set which search radius is bounded from the start.
+  //! It follows the nanoflann::KNNResultSet interface.
+  class BoundedKnnResultSet
+  {
+  public:
+    BoundedKnnResultSet(int capacity, float maxSqDist, int* indices, float* dists)
+      : Capacity(capacity), Indices(indices), Dists(dists)
+    {
+      this->Dists[this->Capacity - 1] = maxSqDist;
+    }
+
+    size_t size() const { return this->Count; }
+    bool full() const { return this->Count == this->Capacity; }
+    float worstDist() const { return this->Dists[this->Capacity - 1]; }
+
+    bool addPoint(float dist, int index)
+    {
+      // Insertion sort of the new neighbor
+      int i;
+      for (i = this->Count; i > 0 && this->Dists[i - 1] > dist; --i)
+      {
+        if (i < this->Capacity)
+        {
+          this->Dists[i] = this->Dists[i - 1];
+          this->Indices[i] = this->Indices[i - 1];
+        }
+      }
+      if (i < this->Capacity)
+      {
+        this->Dists[i] = dist;
+        this->Indices[i] = index;
+      }
+      if (this->Count < this->Capacity)
+        ++this->Count;
+      // Continue the search
+      return true;
+    }
+
+  private:
+    int Capacity;
+    int Count = 0;
+    int* Indices;
+    float* Dists;
+  };
+
+  //! Run a nanoflann search with a custom result set
+  //! (with an optional relative error allowed on the distances)
+  template<typename ResultSet>
+  void FindNeighbors(ResultSet& resultSet, const float queryPoint[3], float eps = 0.f) const
+  {
+    #if NANOFLANN_VERSION < 0x150
+    this->Index->findNeighbors(resultSet, queryPoint, nanoflann::SearchParams(32, eps));
+    #else
+    this->Index->findNeighbors(resultSet, queryPoint, nanoflann::SearchParameters(eps));
+    #endif
+  }
+
+  //! File handle closed when going out of scope (even if an exception is thrown)
+  using FilePtr = std::unique_ptr<FILE, decltype(&std::fclose)>;
+
+  //! Header of the index files, used to check that the index matches the pointcloud
+  struct IndexFileHeader
+  {
+    char Magic[8];
+    uint32_t FormatVersion;
+    uint32_t NanoflannVersion;
+    uint64_t NbPoints;
+    int64_t LeafMaxSize;
+    uint64_t Checksum;
+  };
+
+  //! Size and checksum of the serialized index, stored after the header
+  struct IndexPayload
+  {
+    uint64_t Size;
+    uint64_t Checksum;
+  };
+
+  //! FNV-1a hash parameters
+  static constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+  static constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+  //! Update a FNV-1a hash with some bytes
+  static void HashBytes(uint64_t& hash, const void* data, size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= FNV_PRIME;
+    }
+  }
+
+  //! Update a FNV-1a hash with the next bytes of a file.
+  //! Returns false if the file is shorter than size.
+  #if NANOFLANN_VERSION < 0x150
+  static bool HashFile(FILE* file, uint64_t size, uint64_t& hash)
+  {
+    char buffer[4096];
+    while (size > 0)
+    {
+      size_t chunk = std::min<uint64_t>(size, sizeof(buffer));
+      if (std::fread(buffer, 1, chunk, file) != chunk)
+        return false;
+      HashBytes(hash, buffer, chunk);
+      size -= chunk;
+    }
+    return true;
+  }
+  #else
+  static bool HashFile(std::istream& file, uint64_t size, uint64_t& hash)
+  {
+    char buffer[4096];
+    while (size > 0)
+    {
+      size_t chunk = std::min<uint64_t>(size, sizeof(buffer));
+      if (!file.read(buffer, chunk))
+        return false;
+      HashBytes(hash, buffer, chunk);
+      size -= chunk;
+    }
+    return true;
+  }
+  #endif
+
+  //! Compute the expected index file header of the current pointcloud
+  IndexFileHeader ComputeHeader(int leafMaxSize) const
+  {
+    IndexFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.Magic, "LSKDTREE", sizeof(header.Magic));
+    header.FormatVersion = 2;
+    header.NanoflannVersion = NANOFLANN_VERSION;
+    header.NbPoints = this->Cloud->size();
+    header.LeafMaxSize = leafMaxSize;
+    // FNV-1a hash of the points coordinates
+    header.Checksum = FNV_OFFSET_BASIS;
+    for (const Point& point : *this->Cloud)
+      HashBytes(header.Checksum, point.data, 3 * sizeof(float));
+    return header;
+  }
+
+  //! Check that the index only refers to points of the pointcloud
+  bool HasValidIndices() const
+  {
+    #if NANOFLANN_VERSION < 0x150
+    const auto& indices = this->Index->vind;
+    #else
+    const auto& indices = this->Index->vAcc_;
+    #endif
+    const int nbPoints = this->Cloud->size();
+    return indices.size() == this->Cloud->size() &&
+           std::all_of(indices.begin(), indices.end(), [nbPoints](int i) { return i >= 0 && i < nbPoints; });
+  }
+
   //! The kd-tree index for the user to call its methods as usual with any other FLANN index.
   std::unique_ptr<index_t> Index;
 
   //! The input data
   PointCloudPtr Cloud;
+
+  //! The maximum size of a leaf of the tree
+  int LeafMaxSize = 16;
 };
 
 } // end of LidarSlam namespace
\ No newline at end of file
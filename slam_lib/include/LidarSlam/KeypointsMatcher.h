@@ -24,6 +24,8 @@
 #include "LidarSlam/MotionModel.h"
 #include "LidarSlam/Utilities.h"
 #include "LidarSlam/Enums.h"
+#include "LidarSlam/NeighborhoodModelCache.h"
+#include "LidarSlam/RollingGrid.h"
 
 #include <Eigen/Dense>
 #include <pcl/point_cloud.h>
@@ -38,6 +40,7 @@ public:
   using Point = LidarPoint;
   using PointCloud = pcl::PointCloud<Point>;
   using KDTree = KDTreePCLAdaptor<Point>;
+  using SearchIndex = NeighborSearch<Point>;
 
   //! Structure to easily set all matching parameters
   struct Parameters
@@ -73,6 +76,39 @@ public:
     // The residuals will be robustified by Tukey loss at scale SatDist,
     // leading to 50% of saturation at SatDist/2, fully saturated at SatDist.
     double SaturationDistance = 1.;
+
+    // If enabled, no Ceres residual is built for each match : the matches
+    // parameters are only stored in MatchingResults::Matches, to be optimized
+    // within a single batched residual block (cf. LocalOptimizer::AddLidarMatches()).
+    bool BatchedResiduals = false;
+
+    // Parameterization of the pose optimized by the residuals built
+    PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
+
+    // Approximate nearest neighbors search schedule along ICP iterations.
+    // During the first ICP iterations, the saturation distance is large and
+    // coarse matches are tolerated : the neighbors can be searched with a
+    // relative error eps on their distances (each returned neighbor is at most
+    // (1 + eps) times farther than the exact one), which prunes more of the kd-tree.
+    // eps decreases linearly from InitKnnEpsilon at the first ICP iteration to 0
+    // at the last NbExactKnnIterations iterations, which use exact search.
+    // The ICP loop can only stop early on an exact iteration.
+    double InitKnnEpsilon = 0.;              ///< [>=0] Relative error allowed at first ICP iteration (0 = always exact)
+    unsigned int NbExactKnnIterations = 1;   ///< Number of final ICP iterations using exact search
+
+    // Relative error allowed for the neighbors search of the current ICP
+    // iteration, usually set from the schedule above with GetKnnEpsilon().
+    double KnnEpsilon = 0.;
+
+    // Evaluate the approximate search schedule at a given ICP iteration
+    double GetKnnEpsilon(unsigned int icpIter, unsigned int nbIcpIter) const
+    {
+      if (this->InitKnnEpsilon <= 0. || icpIter + this->NbExactKnnIterations >= nbIcpIter)
+        return 0.;
+      // Number of approximate iterations (at least 1 here)
+      unsigned int nbApproxIter = nbIcpIter - this->NbExactKnnIterations;
+      return this->InitKnnEpsilon * (1. - icpIter / static_cast<double>(nbApproxIter));
+    }
   };
 
   //! Result of matching for one set of keypoints
@@ -89,6 +125,7 @@ public:
       INVALID_NUMERICAL,          ///< Optimization parameter computation has numerical invalidity
       MSE_TOO_LARGE,              ///< Mean squared error to model is too important to accept fitted model
       UNKOWN,                     ///< Unkown status (matching probably not performed yet)
+      NOT_SELECTED,               ///< Keypoint has been matched, but the match was not selected within the residuals budget
       nStatus
     };
 
@@ -98,11 +135,16 @@ public:
       MatchStatus Status;
       double Weight;
       CeresTools::Residual Cost;
+      CeresTools::PointToModelMatch Match;
     };
 
     // Vector of residual functions to add to ceres problem
     std::vector<CeresTools::Residual> Residuals;
 
+    // Parameters of the match of each keypoint (null weight if not matched),
+    // only filled if Parameters::BatchedResiduals is enabled
+    std::vector<CeresTools::PointToModelMatch> Matches;
+
     // Matching result of each keypoint
     std::vector<MatchStatus> Rejections;
     std::vector<double> Weights;
@@ -118,7 +160,80 @@ public:
       this->Rejections.assign(N, MatchingResults::MatchStatus::UNKOWN);
       this->RejectionsHistogram.fill(0);
       this->Residuals.assign(N, CeresTools::Residual());
+      this->Matches.clear();
+    }
+  };
+
+  //! Models fitted on the neighborhood of each keypoint, kept from one ICP
+  //! iteration to the next one to avoid searching and fitting them again
+  //! if the keypoints did not move much.
+  //! It must be reset for each new set of keypoints (i.e. each new frame).
+  struct IterationCache
+  {
+    //! Create an empty cache, with the given max keypoint displacement [m]
+    //! allowed to reuse its model
+    explicit IterationCache(double maxDisplacement = 0.)
+      : MaxSqDisplacement(maxDisplacement * maxDisplacement)
+    {}
+
+    //! Reset the cache for nbPoints keypoints
+    void Resize(unsigned int nbPoints);
+
+    //! Check if the model of a keypoint can be reused at its new WORLD position,
+    //! with the current neighbors search relative error eps.
+    //! A model fitted from a coarser approximate neighborhood is never reused.
+    bool IsValid(unsigned int index, const Eigen::Vector3f& position, double eps) const
+    {
+      return this->Epsilons[index] <= eps &&
+             (position - this->Positions[index]).squaredNorm() <= this->MaxSqDisplacement;
+    }
+
+    //! Store the model fitted for a keypoint at its WORLD position,
+    //! from neighbors searched with relative error eps
+    void Store(unsigned int index, const Eigen::Vector3f& position, double eps, const NeighborhoodModel& model)
+    {
+      this->Positions[index] = position;
+      this->Epsilons[index] = eps;
+      this->Models[index] = model;
     }
+
+    double MaxSqDisplacement;                ///< [m²] Max squared displacement to reuse a model
+    std::vector<Eigen::Vector3f> Positions;  ///< WORLD positions of the keypoints when the models were fitted
+    std::vector<double> Epsilons;            ///< Neighbors search relative errors used to fit the models
+    std::vector<NeighborhoodModel> Models;   ///< Models fitted for each keypoint
+  };
+
+  //! Neighbors search radii of the last matched keypoints, indexed by
+  //! (laser_id, azimuth bin) and kept from one frame to the next one.
+  //! Keypoints of consecutive frames from the same ring and azimuth usually
+  //! match the same neighborhoods : the distance to the k-th neighbor of last
+  //! keypoint, shifted by the distance between both keypoints, is used to
+  //! bound the neighbors search of the current keypoint. If less than k
+  //! neighbors are found within this bound, a full KNN search is performed.
+  struct WarmStartTable
+  {
+    //! Create an empty table, with the given number of azimuth bins per laser ring (>0)
+    explicit WarmStartTable(unsigned int nbAzimuthBins = 0)
+      : NbAzimuthBins(nbAzimuthBins)
+    {}
+
+    //! Get the bin of a keypoint, from its laser ring and its azimuth in BASE coordinates
+    unsigned int GetBin(const Point& basePoint) const;
+
+    //! Get the guessed search radius bound of a keypoint, 0 if unknown
+    float GetRadius(unsigned int bin, const Eigen::Vector3f& worldPoint) const;
+
+    //! Store the distance to the k-th neighbor of a keypoint
+    void Store(unsigned int bin, const Eigen::Vector3f& worldPoint, float radius);
+
+    unsigned int NbAzimuthBins;              ///< Number of azimuth bins per laser ring
+    //! Transform from the WORLD coordinates of the matched keypoints to the fixed
+    //! frame in which the positions are stored. It must be updated before each
+    //! matching if the WORLD frame changes from one frame to the next one
+    //! (e.g. ego-motion, where WORLD is the previous frame BASE).
+    Eigen::UnalignedIsometry3d WorldToFixed = Eigen::UnalignedIsometry3d::Identity();
+    std::vector<Eigen::Vector3f> Positions;  ///< Fixed frame position of the last keypoint matched in each bin
+    std::vector<float> Radii;                ///< [m] Distance to the k-th neighbor of this keypoint (0 if none)
   };
 
   //----------------------------------------------------------------------------
@@ -138,9 +253,56 @@ public:
   // - Assess the model quality by checking its error relatively to the neighborhood.
   // - Build the corresponding point-to-model distance operator
   // If any of these steps fail, the matching procedure of the current keypoint aborts.
+  // If a models cache is given, the neighborhood models are fitted around the
+  // nearest neighbor of each keypoint, and are cached to be reused by all other
+  // keypoints sharing the same nearest neighbor (in this call or next ones).
+  // The cache must be cleared if prevPoints changes.
+  // prevPoints may be a KD-tree or any other neighbors search structure
+  // (e.g. the hashed voxels of a map, cf. NeighborSearchBackend).
+  // If an iteration cache is given, the models fitted for each keypoint are
+  // stored in it, and reused at next calls (i.e. next ICP iterations) for the
+  // keypoints which did not move much in the meantime.
+  // If a warm start table is given, the neighbors searches are bounded by the
+  // results of the previous keypoints of same ring and azimuth, and the table
+  // is updated with the current results.
+  // If a residuals pool is given, the residuals are recycled from it instead of
+  // being allocated (cf. CeresTools::ResidualsPool) : the residuals previously
+  // built with the same pool must not be used anymore.
   MatchingResults BuildMatchResiduals(const PointCloud::Ptr& currPoints,
-                                      const KDTree& prevPoints,
-                                      Keypoint keypointType);
+                                      const SearchIndex& prevPoints,
+                                      Keypoint keypointType,
+                                      NeighborhoodModelCache* modelCache = nullptr,
+                                      IterationCache* iterationCache = nullptr,
+                                      WarmStartTable* warmStart = nullptr,
+                                      CeresTools::ResidualsPool* residualsPool = nullptr);
+
+  // Voxel-Gaussian matching (cf. RegistrationEngine::VOXEL_GAUSSIAN).
+  // Same as above, but instead of searching the nearest neighbors of each
+  // keypoint in a KD-tree, the line/plane/blob model is fitted on the merged
+  // statistics (mean and covariance) of the map voxels around the keypoint,
+  // which are only looked up by hashing (cf. RollingGrid::GetNeighborhoodStatistics()).
+  // The map must keep its voxels statistics (cf. RollingGrid::SetKeepVoxelStatistics()).
+  // The number of neighbors parameters are used as the min number of points
+  // required in the neighborhood.
+  MatchingResults BuildVoxelMatchResiduals(const PointCloud::Ptr& currPoints,
+                                           const RollingGrid& map,
+                                           Keypoint keypointType,
+                                           CeresTools::ResidualsPool* residualsPool = nullptr);
+
+  // Observability-aware selection of the batched matches of all keypoints types,
+  // to optimize at most budget of them (cf. Parameters::BatchedResiduals).
+  // The information brought by each match on the pose is J^T J, J being the
+  // jacobian of its residual wrt the translation and the rotation (about the
+  // BASE origin) of the pose. The principal directions of the total
+  // information are computed separately for translation and rotation, and the
+  // budget is shared between these 6 directions : the matches which bring the
+  // most information along each direction are selected, starting with the
+  // less constrained directions. This way, the redundant matches (e.g. the
+  // ground planes constraining Z, roll and pitch) are discarded first, while
+  // keeping the conditioning of the problem.
+  // The matches which are not selected get the NOT_SELECTED status and a null weight.
+  static void SelectMatches(std::map<Keypoint, MatchingResults>& matchingResults,
+                            const Eigen::Isometry3d& pose, unsigned int budget);
 
   //----------------------------------------------------------------------------
 
@@ -161,23 +323,93 @@ private:
   //    * A = C^{-1/2} is the squared information matrix, aka stiffness matrix, where
   //      C is the covariance matrix encoding the shape of the neighborhood for a blob.
   // - weight attenuates the distance function for outliers
-  CeresTools::Residual BuildResidual(const Eigen::Matrix3d& A, const Eigen::Vector3d& P, const Eigen::Vector3d& X, double weight = 1.);
+  // If a pool is given, its poolIndex-th residual is re-parameterized and returned.
+  CeresTools::Residual BuildResidual(const Eigen::Matrix3d& A, const Eigen::Vector3d& P, const Eigen::Vector3d& X, double weight = 1.,
+                                     CeresTools::ResidualsPool* pool = nullptr, unsigned int poolIndex = 0);
+
+  // Nearest neighbors of a keypoint in the previous keypoints,
+  // sorted by increasing distance (views on the batch search results)
+  struct Neighborhood
+  {
+    const int* Indices;
+    const float* SqDistances;
+    unsigned int Size;
+  };
+
+  // Per-thread buffers reused from one keypoint to another (and from one
+  // matcher to another), to avoid any heap allocation in steady state.
+  // They only grow, and are sized from the matching parameters.
+  struct ScratchBuffers
+  {
+    std::vector<int> Indices;            ///< Selected neighbors indices
+    std::vector<float> SqDistances;      ///< Selected neighbors squared distances
+    std::vector<uint8_t> LaserIdTaken;   ///< Scan lines already used (per-ring edge neighbors)
+    std::vector<int> KnnIndices;         ///< Neighbors indices of a map point (cached models)
+    std::vector<float> KnnSqDistances;   ///< Neighbors squared distances of a map point (cached models)
+    PointCloud Neighbors;                ///< Neighbors of a map point, if gathered from several structures (cached models)
+    std::vector<int> SelectedIndices;        ///< Neighbors selected for a single model fitting
+    std::vector<float> SelectedSqDistances;  ///< Squared distances of the neighbors selected for a single model fitting
+    std::vector<float> RansacPoints;         ///< Neighbors relative positions, as x, y and z arrays (RANSAC edge neighbors)
+    std::vector<uint8_t> RansacInlierFlags;  ///< Inlier flag of each neighbor for a candidate line (RANSAC edge neighbors)
+    std::vector<uint64_t> RansacInlierMasks; ///< Inliers bitsets of the current and best candidate lines (RANSAC edge neighbors)
+
+    void Reserve(unsigned int nbNeighbors);
+  };
 
-  // Match the current keypoint with its neighborhood in the map / previous
-  MatchingResults::MatchInfo BuildLineMatch(const KDTree& previousEdges, const Point& p);
-  MatchingResults::MatchInfo BuildPlaneMatch(const KDTree& previousPlanes, const Point& p);
-  MatchingResults::MatchInfo BuildBlobMatch(const KDTree& previousBlobs, const Point& p);
+  // Get the scratch buffers of the calling thread
+  static ScratchBuffers& GetScratchBuffers();
+
+  // Match the current keypoint with a model fitted on its neighborhood in the map / previous
+  // (recycling the poolIndex-th residual of the pool, if any)
+  MatchingResults::MatchInfo BuildMatch(const NeighborhoodModel& model, const Point& p,
+                                        CeresTools::ResidualsPool* pool = nullptr, unsigned int poolIndex = 0);
+
+  // Get the cached model of the nearest neighbor of the current keypoint
+  // in the map / previous, fitting this model if it is not cached yet
+  NeighborhoodModel GetCachedModel(NeighborhoodModelCache& modelCache, const SearchIndex& prevPoints,
+                                   Keypoint keypointType, const Neighborhood& nearest, unsigned int knearest);
+
+  // Fit a line/plane/blob model on a neighborhood in the map / previous
+  // (select the neighbors, compute their PCA and fit the model on it)
+  NeighborhoodModel BuildModel(Keypoint keypointType, const PointCloud& prevPoints, const Neighborhood& knn);
+
+  // Select the neighbors to fit the line/plane/blob model on, among the knn.
+  // If some neighbors have to be discarded, the selected ones are written in
+  // the given buffers (which must be able to store knn.Size values).
+  MatchingResults::MatchStatus SelectNeighborhood(Keypoint keypointType, const PointCloud& prevPoints,
+                                                  const Neighborhood& knn, int* indicesBuffer,
+                                                  float* sqDistBuffer, Neighborhood& selected);
+  MatchingResults::MatchStatus SelectLineNeighbors(const PointCloud& previousEdges, const Neighborhood& knn,
+                                                   int* indicesBuffer, float* sqDistBuffer,
+                                                   Neighborhood& selected);
+  MatchingResults::MatchStatus SelectPlaneNeighbors(const Neighborhood& knn, Neighborhood& selected) const;
+  MatchingResults::MatchStatus SelectBlobNeighbors(const Neighborhood& knn, Neighborhood& selected) const;
+
+  // Fit a line/plane/blob model from the PCA of the selected neighborhood
+  // (eigen values sorted by increasing order, and matching eigen vectors as columns)
+  NeighborhoodModel FitModel(Keypoint keypointType, const Eigen::Vector3d& mean,
+                             const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const;
+  NeighborhoodModel FitLineModel(const Eigen::Vector3d& mean, const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const;
+  NeighborhoodModel FitPlaneModel(const Eigen::Vector3d& mean, const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const;
+  NeighborhoodModel FitBlobModel(const Eigen::Vector3d& mean, const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const;
+
+  // Fit a line/plane/blob model on the statistics of the map voxels around a keypoint
+  NeighborhoodModel BuildVoxelModel(Keypoint keypointType, const RollingGrid::VoxelStatistics& stats,
+                                    const Eigen::Vector3f& worldPoint) const;
+
+  // Key identifying the parameters used to fit the models of a keypoint type
+  uint64_t GetModelParametersKey(Keypoint keypointType) const;
 
   // Instead of taking the k-nearest neigbors we will take specific neighbor
   // using the particularities of the lidar sensor
-  void GetPerRingLineNeighbors(const KDTree& previousEdges, const double pos[3],
-                               unsigned int knearest, std::vector<int>& validKnnIndices,
+  void GetPerRingLineNeighbors(const PointCloud& previousEdges, const Neighborhood& knn,
+                               std::vector<int>& validKnnIndices,
                                std::vector<float>& validKnnSqDist) const;
 
   // Instead of taking the k-nearest neighbors we will take specific neighbor
   // using a sample consensus model
-  void GetRansacLineNeighbors(const KDTree& previousEdges, const double pos[3],
-                              unsigned int knearest, double maxDistInlier,
+  void GetRansacLineNeighbors(const PointCloud& previousEdges, const Neighborhood& knn,
+                              double maxDistInlier,
                               std::vector<int>& validKnnIndices,
                               std::vector<float>& validKnnSqDist) const;
 
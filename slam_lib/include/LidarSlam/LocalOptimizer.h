@@ -19,13 +19,20 @@
 #pragma once
 
 #include "LidarSlam/CeresCostFunctions.h"
+#include "LidarSlam/Enums.h"
 #include "LidarSlam/Utilities.h"
 #include <Eigen/Geometry>
 #include <ceres/ceres.h>
 
+#include <unordered_map>
+
 namespace LidarSlam
 {
 // Helper class to optimize the LidarSlam problem
+// The Ceres problem is kept from one Solve() call to the next one, and only
+// updated with the residuals which changed : to benefit from it, the same
+// optimizer should be reused (calling Clear() between each optimization),
+// with recycled residuals (cf. CeresTools::ResidualsPool).
 class LocalOptimizer
 {
 public:
@@ -58,6 +65,13 @@ public:
   // Set number of threads
   void SetNbThreads(unsigned int nbThreads);
 
+  // Set the solver to use
+  void SetSolver(PoseSolver solver);
+
+  // Set the parameterization of the pose to optimize.
+  // The residuals added must use the same parameterization.
+  void SetPoseParameterization(PoseParameterization parameterization);
+
   // Set prior pose
   void SetPosePrior(const Eigen::Isometry3d& posePrior);
 
@@ -68,16 +82,24 @@ public:
   void AddResidual(const CeresTools::Residual& res);
   void AddResiduals(const std::vector<CeresTools::Residual>& residuals);
 
+  // Add LiDAR point-to-model matches (the ones with null weight are ignored).
+  // All of them are optimized within a single batched residual block
+  // (cf. CeresCostFunctions::BatchedMahalanobisDistanceAffineIsometryResidual).
+  void AddLidarMatches(const std::vector<CeresTools::PointToModelMatch>& matches);
+
   // Clear all residuals
   void Clear();
 
-  // Build and optimize the Ceres problem
+  // Update and optimize the Ceres problem
   ceres::Solver::Summary Solve();
 
   // Get optimization results
   Eigen::Isometry3d GetOptimizedPose() const;
 
-  // Estimate registration error
+  // Estimate registration error.
+  // The covariance is directly computed from the normal equations of the
+  // residuals at the optimized pose. Ceres covariance estimation (SVD) is only
+  // used if these normal equations are ill-conditioned.
   RegistrationError EstimateRegistrationError();
 
   //----------------------------------------------------------------------------
@@ -91,18 +113,90 @@ private:
   // Max number of threads to use to parallelize computations
   unsigned int NbThreads = 1;
 
+  // Solver to use
+  PoseSolver Solver = PoseSolver::CERES;
+
+  // Parameterization of the pose
+  PoseParameterization Parameterization = PoseParameterization::EULER_ANGLES;
+
   // Maximum number of iteration
   unsigned int LMMaxIter = 15;
 
   // DoF to optimize (= output)
-  Eigen::Vector6d PoseArray;  ///< Pose parameters to optimize (XYZRPY)
+  using PoseVector = Eigen::Matrix<double, 7, 1>;
+  PoseVector PoseArray;  ///< Pose parameters to optimize (XYZRPY, or XYZ and quaternion XYZW)
 
   // Residuals vector
-  // These residuals must involve the full 6D pose array (X, Y, Z, rX, rY, rZ)
+  // These residuals must involve the full pose array (X, Y, Z, rX, rY, rZ),
+  // or (X, Y, Z, qX, qY, qZ, qW) with the quaternion parameterization
   std::vector<CeresTools::Residual> Residuals;
 
   // The Ceres problem to optimize
   std::unique_ptr<ceres::Problem> Problem;
+
+  // Is the Ceres problem up to date with the residuals added
+  bool ProblemUpToDate = false;
+
+  // Normal equations matrix J^T J at the optimized pose, in the pose tangent
+  // space (X, Y, Z, rX, rY, rZ), if it was computed by the last optimization
+  // (used to estimate the covariance)
+  Eigen::Matrix6d NormalMatrix;
+  bool NormalMatrixValid = false;
+
+  // Residual blocks currently added to the Ceres problem, indexed by cost function.
+  // Their residuals are kept here so that they are not destroyed while in use.
+  struct ResidualBlock
+  {
+    ceres::ResidualBlockId Id;
+    CeresTools::Residual Res;
+    bool Used;
+  };
+  std::unordered_map<const ceres::CostFunction*, ResidualBlock> ResidualBlocks;
+
+  // Residual blocks added several times (i.e. sharing the same cost function)
+  std::vector<ResidualBlock> DuplicatedResidualBlocks;
+
+  // 2D mode and pose parameterization of the current Ceres problem
+  bool ProblemTwoDMode = false;
+  PoseParameterization ProblemParameterization = PoseParameterization::EULER_ANGLES;
+
+  // Batched LiDAR matches, and their residual block in the Ceres problem (if any)
+  std::shared_ptr<CeresCostFunctions::BatchedMahalanobisDistanceAffineIsometryResidual> LidarMatches =
+    std::make_shared<CeresCostFunctions::BatchedMahalanobisDistanceAffineIsometryResidual>();
+  ceres::ResidualBlockId LidarMatchesBlock = nullptr;
+
+  // Create or update the Ceres problem with the residuals added
+  void UpdateProblem();
+
+  // Check if all residuals only depend on the pose
+  bool IsPoseOnlyProblem() const;
+
+  // Apply a 6D increment (dX, dY, dZ, rX, rY, rZ) to the pose, and get the
+  // jacobian of this increment wrt the pose parameters
+  PoseVector PosePlus(const PoseVector& pose, const Eigen::Vector6d& delta) const;
+  Eigen::Matrix<double, 7, 6> PosePlusJacobian(const PoseVector& pose) const;
+
+  // Estimate the pose covariance with Ceres (SVD of the jacobian)
+  void EstimateCovarianceSVD(Eigen::Matrix6d& covariance);
+
+  // Convert pose parameters to isometry
+  Eigen::Isometry3d ToIsometry(const PoseVector& pose) const;
+
+  // Optimize the pose with the dedicated Levenberg-Marquardt solver, on DoF
+  // parameters : 6 (X, Y, Z, rX, rY, rZ), or 3 (X, Y, rZ) in 2D mode.
+  // Return false if it failed (the pose is then left unchanged).
+  template<int DoF>
+  bool SolveDenseLM(ceres::Solver::Summary& summary);
+
+  // Evaluate the cost of all residuals at a given pose, and optionally the
+  // DoF x DoF normal equations H = J^T J and g = J^T r (robustified as Ceres does).
+  // In the planar case (DoF = 3), the LiDAR matches are directly evaluated wrt
+  // (X, Y, rZ), without computing the full 6D jacobians.
+  // Return false if any evaluation failed.
+  template<int DoF>
+  bool EvaluateNormalEquations(const PoseVector& pose, double& cost,
+                               Eigen::Matrix<double, DoF, DoF>* H = nullptr,
+                               Eigen::Matrix<double, DoF, 1>* g = nullptr) const;
 };
 
 } // end of LidarSlam namespace
\ No newline at end of file
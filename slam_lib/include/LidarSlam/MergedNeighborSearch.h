@@ -0,0 +1,167 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-17
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+#pragma once
+
+#include "LidarSlam/NeighborSearch.h"
+
+#include <memory>
+#include <vector>
+
+namespace LidarSlam
+{
+
+/*!
+ * @brief Nearest neighbors search in the union of two search structures,
+ * without copying their points.
+ *
+ * This is used to search the neighbors both in a shared read-only prior map
+ * and in the points added locally, each one having its own search structure.
+ * The neighbors are searched in both structures and their results are merged.
+ * The indices of the first structure are kept unchanged, and the ones of the
+ * second structure are shifted by First->GetIndicesRange().
+ */
+template<typename PointT>
+class MergedNeighborSearch : public NeighborSearch<PointT>
+{
+public:
+
+  using PointCloudPtr = typename NeighborSearch<PointT>::PointCloudPtr;
+  using SearchPtr = std::shared_ptr<const NeighborSearch<PointT>>;
+
+  MergedNeighborSearch(const SearchPtr& first, const SearchPtr& second)
+    : First(first)
+    , Second(second)
+  {}
+
+  size_t KnnSearch(const float queryPoint[3], int knearest, int* knnIndices, float* knnSqDistances,
+                   float eps = 0.f) const override
+  {
+    if (knearest <= 0)
+      return 0;
+    thread_local std::vector<int> indices;
+    thread_local std::vector<float> sqDistances;
+    indices.resize(2 * knearest);
+    sqDistances.resize(2 * knearest);
+    size_t count1 = this->First->Size() ? this->First->KnnSearch(queryPoint, knearest, indices.data(), sqDistances.data(), eps) : 0;
+    size_t count2 = this->Second->Size() ? this->Second->KnnSearch(queryPoint, knearest, indices.data() + knearest, sqDistances.data() + knearest, eps) : 0;
+    return this->Merge(indices.data(), sqDistances.data(), count1,
+                       indices.data() + knearest, sqDistances.data() + knearest, count2,
+                       knearest, knnIndices, knnSqDistances);
+  }
+
+  void BatchKnnSearch(const float* queryPoints, size_t nbQueries, int knearest,
+                      int* knnIndices, float* knnSqDistances, size_t* knnCounts, int nbThreads = 1,
+                      float eps = 0.f, const float* maxDistances = nullptr) const override
+  {
+    if (!nbQueries || knearest <= 0)
+      return;
+
+    // Batch search in each structure, to benefit from their own optimizations.
+    // The distance bounds stay valid as upper bounds in each structure.
+    thread_local std::vector<int> indices;
+    thread_local std::vector<float> sqDistances;
+    thread_local std::vector<size_t> counts;
+    const size_t size = nbQueries * knearest;
+    indices.resize(2 * size);
+    sqDistances.resize(2 * size);
+    counts.assign(2 * nbQueries, 0);
+    if (this->First->Size())
+      this->First->BatchKnnSearch(queryPoints, nbQueries, knearest, indices.data(), sqDistances.data(),
+                                  counts.data(), nbThreads, eps, maxDistances);
+    if (this->Second->Size())
+      this->Second->BatchKnnSearch(queryPoints, nbQueries, knearest, indices.data() + size, sqDistances.data() + size,
+                                   counts.data() + nbQueries, nbThreads, eps, maxDistances);
+
+    // Merge the results of each query
+    // NOTE: The thread_local buffers must be accessed through pointers from the worker threads
+    const int* allIndices = indices.data();
+    const float* allSqDistances = sqDistances.data();
+    const size_t* allCounts = counts.data();
+    const int nbQueriesInt = static_cast<int>(nbQueries);
+    #pragma omp parallel for num_threads(nbThreads) schedule(static)
+    for (int q = 0; q < nbQueriesInt; ++q)
+    {
+      const size_t offset = q * knearest;
+      knnCounts[q] = this->Merge(allIndices + offset, allSqDistances + offset, allCounts[q],
+                                 allIndices + size + offset, allSqDistances + size + offset, allCounts[nbQueries + q],
+                                 knearest, knnIndices + offset, knnSqDistances + offset);
+    }
+  }
+
+  size_t Size() const override
+  {
+    return this->First->Size() + this->Second->Size();
+  }
+
+  size_t GetIndicesRange() const override
+  {
+    return this->First->GetIndicesRange() + this->Second->GetIndicesRange();
+  }
+
+  const PointT& GetPoint(int index) const override
+  {
+    const int range1 = this->First->GetIndicesRange();
+    return index < range1 ? this->First->GetPoint(index) : this->Second->GetPoint(index - range1);
+  }
+
+  //! The points are not stored in a single pointcloud
+  PointCloudPtr GetInputCloud() const override
+  {
+    return PointCloudPtr();
+  }
+
+  size_t GetMemorySize() const override
+  {
+    return this->First->GetMemorySize() + this->Second->GetMemorySize();
+  }
+
+private:
+
+  //! Merge the sorted neighbors found in each structure, keeping the k nearest ones
+  size_t Merge(const int* indices1, const float* sqDistances1, size_t count1,
+               const int* indices2, const float* sqDistances2, size_t count2,
+               int knearest, int* knnIndices, float* knnSqDistances) const
+  {
+    const int range1 = this->First->GetIndicesRange();
+    size_t i1 = 0, i2 = 0, count = 0;
+    while (count < static_cast<size_t>(knearest) && (i1 < count1 || i2 < count2))
+    {
+      if (i2 >= count2 || (i1 < count1 && sqDistances1[i1] <= sqDistances2[i2]))
+      {
+        knnIndices[count] = indices1[i1];
+        knnSqDistances[count] = sqDistances1[i1];
+        ++i1;
+      }
+      else
+      {
+        knnIndices[count] = indices2[i2] + range1;
+        knnSqDistances[count] = sqDistances2[i2];
+        ++i2;
+      }
+      ++count;
+    }
+    return count;
+  }
+
+  //! Search structures to merge
+  SearchPtr First;
+  SearchPtr Second;
+};
+
+} // end of LidarSlam namespace
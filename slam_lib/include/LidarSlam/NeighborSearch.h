@@ -0,0 +1,108 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-16
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+#pragma once
+
+#include <pcl/point_cloud.h>
+
+#include <cstddef>
+
+namespace LidarSlam
+{
+
+/*!
+ * @brief Common interface of the nearest neighbors search structures
+ * (KD-tree, hashed voxels, ...) used to match keypoints with a map.
+ *
+ * The neighbors are returned as indices in the input pointcloud of the
+ * structure, sorted by increasing distance to the query point.
+ */
+template<typename PointT>
+class NeighborSearch
+{
+public:
+
+  using PointCloud = pcl::PointCloud<PointT>;
+  using PointCloudPtr = typename PointCloud::Ptr;
+
+  virtual ~NeighborSearch() = default;
+
+  /**
+    * \brief Finds the `K` nearest neighbors points to a given query point.
+    * \param[in] queryPoint Input point to look closest neighbors to.
+    * \param[in] knearest Number of nearest neighbors to find.
+    * \param[out] knnIndices Indices of the NN.
+    * \param[out] knnSqDistances Squared distances of the NN to the query point.
+    * \param[in] eps Relative error allowed on the neighbors distances, if the
+    * structure supports approximate search.
+    * \return Number `N` of neighbors found.
+    */
+  virtual size_t KnnSearch(const float queryPoint[3], int knearest, int* knnIndices, float* knnSqDistances,
+                           float eps = 0.f) const = 0;
+
+  /**
+    * \brief Finds the `K` nearest neighbors of a batch of query points.
+    * Refer to KDTreePCLAdaptor::BatchKnnSearch() for the parameters details.
+    * By default, the queries are processed independently with KnnSearch(),
+    * and the optional maxDistances bounds are ignored.
+    */
+  virtual void BatchKnnSearch(const float* queryPoints, size_t nbQueries, int knearest,
+                              int* knnIndices, float* knnSqDistances, size_t* knnCounts, int nbThreads = 1,
+                              float eps = 0.f, const float* maxDistances = nullptr) const
+  {
+    (void)maxDistances;
+    if (knearest <= 0)
+      return;
+    const int nbQueriesInt = static_cast<int>(nbQueries);
+    #pragma omp parallel for num_threads(nbThreads) schedule(guided, 64)
+    for (int q = 0; q < nbQueriesInt; ++q)
+      knnCounts[q] = this->KnnSearch(queryPoints + 3 * q, knearest, knnIndices + q * knearest,
+                                     knnSqDistances + q * knearest, eps);
+  }
+
+  /**
+    * \brief Get the number of points which can be returned as neighbors.
+    */
+  virtual size_t Size() const = 0;
+
+  /**
+    * \brief Get the upper bound of the neighbors indices :
+    * the returned indices lie in [0, GetIndicesRange()[.
+    */
+  virtual size_t GetIndicesRange() const = 0;
+
+  /**
+    * \brief Get the point which a neighbor index refers to.
+    */
+  virtual const PointT& GetPoint(int index) const = 0;
+
+  /**
+    * \brief Get the input pointcloud, which the neighbors indices refer to.
+    * If the points are not stored in a single pointcloud (e.g. if they are
+    * spread over several structures), nullptr is returned : use GetPoint().
+    */
+  virtual PointCloudPtr GetInputCloud() const = 0;
+
+  /**
+    * \brief Get the approximate [bytes] memory used by the search structure
+    * (not including the input pointcloud).
+    */
+  virtual size_t GetMemorySize() const = 0;
+};
+
+} // end of LidarSlam namespace
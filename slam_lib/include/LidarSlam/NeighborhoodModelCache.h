@@ -0,0 +1,122 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-16
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+#pragma once
+
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LidarSlam
+{
+
+//! Geometric model (line, plane or blob) fitted on the neighborhood of a map point
+struct NeighborhoodModel
+{
+  Eigen::Matrix3d A = Eigen::Matrix3d::Zero();  ///< Distance operator (cf. KeypointsMatcher::BuildResidual)
+  Eigen::Vector3d P = Eigen::Vector3d::Zero();  ///< Centroid of the neighborhood
+  double Weight = 0.;                           ///< Quality score of the model
+  uint8_t Status = 0;                           ///< KeypointsMatcher::MatchingResults::MatchStatus of the fitting
+};
+
+/*!
+ * @brief Lazy cache of the geometric models fitted around each point of a map.
+ *
+ * The models are indexed by the point indices in the KD-tree used for matching,
+ * and are computed on first request. Therefore, the cache must be cleared
+ * each time this KD-tree is rebuilt (i.e. when the map content changes).
+ * It is also cleared if the fitting parameters change.
+ *
+ * Models can be requested concurrently from several threads.
+ */
+class NeighborhoodModelCache
+{
+public:
+
+  //! Prepare the cache for a map of nbPoints points and a given set of fitting parameters.
+  //! If they differ from the ones of the cached models, the cache is cleared.
+  void Prepare(unsigned int nbPoints, uint64_t parametersKey)
+  {
+    if (nbPoints != this->NbPoints || parametersKey != this->ParametersKey)
+    {
+      this->ParametersKey = parametersKey;
+      this->Allocate(nbPoints);
+    }
+  }
+
+  //! Remove all cached models
+  void Clear() { this->Allocate(0); }
+
+  //! Get the model of a map point. If it is not cached yet, it is computed
+  //! using fitModel() and cached.
+  //! The cache must have been prepared to a size greater than index.
+  template<typename FitFunction>
+  NeighborhoodModel Get(unsigned int index, const FitFunction& fitModel)
+  {
+    std::atomic<uint8_t>& state = this->States[index];
+    if (state.load(std::memory_order_acquire) == READY)
+      return this->Models[index];
+
+    // Claim the model to compute it
+    uint8_t expected = EMPTY;
+    if (state.compare_exchange_strong(expected, COMPUTING, std::memory_order_acq_rel))
+    {
+      this->Models[index] = fitModel();
+      state.store(READY, std::memory_order_release);
+      return this->Models[index];
+    }
+
+    // Another thread is computing this model : do not wait for it
+    return fitModel();
+  }
+
+  //! Get the approximate [bytes] memory used by the cache
+  size_t GetMemorySize() const
+  {
+    return this->NbPoints * (sizeof(NeighborhoodModel) + sizeof(std::atomic<uint8_t>));
+  }
+
+private:
+
+  enum : uint8_t { EMPTY = 0, COMPUTING = 1, READY = 2 };
+
+  void Allocate(unsigned int nbPoints)
+  {
+    this->NbPoints = nbPoints;
+    this->States.reset(nbPoints ? new std::atomic<uint8_t>[nbPoints]() : nullptr);
+    this->Models.resize(nbPoints);
+    this->Models.shrink_to_fit();
+  }
+
+  //! Number of points in the map
+  unsigned int NbPoints = 0;
+
+  //! Key identifying the fitting parameters used to compute the cached models
+  uint64_t ParametersKey = 0;
+
+  //! State (EMPTY, COMPUTING or READY) of each model
+  std::unique_ptr<std::atomic<uint8_t>[]> States;
+
+  //! Cached models, only valid if their state is READY
+  std::vector<NeighborhoodModel> Models;
+};
+
+} // end of LidarSlam namespace
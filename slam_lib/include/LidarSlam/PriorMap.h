@@ -0,0 +1,113 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-16
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+#pragma once
+
+#include "LidarSlam/Enums.h"
+#include "LidarSlam/LidarPoint.h"
+#include "LidarSlam/KDTreePCLAdaptor.h"
+
+#include <Eigen/Dense>
+#include <pcl/point_cloud.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LidarSlam
+{
+
+/*!
+ * @brief Read-only keypoints map which can be shared between several SLAM instances.
+ *
+ * The map points are sorted by square tiles (in the XYZ space) so that the
+ * points lying in a bounding box can be extracted with contiguous copies.
+ * A KD-tree is built once on the whole map and is never modified afterwards.
+ * As the map is immutable, it can safely be used simultaneously by several
+ * RollingGrid instances (through reference-counted pointers), each one only
+ * storing and indexing its own local additions : the neighbors are searched
+ * both in this KD-tree and in the local one (cf. MergedNeighborSearch).
+ */
+class PriorMap
+{
+public:
+
+  // Useful types
+  using Point = LidarPoint;
+  using PointCloud = pcl::PointCloud<Point>;
+  using KDTree = KDTreePCLAdaptor<Point>;
+
+  //! Build the map from a keypoints cloud (expressed in WORLD coordinates).
+  //! The points are reordered by tiles of size tileResolution.
+  //! The input cloud must not be modified afterwards.
+  //! If indexCacheFile is not empty, the KD-tree index is loaded from this file
+  //! if it matches the map, or is built and saved to this file otherwise.
+  PriorMap(PointCloud::Ptr cloud, double tileResolution = 10., const std::string& indexCacheFile = "");
+
+  //! Get the number of points in the map
+  unsigned int Size() const {return this->Cloud->size();}
+
+  //! Get the approximate [bytes] memory used by the map points and KD-tree
+  size_t GetMemorySize() const;
+
+  //! Get the [m] size of the tiles
+  double GetTileResolution() const {return this->TileResolution;}
+
+  //! Get all points of the map (shared with other users of this map)
+  PointCloud::ConstPtr GetCloud() const {return this->Cloud;}
+
+  //! Get the KD-tree built on top of the whole map
+  const std::shared_ptr<const KDTree>& GetKdTree() const {return this->KdTree;}
+
+  //! Append to output the points of the tiles intersecting the input bounding box.
+  //! The tiles are found by binary search (or by a linear scan if the box is larger than the map).
+  void ExtractPoints(const Eigen::Array3f& minPoint, const Eigen::Array3f& maxPoint, PointCloud& output) const;
+
+private:
+
+  // Contiguous range of points lying in the same tile
+  struct Tile
+  {
+    Eigen::Array3i Coords;
+    unsigned int Begin;
+    unsigned int End;
+  };
+
+  //! [m] Size of the square tiles
+  double TileResolution;
+
+  //! Map points, sorted by tiles
+  PointCloud::Ptr Cloud;
+
+  //! Tiles of the map, indexing ranges of Cloud
+  std::vector<Tile> Tiles;
+
+  //! KD-Tree built on top of the whole map for fast NN queries
+  std::shared_ptr<const KDTree> KdTree;
+};
+
+//! Load prior keypoints maps from PCD files named <filePrefix><edges|planes|blobs>.pcd
+//! Missing files are ignored.
+//! If cacheIndices is enabled, the KD-tree indices are cached in files named
+//! <filePrefix><edges|planes|blobs>.kdtree to avoid rebuilding them at next startup.
+//! The returned maps can be shared between several SLAM instances (cf. Slam::SetPriorMaps).
+std::map<Keypoint, std::shared_ptr<const PriorMap>> LoadPriorMapsFromPCD(const std::string& filePrefix, double tileResolution = 10.,
+                                                                         bool cacheIndices = true);
+
+} // end of LidarSlam namespace
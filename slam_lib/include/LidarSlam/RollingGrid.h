@@ -22,7 +22,15 @@
 #include "LidarSlam/Enums.h"
 #include "LidarSlam/LidarPoint.h"
 #include "LidarSlam/KDTreePCLAdaptor.h"
+#include "LidarSlam/HashedVoxelSearch.h"
+#include "LidarSlam/MergedNeighborSearch.h"
+#include "LidarSlam/NeighborhoodModelCache.h"
+#include "LidarSlam/PriorMap.h"
+#include <iostream>
+#include <limits>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #define SetMacro(name,type) void Set##name (type _arg) { name = _arg; }
 #define GetMacro(name,type) type Get##name () const { return name; }
@@ -62,6 +70,24 @@ public:
   using Point = LidarPoint;
   using PointCloud = pcl::PointCloud<Point>;
   using KDTree = KDTreePCLAdaptor<Point>;
+  using SearchIndex = NeighborSearch<Point>;
+  using HashedVoxels = HashedVoxelSearch<Point>;
+  using MergedSearch = MergedNeighborSearch<Point>;
+
+  // Incremental statistics of all the points which fell in a voxel
+  // (not only the remaining point after downsampling)
+  struct VoxelStatistics
+  {
+    unsigned int N = 0;                                  ///< Number of points
+    Eigen::Vector3f Mean = Eigen::Vector3f::Zero();      ///< Mean point
+    Eigen::Matrix3f Scatter = Eigen::Matrix3f::Zero();   ///< Sum of the squared deviations to the mean (N * covariance)
+
+    //! Add a point to the statistics (Welford's online algorithm)
+    void Add(const Eigen::Vector3f& point);
+
+    //! Merge other statistics in these ones (Chan's parallel algorithm)
+    void Merge(const VoxelStatistics& other);
+  };
 
   // Voxel structure to store the remaining point
   // after downsampling and to count the number
@@ -70,11 +96,46 @@ public:
   {
     Point point;
     unsigned int count = 0;
+    // Index of the keyframe which provided the voxel point (-1 if unknown)
+    int anchor = -1;
+    // Index of the voxel point in the hashed voxels search structure (-1 if unused)
+    int searchIndex = -1;
   };
 
   using SamplingVG = std::unordered_map<int, Voxel>;
   using RollingVG  = std::unordered_map<int, SamplingVG>;
 
+  // Statistics of the points added to an inner voxel, split by anchor to be
+  // able to remove the contribution of some keyframes (cf. RemoveAnchoredPoints)
+  using AnchoredStatistics = std::vector<std::pair<int, VoxelStatistics>>;
+  // Statistics of the inner voxels, indexed like the voxels of RollingVG
+  using StatisticsVG = std::unordered_map<int, std::unordered_map<int, AnchoredStatistics>>;
+
+  // Copy of the grid content written by Save(), stored in flat arrays.
+  // It can be written afterwards (e.g. in a background thread) while the grid
+  // keeps being updated, and is much faster to get than to serialize.
+  struct Snapshot
+  {
+    // Inner voxel content
+    struct SavedVoxel
+    {
+      int Id;
+      Point point;
+      unsigned int count;
+      int anchor;
+    };
+
+    int GridSize;
+    double VoxelResolution;
+    double LeafSize;
+    Eigen::Array3f VoxelGridPosition;
+    std::vector<std::pair<int, uint64_t>> VoxelsOut;                          ///< Outer voxels ids and numbers of inner voxels
+    std::vector<SavedVoxel, Eigen::aligned_allocator<SavedVoxel>> VoxelsIn;  ///< Inner voxels, sorted by outer voxel
+
+    //! Write the snapshot to a binary stream, to be read by RollingGrid::Load()
+    void Save(std::ostream& out) const;
+  };
+
   //============================================================================
   //   Initialization and parameters setters
   //============================================================================
@@ -100,7 +161,9 @@ public:
   void SetVoxelResolution(double resolution);
   GetMacro(VoxelResolution, double)
 
-  SetMacro(LeafSize, double)
+  //! Set the size of the leaf used to downsample the points within each voxel.
+  //! The hashed voxels search structure, if used, is rebuilt during the process.
+  void SetLeafSize(double leafSize);
   GetMacro(LeafSize, double)
 
   SetMacro(MinFramesPerVoxel, unsigned int)
@@ -114,6 +177,32 @@ public:
 
   // Check if keypoints time decaying is enabled
   bool IsTimeThreshold() const {return DecayingThreshold > 0;}
+
+  //! If enabled, each voxel keeps the statistics (mean and covariance) of all
+  //! the points added to it, to be matched with GetNeighborhoodStatistics().
+  //! These statistics are stored apart from the voxels, and released when disabled.
+  void SetKeepVoxelStatistics(bool keep);
+  GetMacro(KeepVoxelStatistics, bool)
+
+  //! Set the structure used to search the nearest neighbors in the map.
+  //! With HASHED_VOXELS, the map points are indexed in a hashed voxel grid
+  //! (of 3 * LeafSize voxels), which is updated each time points are added or
+  //! removed : the sub-map KD-tree is then never built nor cleared.
+  //! NOTE: In this mode, the moving objects are not rejected (MinFramesPerVoxel).
+  void SetSearchBackend(NeighborSearchBackend backend);
+  GetMacro(SearchBackend, NeighborSearchBackend)
+
+  //! Check if the hashed voxels search structure is used
+  bool IsIncrementalSearch() const {return this->SearchBackend == NeighborSearchBackend::HASHED_VOXELS;}
+
+  //! Set a read-only prior map, which may be shared with other rolling grids.
+  //! The neighbors are searched both in its prebuilt KD-tree and in the sub-map
+  //! KD-tree (or hashed voxels), which only indexes the points stored in this grid : the prior
+  //! map points are never modified nor copied in this grid.
+  //! NOTE: Get() and Size() only consider the points stored in this grid.
+  //! The sub-map KD-tree is cleared during the process.
+  void SetPriorMap(const std::shared_ptr<const PriorMap>& prior);
+  GetMacro(Prior, std::shared_ptr<const PriorMap>)
   //============================================================================
   //   Main rolling grid use
   //============================================================================
@@ -133,7 +222,53 @@ public:
   //! currentTime is the timestamp that will be associated to the added point.
   //! If roll is true, the map is rolled first so that all new points to add can fit in rolled map.
   //! If points are added, the sub-map KD-tree is cleared.
-  void Add(const PointCloud::Ptr& pointcloud, bool fixed = false, double currentTime = -1., bool roll = true);
+  //! anchor is the index of the keyframe providing these points, it allows to
+  //! remove them afterwards (cf. RemoveAnchoredPoints).
+  void Add(const PointCloud::Ptr& pointcloud, bool fixed = false, double currentTime = -1., bool roll = true, int anchor = -1);
+
+  //! Remove the (not fixed) points provided by some keyframes.
+  //! This is used to update the map after a keyframe pose correction without
+  //! having to rebuild it from all logged keyframes.
+  //! The contribution of these keyframes to the voxels statistics is removed too,
+  //! even in the voxels which point is kept.
+  //! If points are removed, the sub-map KD-tree is cleared.
+  void RemoveAnchoredPoints(const std::unordered_set<int>& anchors);
+
+  //! Remove the outer voxels which are the farthest from a given position,
+  //! until at least nbPoints points have been removed (or the grid is empty).
+  //! Fixed points are removed too, as if the grid had been rolled.
+  //! Return the number of removed points.
+  //! If points are removed, the sub-map KD-tree is cleared.
+  unsigned int RemoveFarthestVoxels(const Eigen::Array3f& position, unsigned int nbPoints);
+
+  //! Get the approximate [bytes] memory used by the voxels of the grid
+  size_t GetMemorySize() const;
+
+  //! Get the merged statistics of the voxels lying around a given position :
+  //! the voxel containing it and its neighbors up to radius voxels away in
+  //! each direction. This only requires hash lookups, no KD-tree.
+  //! The voxels without statistics (added before KeepVoxelStatistics was
+  //! enabled, restored from a checkpoint, or which statistics came only from
+  //! removed anchors) contribute with their single point.
+  //! NOTE: The prior map points, if any, are not considered.
+  VoxelStatistics GetNeighborhoodStatistics(const Eigen::Vector3f& position, int radius = 1) const;
+
+  //! Check if the inner voxel containing a given position holds a point.
+  //! This only requires hash lookups, no KD-tree.
+  //! NOTE: The prior map points, if any, are not considered.
+  bool IsOccupied(const Eigen::Vector3f& position) const;
+
+  //! Write the grid geometry and voxels (points, counts and anchors) to a binary stream
+  void Save(std::ostream& out) const {this->GetSnapshot().Save(out);}
+
+  //! Copy the grid content to be written later by Snapshot::Save()
+  Snapshot GetSnapshot() const;
+
+  //! Restore the grid from a binary stream written by Save().
+  //! The grid geometry (size, resolution, leaf size and position) is restored too.
+  //! The sub-map KD-tree is cleared during the process.
+  //! Return false if the stream is invalid, in which case the grid is left empty.
+  bool Load(std::istream& in);
 
   //============================================================================
   //   Sub map use
@@ -151,13 +286,27 @@ public:
 
   //! Check if the KD-tree built on top of the submap is valid or if it needs to be updated.
   //! The KD-tree is cleared every time the map is modified.
-  bool IsSubMapKdTreeValid() const {return this->KdTree.GetInputCloud() && !this->KdTree.GetInputCloud()->empty();}
+  //! With the hashed voxels backend, it is valid as soon as the map is not empty.
+  bool IsSubMapKdTreeValid() const {return this->SubMapSearch->Size() > 0;}
 
-  //! Get the KD-Tree of the submap for fast NN queries
-  const KDTree& GetSubMapKdTree() const {return this->KdTree;}
+  //! Get the search structure of the submap for fast NN queries :
+  //! its KD-tree, or the hashed voxels of the whole map if used,
+  //! merged with the prior map KD-tree if any.
+  const SearchIndex& GetSubMapKdTree() const {return *this->SubMapSearch;}
 
-  //! Get the sub map lastly computed
-   const PointCloud::Ptr GetSubMap() const {return this->SubMap;}
+  //! Get the cache of the neighborhood models fitted on the submap points.
+  //! It is cleared each time the submap KD-tree is rebuilt or cleared,
+  //! so that the cached models stay valid as long as the map is unchanged.
+  NeighborhoodModelCache& GetSubMapModelCache() {return this->ModelCache;}
+
+  //! Get the sub map lastly computed, for visualization.
+  //! The prior map points lying in the sub-map bounding box are copied in it.
+  //! NOTE: No sub-map is extracted with the hashed voxels backend.
+  PointCloud::ConstPtr GetSubMap() const;
+
+  //! Get the approximate [bytes] memory used by the sub-map, its KD-tree and models cache
+  //! The prior map ones are not taken into account.
+  size_t GetSubMapMemorySize() const;
 
   //! Remove too old voxels from the map
   //! relatively to the DecayingThreshold parameter
@@ -185,6 +334,12 @@ private:
   //! Each outer voxel can be accessed using a flattened 1D index.
   RollingVG Voxels;
 
+  //! Statistics of all the points added to each inner voxel,
+  //! only filled if KeepVoxelStatistics is enabled.
+  //! The statistics of the kept anchors remain even if the voxel point
+  //! is removed by RemoveAnchoredPoints().
+  StatisticsVG VoxelsStatistics;
+
   //! [m, m, m] Current position of the center of the outer VoxelGrid
   Eigen::Array3f VoxelGridPosition;
 
@@ -192,11 +347,32 @@ private:
   unsigned int NbPoints;
 
   //! KD-Tree built on top of local sub-map for fast NN queries in sub-map
-  KDTree KdTree;
+  std::shared_ptr<const KDTree> KdTree;
+
+  //! Search structure of the sub-map : its KD-tree (or hashed voxels),
+  //! merged with the prior map one if any
+  std::shared_ptr<const SearchIndex> SubMapSearch;
+
+  //! Neighborhood models fitted on the points of the sub-map KD-tree
+  NeighborhoodModelCache ModelCache;
+
+  //! Structure used to search the nearest neighbors in the map
+  NeighborSearchBackend SearchBackend = NeighborSearchBackend::KD_TREE;
+
+  //! Hashed voxels indexing all the points stored in this grid (not the prior
+  //! map ones), only allocated if SearchBackend is HASHED_VOXELS
+  std::shared_ptr<HashedVoxels> VoxelSearch;
+
+  //! Read-only prior map, optionally shared with other grids
+  std::shared_ptr<const PriorMap> Prior;
 
   //! Local sub-map stored for further visualization
   PointCloud::Ptr SubMap;
 
+  //! Bounding box of the local sub-map, used to extract the prior map points to visualize
+  Eigen::Array3f SubMapMinPoint = Eigen::Array3f::Constant(-std::numeric_limits<float>::infinity());
+  Eigen::Array3f SubMapMaxPoint = Eigen::Array3f::Constant(std::numeric_limits<float>::infinity());
+
   //! Minimum number of points in a voxel
   //! to extract it in a submap
   unsigned int MinFramesPerVoxel = 0;
@@ -211,6 +387,9 @@ private:
   //! If negative, the keypoints are never removed
   double DecayingThreshold = -1;
 
+  //! Keep the statistics of all the points added to each voxel
+  bool KeepVoxelStatistics = false;
+
 private:
 
   //! Conversion from 3D voxel index to 1D flattened index
@@ -218,6 +397,33 @@ private:
 
   //! Conversion from 1D flattened voxel index to 3D index
   Eigen::Array3i To3d(int voxelId1d) const;
+
+  //! Get the outer and inner voxels indices of a given position, the origin of
+  //! the outer voxel grid being given. Return false if it lies out of the grid.
+  bool GetVoxelIndices(const Eigen::Array3f& position, const Eigen::Array3f& voxelGridOrigin, int& idxOut, int& idxIn) const;
+
+  //! Get the inner voxel containing a given position (nullptr if empty),
+  //! the origin of the outer voxel grid being given
+  const Voxel* FindVoxel(const Eigen::Array3f& position, const Eigen::Array3f& voxelGridOrigin) const;
+
+  //! Add a point provided by an anchor to the statistics of an inner voxel
+  void AddToStatistics(int idxOut, int idxIn, int anchor, const Eigen::Vector3f& point);
+
+  //! Remove the statistics of an inner voxel
+  void RemoveStatistics(int idxOut, int idxIn);
+
+  //! Clear the deprecated sub-map KD-tree
+  void ClearKdTree();
+
+  //! Update the sub-map search structure from its KD-tree and the prior map one
+  void UpdateSubMapSearch();
+
+  //! Rebuild the hashed voxels from the grid points, to be searched alongside
+  //! the prior map KD-tree (or release them if the KD-tree backend is used)
+  void BuildVoxelSearch();
+
+  //! Remove the points of an inner voxel grid from the hashed voxels
+  void RemoveFromVoxelSearch(const SamplingVG& voxels);
 };
 
 } // end of LidarSlam namespace
\ No newline at end of file
@@ -82,12 +82,14 @@
 #include "LidarSlam/LocalOptimizer.h"
 #include "LidarSlam/MotionModel.h"
 #include "LidarSlam/RollingGrid.h"
+#include "LidarSlam/PriorMap.h"
 #include "LidarSlam/PointCloudStorage.h"
 #include "LidarSlam/ExternalSensorManagers.h"
 #include "LidarSlam/State.h"
 
 #include <Eigen/Geometry>
 
+#include <future>
 #include <list>
 
 #ifdef USE_G2O
@@ -147,6 +149,7 @@ public:
   Eigen::Isometry3d GetLatencyCompensatedWorldTransform() const;
   // Get keypoints maps
   // If clean is true, the moving objects are removed from map
+  // NOTE: The prior map points are not included (cf. SetPriorMaps).
   PointCloud::Ptr GetMap(Keypoint k, bool clean = false) const;
 
   // Get target keypoints for current scan
@@ -193,6 +196,31 @@ public:
   // Load keypoints maps from disk (and reset SLAM maps)
   void LoadMapsFromPCD(const std::string& filePrefix, bool resetMaps = true);
 
+  // Set read-only prior maps to localize against (cf. LoadPriorMapsFromPCD).
+  // These maps can be shared between several SLAM instances : each instance
+  // only stores its own keypoints additions in its maps.
+  // Missing keypoint types detach the corresponding prior map.
+  void SetPriorMaps(const std::map<Keypoint, std::shared_ptr<const PriorMap>>& priorMaps);
+  std::shared_ptr<const PriorMap> GetPriorMap(Keypoint k) const;
+  // Check if a prior map is set for any of the used keypoints types
+  bool UsePriorMaps() const;
+
+  // Save the SLAM state (motion, logged states and maps with their voxels
+  // counts, times and labels) to a versioned binary checkpoint <filePrefix>.ckpt
+  // for a fast warm restart. The logged keypoints are incrementally appended to
+  // <filePrefix>.<generation>.kpts, only new states being written at each call.
+  // If async is true, the state is copied in memory and the files are
+  // serialized and written in a background thread. If the previous checkpoint
+  // is still being written, this one is skipped and false is returned.
+  // The previous checkpoint is kept valid until the new one is entirely written.
+  // NOTE: The parameters and the external sensors measurements are not saved.
+  bool SaveCheckpoint(const std::string& filePrefix, bool async = false);
+
+  // Restore the SLAM state from a checkpoint written by SaveCheckpoint().
+  // The maps geometry (grid size, voxels resolution and leaf sizes) is restored
+  // too, other parameters are left untouched.
+  bool LoadCheckpoint(const std::string& filePrefix);
+
   // ---------------------------------------------------------------------------
   //   General parameters
   // ---------------------------------------------------------------------------
@@ -218,6 +246,15 @@ public:
   SetMacro(LoggingStorage, PointCloudStorageType)
   GetMacro(LoggingStorage, PointCloudStorageType)
 
+  SetMacro(MemoryBudget, double)
+  GetMacro(MemoryBudget, double)
+
+  SetMacro(MemoryEvictionPolicies, const std::vector<MemoryEvictionPolicy>&)
+  GetMacro(MemoryEvictionPolicies, std::vector<MemoryEvictionPolicy>)
+
+  // Get the approximate [MB] memory used by each SLAM subsystem
+  std::map<MemorySubsystem, double> GetMemoryUsage() const;
+
   LidarState& GetLastState();
 
   GetMacro(Latency, double);
@@ -270,6 +307,15 @@ public:
   GetMacro(TwoDMode, bool)
   SetMacro(TwoDMode, bool)
 
+  GetMacro(BatchedLidarResiduals, bool)
+  SetMacro(BatchedLidarResiduals, bool)
+
+  GetMacro(OptimizationSolver, PoseSolver)
+  SetMacro(OptimizationSolver, PoseSolver)
+
+  GetMacro(OptimizationParameterization, PoseParameterization)
+  SetMacro(OptimizationParameterization, PoseParameterization)
+
   // Get/Set EgoMotion
   GetMacro(EgoMotionLMMaxIter, unsigned int)
   SetMacro(EgoMotionLMMaxIter, unsigned int)
@@ -277,6 +323,15 @@ public:
   GetMacro(EgoMotionICPMaxIter, unsigned int)
   SetMacro(EgoMotionICPMaxIter, unsigned int)
 
+  GetMacro(EgoMotionConvergenceTranslation, double)
+  SetMacro(EgoMotionConvergenceTranslation, double)
+
+  GetMacro(EgoMotionConvergenceRotation, double)
+  SetMacro(EgoMotionConvergenceRotation, double)
+
+  GetMacro(EgoMotionConvergenceMatchesRatio, double)
+  SetMacro(EgoMotionConvergenceMatchesRatio, double)
+
   GetMacro(EgoMotionMaxNeighborsDistance, double)
   SetMacro(EgoMotionMaxNeighborsDistance, double)
 
@@ -304,6 +359,18 @@ public:
   GetMacro(EgoMotionFinalSaturationDistance, double)
   SetMacro(EgoMotionFinalSaturationDistance, double)
 
+  GetMacro(EgoMotionNeighborhoodReuseRatio, double)
+  SetMacro(EgoMotionNeighborhoodReuseRatio, double)
+
+  GetMacro(EgoMotionInitKnnEpsilon, double)
+  SetMacro(EgoMotionInitKnnEpsilon, double)
+
+  GetMacro(EgoMotionNbExactKnnIterations, unsigned int)
+  SetMacro(EgoMotionNbExactKnnIterations, unsigned int)
+
+  GetMacro(EgoMotionWarmStartAzimuthBins, unsigned int)
+  SetMacro(EgoMotionWarmStartAzimuthBins, unsigned int)
+
   // Get/Set Localization
   GetMacro(LocalizationLMMaxIter, unsigned int)
   SetMacro(LocalizationLMMaxIter, unsigned int)
@@ -311,6 +378,15 @@ public:
   GetMacro(LocalizationICPMaxIter, unsigned int)
   SetMacro(LocalizationICPMaxIter, unsigned int)
 
+  GetMacro(LocalizationConvergenceTranslation, double)
+  SetMacro(LocalizationConvergenceTranslation, double)
+
+  GetMacro(LocalizationConvergenceRotation, double)
+  SetMacro(LocalizationConvergenceRotation, double)
+
+  GetMacro(LocalizationConvergenceMatchesRatio, double)
+  SetMacro(LocalizationConvergenceMatchesRatio, double)
+
   GetMacro(LocalizationMaxNeighborsDistance, double)
   SetMacro(LocalizationMaxNeighborsDistance, double)
 
@@ -341,6 +417,30 @@ public:
   GetMacro(LocalizationFinalSaturationDistance, double)
   SetMacro(LocalizationFinalSaturationDistance, double)
 
+  GetMacro(LocalizationMapModelCache, bool)
+  SetMacro(LocalizationMapModelCache, bool)
+
+  GetMacro(LocalizationNeighborhoodReuseRatio, double)
+  SetMacro(LocalizationNeighborhoodReuseRatio, double)
+
+  GetMacro(LocalizationInitKnnEpsilon, double)
+  SetMacro(LocalizationInitKnnEpsilon, double)
+
+  GetMacro(LocalizationNbExactKnnIterations, unsigned int)
+  SetMacro(LocalizationNbExactKnnIterations, unsigned int)
+
+  GetMacro(LocalizationWarmStartAzimuthBins, unsigned int)
+  SetMacro(LocalizationWarmStartAzimuthBins, unsigned int)
+
+  GetMacro(LocalizationSamplingRatios, std::vector<double>)
+  SetMacro(LocalizationSamplingRatios, const std::vector<double>&)
+
+  GetMacro(LocalizationResidualsBudget, unsigned int)
+  SetMacro(LocalizationResidualsBudget, unsigned int)
+
+  GetMacro(LocalizationEngine, RegistrationEngine)
+  void SetLocalizationEngine(RegistrationEngine engine);
+
   // External Sensor parameters
 
   // General
@@ -403,12 +503,24 @@ public:
   GetMacro(MapUpdate, MappingMode)
   SetMacro(MapUpdate, MappingMode)
 
+  GetMacro(KfAnchoredMaps, bool)
+  SetMacro(KfAnchoredMaps, bool)
+
+  GetMacro(KfAnchorDistanceTolerance, double)
+  SetMacro(KfAnchorDistanceTolerance, double)
+
+  GetMacro(KfAnchorAngleTolerance, double)
+  SetMacro(KfAnchorAngleTolerance, double)
+
   double GetVoxelGridDecayingThreshold();
   void SetVoxelGridDecayingThreshold(double decay);
 
   SamplingMode GetVoxelGridSamplingMode(Keypoint k);
   void SetVoxelGridSamplingMode(Keypoint k, SamplingMode sm);
 
+  NeighborSearchBackend GetVoxelGridSearchBackend(Keypoint k);
+  void SetVoxelGridSearchBackend(Keypoint k, NeighborSearchBackend backend);
+
   // Set RollingGrid Parameters
   void ClearMaps();
   void SetVoxelGridLeafSize(Keypoint k, double size);
@@ -424,6 +536,9 @@ public:
   GetMacro(OverlapSamplingRatio, float)
   void SetOverlapSamplingRatio(float _arg);
 
+  GetMacro(OverlapMethod, OverlapEstimator)
+  void SetOverlapMethod(OverlapEstimator method);
+
   GetMacro(OverlapEstimation, float)
 
   // Matches
@@ -483,6 +598,17 @@ private:
   // This reduces about 5 times the memory consumption, but slows down logging (and PGO).
   PointCloudStorageType LoggingStorage = PointCloudStorageType::PCL_CLOUD;
 
+  // [MB] Approximate maximum memory that the SLAM is allowed to use
+  // (logged states, maps, submaps and prior maps).
+  // When exceeded, the MemoryEvictionPolicies are applied in order until the
+  // memory usage fits the budget again. If 0, the memory usage is not limited.
+  double MemoryBudget = 0.;
+
+  // Ordered policies to apply to free memory when MemoryBudget is exceeded
+  std::vector<MemoryEvictionPolicy> MemoryEvictionPolicies = {MemoryEvictionPolicy::COMPRESS_OLD_STATES,
+                                                              MemoryEvictionPolicy::DROP_NON_KEYFRAME_CLOUDS,
+                                                              MemoryEvictionPolicy::DROP_FAR_MAP_VOXELS};
+
   // Number of frames that have been processed by SLAM (number of poses in trajectory)
   unsigned int NbrFrameProcessed = 0;
 
@@ -540,6 +666,20 @@ private:
   // The oldest states are forgotten (cf. LoggingTimeout parameter)
   std::list<LidarState> LogStates;
 
+  // **** CHECKPOINTS ****
+
+  // Background writing of the last checkpoint
+  std::future<bool> CheckpointWriting;
+  // Path prefix of the last checkpoint
+  std::string CheckpointPrefix;
+  // Generation of the checkpoint keypoints file, which is rewritten from
+  // scratch when it mostly contains states which are not logged anymore
+  unsigned int CheckpointGeneration = 0;
+  // [bytes] Size of the checkpoint keypoints file
+  uint64_t CheckpointKeypointsSize = 0;
+  // Offsets of the keypoints of each logged state (by index) in the keypoints file
+  std::map<unsigned int, std::map<Keypoint, uint64_t>> CheckpointKeypointsOffsets;
+
   // ---------------------------------------------------------------------------
   //   Keypoints extraction
   // ---------------------------------------------------------------------------
@@ -589,6 +729,14 @@ private:
   // Number of keyrames
   int KfCounter = 0;
 
+  // If true, the maps points are anchored to the keyframe which provided them.
+  // After a pose graph optimization, only the points of the keyframes whose pose
+  // moved more than the tolerances below are re-inserted in the maps.
+  // If false, the maps are entirely rebuilt from all logged keyframes.
+  bool KfAnchoredMaps = false;
+  double KfAnchorDistanceTolerance = 0.05;  ///< [m] Min keyframe translation correction to update the maps
+  double KfAnchorAngleTolerance = 0.5;      ///< [°] Min keyframe rotation correction to update the maps
+
   // How to update the map
   // The map can be updated more or less with new input keypoints
   // from current scanned points depending on the initial map reliability.
@@ -611,6 +759,18 @@ private:
   std::map<Keypoint, KeypointsMatcher::MatchingResults> EgoMotionMatchingResults;
   std::map<Keypoint, KeypointsMatcher::MatchingResults> LocalizationMatchingResults;
 
+  //! Neighbors search results of last matched keypoints, used to warm start the next searches
+  std::map<Keypoint, KeypointsMatcher::WarmStartTable> EgoMotionWarmStart;
+  std::map<Keypoint, KeypointsMatcher::WarmStartTable> LocalizationWarmStart;
+
+  //! Residuals recycled from one ICP iteration (and frame) to the next one
+  std::map<Keypoint, CeresTools::ResidualsPool> EgoMotionResidualsPools;
+  std::map<Keypoint, CeresTools::ResidualsPool> LocalizationResidualsPools;
+
+  //! Optimizers, whose Ceres problems are updated from one ICP iteration (and frame) to the next one
+  LocalOptimizer EgoMotionOptimizer;
+  LocalOptimizer LocalizationOptimizer;
+
   // Optimization results
   // Variance-Covariance matrix that estimates the localization error about the
   // 6-DoF parameters (DoF order : X, Y, Z, rX, rY, rZ)
@@ -674,6 +834,23 @@ private:
   // This will hold Z (elevation), rX (roll) and rY (pitch) constant.
   bool TwoDMode = false;
 
+  // Optimize all LiDAR matches within a single batched residual block, with
+  // analytic jacobians, instead of one auto-differentiated block per match.
+  // The optimization results are the same, but faster with many matches.
+  bool BatchedLidarResiduals = false;
+
+  // Solver used to optimize the pose at each ICP-LM iteration.
+  // The dedicated DENSE_LM solver is faster than the generic Ceres one,
+  // which is used as a fallback. In 2D mode, it solves a 3-DoF planar problem
+  // (X, Y, rZ), with batched LiDAR matches.
+  PoseSolver OptimizationSolver = PoseSolver::CERES;
+
+  // Parameterization of the pose optimized at each ICP-LM iteration.
+  // With QUATERNION, the rotation is updated on the SO(3) manifold, which
+  // avoids the Euler angles singularities and trigonometric functions
+  // evaluations in the residuals.
+  PoseParameterization OptimizationParameterization = PoseParameterization::EULER_ANGLES;
+
   // Number of outer ICP-optim loop iterations to perform.
   // Each iteration will consist of building ICP matches, then optimizing them.
   unsigned int EgoMotionICPMaxIter = 4;
@@ -684,6 +861,23 @@ private:
   unsigned int EgoMotionLMMaxIter = 15;
   unsigned int LocalizationLMMaxIter = 15;
 
+  // ICP-LM loop convergence criteria.
+  // The loop stops when the pose increment of the last optimization is below
+  // both the translation [m] and rotation [°] thresholds, as new matches
+  // would barely change. It also stops, keeping the last optimized pose, if
+  // the ratio of keypoints whose matching status changed since the previous
+  // ICP iteration (relatively to the number of matches) is below
+  // ConvergenceMatchesRatio, as the same correspondences were already optimized.
+  // The matching results and localization uncertainty of the kept pose are then
+  // restored (this requires to estimate the uncertainty at each ICP iteration).
+  // Null values disable these criteria.
+  double EgoMotionConvergenceTranslation = 0.;
+  double EgoMotionConvergenceRotation = 0.;
+  double EgoMotionConvergenceMatchesRatio = 0.;
+  double LocalizationConvergenceTranslation = 0.;
+  double LocalizationConvergenceRotation = 0.;
+  double LocalizationConvergenceMatchesRatio = 0.;
+
   // Point-to-neighborhood matching parameters.
   // The goal will be to loop over all keypoints, and to build the corresponding
   // point-to-neighborhood residuals that will be optimized later.
@@ -730,6 +924,63 @@ private:
   double LocalizationInitSaturationDistance = 2.;
   double LocalizationFinalSaturationDistance = 0.5;
 
+  // If true, during Localization, the line/plane/blob models are fitted around
+  // the nearest map point of each keypoint instead of around the keypoint itself.
+  // These models are cached in the maps and reused across keypoints, ICP
+  // iterations and frames, as long as the maps are not modified.
+  // This saves most of the neighborhoods extraction and PCA computations,
+  // especially if the maps are fixed (MappingMode::NONE), but slightly
+  // approximates the neighborhood of each keypoint.
+  bool LocalizationMapModelCache = false;
+
+  // Ratio of the keypoints map leaf size under which the neighborhood model
+  // of a keypoint fitted at previous ICP iteration is reused, instead of
+  // searching and fitting it again. A keypoint is only matched again if its
+  // transformed position moved more than ratio * leaf size since its last match.
+  // If 0, all keypoints are matched again at each ICP iteration.
+  double EgoMotionNeighborhoodReuseRatio = 0.;
+  double LocalizationNeighborhoodReuseRatio = 0.;
+
+  // Approximate nearest neighbors search during the first ICP iterations.
+  // The neighbors are searched with a relative error on their distances,
+  // decreasing linearly from InitKnnEpsilon at first ICP iteration to 0 (exact
+  // search) at the last NbExactKnnIterations iterations.
+  // If InitKnnEpsilon is 0, the neighbors search is always exact.
+  double EgoMotionInitKnnEpsilon = 0.;
+  unsigned int EgoMotionNbExactKnnIterations = 1;
+  double LocalizationInitKnnEpsilon = 0.;
+  unsigned int LocalizationNbExactKnnIterations = 1;
+
+  // Number of azimuth bins per laser ring used to warm start the neighbors
+  // searches. The results of the keypoints matched at previous frame are
+  // stored by (laser_id, azimuth bin), and used to bound the neighbors search
+  // of the next keypoints falling in the same bin.
+  // If 0, the warm start is disabled.
+  unsigned int EgoMotionWarmStartAzimuthBins = 0;
+  unsigned int LocalizationWarmStartAzimuthBins = 0;
+
+  // Coarse-to-fine keypoints schedule of the Localization ICP-LM loop.
+  // The i-th ICP iteration only matches this ratio ]0-1] of each keypoints
+  // type, subsampled uniformly along the Morton (Z-order) curve to stay
+  // spatially spread. The next iterations, and always the last one, use all
+  // keypoints. The convergence criteria are only checked with all keypoints.
+  // If empty, all keypoints are used at each ICP iteration.
+  std::vector<double> LocalizationSamplingRatios;
+
+  // Max number of LiDAR matches to optimize at each Localization ICP iteration.
+  // If more keypoints are matched, the matches which bring the most information
+  // on the less constrained pose DoF are selected (cf. KeypointsMatcher::SelectMatches()),
+  // the others being rejected with the NOT_SELECTED status. This requires
+  // batched residuals, which are then enabled. The localization uncertainty is
+  // estimated from the selected matches only.
+  // If 0, all matches are optimized.
+  unsigned int LocalizationResidualsBudget = 0;
+
+  // How to match the keypoints with the maps during Localization.
+  // VOXEL_GAUSSIAN requires the maps to keep their voxels statistics, which
+  // are only accumulated from the moment this engine is selected.
+  RegistrationEngine LocalizationEngine = RegistrationEngine::KNN_PCA;
+
   // ---------------------------------------------------------------------------
   //   Graph parameters
   // ---------------------------------------------------------------------------
@@ -754,6 +1005,11 @@ private:
   // Number of matches for processed frame
   unsigned int TotalMatchedKeypoints = 0;
 
+  // Number of ICP-LM iterations (keypoints matching then optimization)
+  // performed for processed frame
+  unsigned int EgoMotionICPIterations = 0;
+  unsigned int LocalizationICPIterations = 0;
+
   // Check motion limitations compliance
   bool ComplyMotionLimits = true;
 
@@ -778,6 +1034,13 @@ private:
   // If 0, overlap won't be computed.
   float OverlapSamplingRatio = 0.f;
 
+  // Method used to estimate the overlap.
+  // VOXEL_OCCUPANCY only requires hash lookups, instead of a KD-tree search
+  // for each point : it allows to estimate the overlap on all points.
+  // As it ignores the prior maps points, NEAREST_NEIGHBOR is used instead
+  // if a prior map is used.
+  OverlapEstimator OverlapMethod = OverlapEstimator::NEAREST_NEIGHBOR;
+
   // Motion limitations
   // Local velocity thresholds in BASE
   Eigen::Array2f VelocityLimits     = {FLT_MAX, FLT_MAX};
@@ -819,12 +1082,24 @@ private:
   // and add points to the maps if we are dealing with a new keyframe.
   void UpdateMapsUsingTworld();
 
+  // Update the maps after a correction of the logged keyframes poses :
+  // the points of the keyframes which moved more than the anchor tolerances
+  // are removed from the maps and added back using their new pose.
+  void UpdateAnchoredMaps();
+
   // Check if the current frame is a keyframe or not
   bool CheckKeyFrame();
 
   // Log current frame processing results : pose, covariance and keypoints.
   void LogCurrentFrameState(double time);
 
+  // Apply the memory eviction policies if the memory usage exceeds MemoryBudget
+  void EnforceMemoryBudget();
+
+  // Keep the maps voxels statistics only if the localization engine needs them.
+  // This must be called each time the maps are created, reset or loaded.
+  void UpdateMapsVoxelStatistics();
+
   // ---------------------------------------------------------------------------
   //   Undistortion helpers
   // ---------------------------------------------------------------------------
@@ -50,6 +50,11 @@ struct LidarState
   // Keypoints extracted at current pose, undistorted and expressed in BASE coordinates
   std::map<Keypoint, PCStoragePtr> Keypoints;
   bool IsKeyFrame = true;
+  // Whether the keypoints of this state have been added to the maps
+  bool IsMapAnchor = false;
+  // Pose used to add the keypoints of this state to the maps.
+  // It is compared to the current pose to decide if the maps need an update.
+  Eigen::UnalignedIsometry3d AnchorIsometry = Eigen::UnalignedIsometry3d::Identity();
 };
 
 } // end of LidarSlam namespace
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include <math.h>
 #include <numeric>
 #include <cctype>
+#include <cstdint>
 
 //==============================================================================
 //   Usefull macros or typedefs
@@ -137,6 +138,53 @@ std::string Capitalize(std::string st);
  */
 std::string Plural(std::string st);
 
+//------------------------------------------------------------------------------
+/*!
+ * @brief Write the raw binary content of a trivially copyable value to a stream.
+ */
+template<typename T>
+inline void WriteBinary(std::ostream& out, const T& value)
+{
+  out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Read the raw binary content of a trivially copyable value from a stream.
+ * @return true if the value has been successfully read.
+ */
+template<typename T>
+inline bool ReadBinary(std::istream& in, T& value)
+{
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Write the points of a pointcloud to a binary stream (the header is not written).
+ */
+template<typename PointT>
+inline void WriteBinaryCloud(std::ostream& out, const pcl::PointCloud<PointT>& cloud)
+{
+  WriteBinary(out, static_cast<uint64_t>(cloud.size()));
+  out.write(reinterpret_cast<const char*>(cloud.points.data()), cloud.size() * sizeof(PointT));
+}
+
+//------------------------------------------------------------------------------
+/*!
+ * @brief Read the points of a pointcloud from a binary stream written by WriteBinaryCloud().
+ * @return true if the pointcloud has been successfully read.
+ */
+template<typename PointT>
+inline bool ReadBinaryCloud(std::istream& in, pcl::PointCloud<PointT>& cloud)
+{
+  uint64_t nbPoints;
+  if (!ReadBinary(in, nbPoints))
+    return false;
+  cloud.resize(nbPoints);
+  return static_cast<bool>(in.read(reinterpret_cast<char*>(cloud.points.data()), nbPoints * sizeof(PointT)));
+}
+
 //==============================================================================
 //   Geometry helpers
 //==============================================================================
@@ -270,6 +318,66 @@ void ComputeMeanAndPCA(const pcl::PointCloud<PointT>& cloud,
   pcl::eigen33(covarianceMatrix, eigenVectors, eigenValues);
 }
 
+//------------------------------------------------------------------------------
+/*!
+ * @brief Compute the centroid and PCA of a pointcloud subset.
+ *
+ * Same as above, but the subset is given as a raw indices array, to avoid any
+ * copy or heap allocation in hot loops.
+ * @param[in] cloud The input pointcloud
+ * @param[in] indices The points to consider from cloud
+ * @param[in] nbIndices The number of points to consider (must not be 0)
+ * @param[out] centroid The mean point of the subset of points
+ * @param[out] eigenVectors The PCA eigen vectors corresponding to eigenValues
+ * @param[out] eigenValues The PCA eigen values, sorted by ascending order
+ */
+template<typename PointT, typename Scalar>
+void ComputeMeanAndPCA(const pcl::PointCloud<PointT>& cloud,
+                       const int* indices,
+                       unsigned int nbIndices,
+                       Eigen::Matrix<Scalar, 3, 1>& centroid,
+                       Eigen::Matrix<Scalar, 3, 3>& eigenVectors,
+                       Eigen::Matrix<Scalar, 3, 1>& eigenValues)
+{
+  // Accumulate first and second order moments, as pcl::computeMeanAndCovarianceMatrix.
+  // The points are taken relatively to the first one, to avoid catastrophic
+  // cancellation in E[xx] - E[x]^2 far from the origin.
+  // [xx, xy, xz, yy, yz, zz, x, y, z]
+  const Eigen::Matrix<Scalar, 3, 1> ref = cloud[indices[0]].getVector3fMap().template cast<Scalar>();
+  Eigen::Matrix<Scalar, 1, 9, Eigen::RowMajor> accu = Eigen::Matrix<Scalar, 1, 9, Eigen::RowMajor>::Zero();
+  for (unsigned int i = 0; i < nbIndices; ++i)
+  {
+    const PointT& p = cloud[indices[i]];
+    const Scalar x = p.x - ref.x(), y = p.y - ref.y(), z = p.z - ref.z();
+    accu[0] += x * x;
+    accu[1] += x * y;
+    accu[2] += x * z;
+    accu[3] += y * y;
+    accu[4] += y * z;
+    accu[5] += z * z;
+    accu[6] += x;
+    accu[7] += y;
+    accu[8] += z;
+  }
+  accu /= static_cast<Scalar>(nbIndices);
+
+  // Compute mean and normalized covariance matrix
+  centroid << accu[6] + ref.x(), accu[7] + ref.y(), accu[8] + ref.z();
+  EIGEN_ALIGN16 Eigen::Matrix<Scalar, 3, 3> covarianceMatrix;
+  covarianceMatrix(0, 0) = accu[0] - accu[6] * accu[6];
+  covarianceMatrix(0, 1) = accu[1] - accu[6] * accu[7];
+  covarianceMatrix(0, 2) = accu[2] - accu[6] * accu[8];
+  covarianceMatrix(1, 1) = accu[3] - accu[7] * accu[7];
+  covarianceMatrix(1, 2) = accu[4] - accu[7] * accu[8];
+  covarianceMatrix(2, 2) = accu[5] - accu[8] * accu[8];
+  covarianceMatrix(1, 0) = covarianceMatrix(0, 1);
+  covarianceMatrix(2, 0) = covarianceMatrix(0, 2);
+  covarianceMatrix(2, 1) = covarianceMatrix(1, 2);
+
+  // Compute eigen values and corresponding eigen vectors
+  pcl::eigen33(covarianceMatrix, eigenVectors, eigenValues);
+}
+
 //==============================================================================
 //   PCL helpers
 //==============================================================================
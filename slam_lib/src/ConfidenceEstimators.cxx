@@ -64,5 +64,34 @@ float LCPEstimator(PointCloud::ConstPtr cloud,
   return lcp / nbPoints;
 }
 
+//-----------------------------------------------------------------------------
+float OccupancyLCPEstimator(PointCloud::ConstPtr cloud,
+                            const std::map<Keypoint, std::shared_ptr<RollingGrid>>& maps,
+                            float subsamplingRatio,
+                            int nbThreads)
+{
+  // Number of points to process
+  int nbPoints = cloud->size() * subsamplingRatio;
+  if (nbPoints == 0 || maps.empty())
+    return -1.;
+
+  // Count the points of input cloud falling in an occupied voxel of any map
+  int nbOverlapping = 0;
+  #pragma omp parallel for num_threads(nbThreads) reduction(+:nbOverlapping)
+  for (int n = 0; n < nbPoints; ++n)
+  {
+    const auto& point = cloud->at(n / subsamplingRatio);
+    for (const auto& map : maps)
+    {
+      if (map.second->IsOccupied(point.getVector3fMap()))
+      {
+        ++nbOverlapping;
+        break;
+      }
+    }
+  }
+  return static_cast<float>(nbOverlapping) / nbPoints;
+}
+
 } // end of Confidence namespace
 } // end of LidarSlam namespace
\ No newline at end of file
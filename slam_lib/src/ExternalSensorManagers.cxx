@@ -66,7 +66,7 @@ bool WheelOdometryManager::ComputeConstraint(double lidarTime, bool verbose)
 
   // If there is memory of a previous pose
   double distDiff = std::abs(synchMeas.Distance - this->RefDistance);
-  this->Residual.Cost = CeresCostFunctions::OdometerDistanceResidual::Create(this->PreviousPose.translation(), distDiff);
+  this->Residual.Cost = CeresCostFunctions::OdometerDistanceResidual::Create(this->Parameterization, this->PreviousPose.translation(), distDiff);
   this->Residual.Robustifier.reset(new ceres::ScaledLoss(NULL, this->Weight, ceres::TAKE_OWNERSHIP));
   if(verbose && !this->Relative)
     PRINT_INFO("Adding absolute wheel odometry residual : " << distDiff << " m travelled since first frame.")
@@ -119,7 +119,7 @@ bool ImuManager::ComputeConstraint(double lidarTime, bool verbose)
     return false;
 
   // Build gravity constraint
-  this->Residual.Cost = CeresCostFunctions::ImuGravityAlignmentResidual::Create(this->GravityRef, synchMeas.Acceleration);
+  this->Residual.Cost = CeresCostFunctions::ImuGravityAlignmentResidual::Create(this->Parameterization, this->GravityRef, synchMeas.Acceleration);
   this->Residual.Robustifier.reset(new ceres::ScaledLoss(NULL, this->Weight, ceres::TAKE_OWNERSHIP));
   PRINT_INFO("\t Adding gravity residual with gravity reference : " << this->GravityRef.transpose())
   return true;
@@ -311,9 +311,9 @@ bool LandmarkManager::ComputeConstraint(double lidarTime, bool verbose)
   // NOTE : the covariances are not used because the uncertainty is not comparable with common keypoint constraints
   // The user must play with the weight parameter to get the best result depending on the tag detection accuracy.
   if (this->PositionOnly)
-    this->Residual.Cost = CeresCostFunctions::LandmarkPositionResidual::Create(this->RelativeTransform, this->AbsolutePose);
+    this->Residual.Cost = CeresCostFunctions::LandmarkPositionResidual::Create(this->Parameterization, this->RelativeTransform, this->AbsolutePose);
   else
-    this->Residual.Cost = CeresCostFunctions::LandmarkResidual::Create(this->RelativeTransform, this->AbsolutePose);
+    this->Residual.Cost = CeresCostFunctions::LandmarkResidual::Create(this->Parameterization, this->RelativeTransform, this->AbsolutePose);
   // Use a robustifier to limit the contribution of an outlier tag detection (the tag may have been moved)
   // Tukey loss applied on residual square:
   //   rho(residual^2) = a^2 / 3 * ( 1 - (1 - residual^2 / a^2)^3 )   for residual^2 <= a^2,
@@ -18,10 +18,26 @@
 
 #include "LidarSlam/KeypointsMatcher.h"
 #include "LidarSlam/CeresCostFunctions.h"
+#include "LidarSlam/BatchPCA.h"
+
+#include <algorithm>
+#include <bitset>
+#include <functional>
 
 namespace LidarSlam
 {
 
+namespace
+{
+//-----------------------------------------------------------------------------
+NeighborhoodModel RejectedModel(KeypointsMatcher::MatchingResults::MatchStatus status)
+{
+  NeighborhoodModel model;
+  model.Status = status;
+  return model;
+}
+} // end of anonymous namespace
+
 //-----------------------------------------------------------------------------
 KeypointsMatcher::KeypointsMatcher(const KeypointsMatcher::Parameters& params,
                                    const Eigen::Isometry3d& posePrior)
@@ -31,55 +47,594 @@ KeypointsMatcher::KeypointsMatcher(const KeypointsMatcher::Parameters& params,
 
 //-----------------------------------------------------------------------------
 KeypointsMatcher::MatchingResults KeypointsMatcher::BuildMatchResiduals(const PointCloud::Ptr& currPoints,
-                                                                        const KDTree& prevPoints,
-                                                                        Keypoint keypointType)
+                                                                        const SearchIndex& prevPoints,
+                                                                        Keypoint keypointType,
+                                                                        NeighborhoodModelCache* modelCache,
+                                                                        IterationCache* iterationCache,
+                                                                        WarmStartTable* warmStart,
+                                                                        CeresTools::ResidualsPool* residualsPool)
 {
-  // Call the correct point-to-neighborhood method
-  auto BuildMatchResidual = [&](const Point& currentPoint)
+  // Reset matching results
+  MatchingResults matchingResults;
+  matchingResults.Reset(currPoints->size());
+  if (this->Params.BatchedResiduals)
+    matchingResults.Matches.resize(currPoints->size());
+
+  if (currPoints->empty() || !prevPoints.Size())
+    return matchingResults;
+
+  // Number of neighbors to extract for each keypoint
+  unsigned int knearest = 0;
+  switch(keypointType)
+  {
+    case Keypoint::EDGE:  knearest = this->Params.EdgeNbNeighbors;  break;
+    case Keypoint::PLANE: knearest = this->Params.PlaneNbNeighbors; break;
+    case Keypoint::BLOB:  knearest = this->Params.BlobNbNeighbors;  break;
+    default: break;
+  }
+
+  // If the neighborhood models are cached, only the nearest map point of each
+  // keypoint is searched : its model is then fetched from cache, or fitted
+  // around it if not available yet.
+  const unsigned int nbSearched = (modelCache && knearest) ? 1 : knearest;
+  if (modelCache)
+    modelCache->Prepare(prevPoints.GetIndicesRange(), this->GetModelParametersKey(keypointType));
+
+  // Transform the keypoints using the current pose estimation.
+  // The neighbors are searched around the estimated positions in WORLD coordinates.
+  // NOTE: The batch buffers are kept from one call to another to avoid reallocations.
+  const int nbPoints = currPoints->size();
+  thread_local std::vector<Eigen::Vector3f> worldPoints;
+  worldPoints.resize(nbPoints);
+  for (int ptIndex = 0; ptIndex < nbPoints; ++ptIndex)
+    worldPoints[ptIndex] = (this->PosePrior * currPoints->points[ptIndex].getVector3fMap().cast<double>()).cast<float>();
+
+  // Select the keypoints which neighborhood needs to be searched.
+  // If the model fitted at a previous ICP iteration is available, and the
+  // keypoint did not move much since, this model is reused.
+  if (iterationCache && iterationCache->Models.size() != currPoints->size())
+    iterationCache->Resize(nbPoints);
+  // If available, the search radius of each query is guessed from last results.
+  thread_local std::vector<int> queryRanks;
+  thread_local std::vector<float> queryPoints;
+  thread_local std::vector<unsigned int> queryBins;
+  thread_local std::vector<float> queryRadii;
+  queryRanks.resize(nbPoints);
+  queryPoints.clear();
+  queryBins.clear();
+  queryRadii.clear();
+  for (int ptIndex = 0; ptIndex < nbPoints; ++ptIndex)
   {
-    switch(keypointType)
+    if (iterationCache && iterationCache->IsValid(ptIndex, worldPoints[ptIndex], this->Params.KnnEpsilon))
+      queryRanks[ptIndex] = -1;
+    else
     {
-      case Keypoint::EDGE:
-        return this->BuildLineMatch(prevPoints, currentPoint);
-      case Keypoint::PLANE:
-        return this->BuildPlaneMatch(prevPoints, currentPoint);
-      case Keypoint::BLOB:
-        return this->BuildBlobMatch(prevPoints, currentPoint);
-      default:
-        return MatchingResults::MatchInfo{ MatchingResults::MatchStatus::UNKOWN, 0., CeresTools::Residual() };
+      queryRanks[ptIndex] = queryPoints.size() / 3;
+      queryPoints.insert(queryPoints.end(), worldPoints[ptIndex].data(), worldPoints[ptIndex].data() + 3);
+      if (warmStart)
+      {
+        queryBins.push_back(warmStart->GetBin(currPoints->points[ptIndex]));
+        queryRadii.push_back(warmStart->GetRadius(queryBins.back(), worldPoints[ptIndex]));
+      }
     }
-  };
+  }
+  const int nbQueries = queryPoints.size() / 3;
+
+  // Get neighboring points of all keypoints at once in previous set of keypoints
+  // (approximately if allowed at this ICP iteration)
+  thread_local std::vector<int> knnIndices;
+  thread_local std::vector<float> knnSqDist;
+  thread_local std::vector<size_t> knnCounts;
+  knnIndices.resize(nbQueries * nbSearched);
+  knnSqDist.resize(nbQueries * nbSearched);
+  knnCounts.assign(nbQueries, 0);
+  prevPoints.BatchKnnSearch(queryPoints.data(), nbQueries, nbSearched, knnIndices.data(), knnSqDist.data(),
+                            knnCounts.data(), this->Params.NbThreads, this->Params.KnnEpsilon,
+                            warmStart ? queryRadii.data() : nullptr);
+
+  // Update the warm start table for next calls
+  if (warmStart && nbSearched)
+  {
+    for (int queryRank = 0; queryRank < nbQueries; ++queryRank)
+    {
+      if (knnCounts[queryRank] == nbSearched)
+      {
+        Eigen::Map<const Eigen::Vector3f> queryPoint(queryPoints.data() + 3 * queryRank);
+        warmStart->Store(queryBins[queryRank], queryPoint, std::sqrt(knnSqDist[(queryRank + 1) * nbSearched - 1]));
+      }
+    }
+  }
+
+  // NOTE: The thread_local buffers must be accessed through pointers from the worker threads
+  const Eigen::Vector3f* allWorldPoints = worldPoints.data();
+  const int* allQueryRanks = queryRanks.data();
+  const int* allKnnIndices = knnIndices.data();
+  const float* allKnnSqDist = knnSqDist.data();
+  const size_t* allKnnCounts = knnCounts.data();
+
+  // Without models cache, the models of all searched keypoints are fitted in 3 batched steps :
+  // the neighbors selection, the PCA of all selected neighborhoods at once (SIMD-friendly
+  // closed-form eigen decompositions), and the models fitting from these PCA.
+  thread_local std::vector<int> selectedIndices;
+  thread_local std::vector<float> selectedSqDist;
+  thread_local std::vector<unsigned int> selectedSizes;
+  thread_local std::vector<uint8_t> selectionStatus;
+  thread_local Utils::PCABatch<double> pcaBatch;
+  if (!modelCache)
+  {
+    // The neighbors indices refer to the map pointcloud. If the map points are
+    // not stored in a single pointcloud (e.g. prior map and local points),
+    // the neighbors of all queries are first gathered in a buffer.
+    thread_local PointCloud gatheredNeighbors;
+    thread_local std::vector<int> gatheredIndices;
+    const PointCloud* neighborsCloud = prevPoints.GetInputCloud().get();
+    const int* neighborsIndices = allKnnIndices;
+    if (!neighborsCloud)
+    {
+      gatheredNeighbors.resize(nbQueries * nbSearched);
+      gatheredIndices.resize(nbQueries * nbSearched);
+      Point* allGatheredNeighbors = gatheredNeighbors.points.data();
+      int* allGatheredIndices = gatheredIndices.data();
+      #pragma omp parallel for num_threads(this->Params.NbThreads) schedule(static)
+      for (int queryRank = 0; queryRank < nbQueries; ++queryRank)
+      {
+        for (unsigned int i = queryRank * nbSearched; i < queryRank * nbSearched + allKnnCounts[queryRank]; ++i)
+        {
+          allGatheredNeighbors[i] = prevPoints.GetPoint(allKnnIndices[i]);
+          allGatheredIndices[i] = i;
+        }
+      }
+      neighborsCloud = &gatheredNeighbors;
+      neighborsIndices = allGatheredIndices;
+    }
+
+    selectedIndices.resize(nbQueries * nbSearched);
+    selectedSqDist.resize(nbQueries * nbSearched);
+    selectedSizes.resize(nbQueries);
+    selectionStatus.resize(nbQueries);
+    int* allSelectedIndices = selectedIndices.data();
+    float* allSelectedSqDist = selectedSqDist.data();
+    unsigned int* allSelectedSizes = selectedSizes.data();
+    uint8_t* allSelectionStatus = selectionStatus.data();
+
+    // Select the neighbors to fit the model on for each searched keypoint
+    #pragma omp parallel for num_threads(this->Params.NbThreads) schedule(guided, 8)
+    for (int queryRank = 0; queryRank < nbQueries; ++queryRank)
+    {
+      Neighborhood knn = { neighborsIndices + queryRank * nbSearched,
+                           allKnnSqDist + queryRank * nbSearched,
+                           static_cast<unsigned int>(allKnnCounts[queryRank]) };
+      int* indicesBuffer = allSelectedIndices + queryRank * nbSearched;
+      float* sqDistBuffer = allSelectedSqDist + queryRank * nbSearched;
+      Neighborhood selected;
+      auto status = this->SelectNeighborhood(keypointType, *neighborsCloud, knn, indicesBuffer, sqDistBuffer, selected);
+      allSelectionStatus[queryRank] = status;
+      allSelectedSizes[queryRank] = (status == MatchingResults::MatchStatus::SUCCESS) ? selected.Size : 0;
+      // Gather all selected neighborhoods in the same buffer for the batched PCA
+      if (allSelectedSizes[queryRank] && selected.Indices != indicesBuffer)
+        std::copy(selected.Indices, selected.Indices + selected.Size, indicesBuffer);
+    }
+
+    // Compute the PCA of all selected neighborhoods at once
+    Utils::ComputeMeanAndPCABatch(*neighborsCloud, selectedIndices.data(), selectedSizes.data(), nbSearched,
+                                  nbQueries, pcaBatch, this->Params.NbThreads);
+  }
+  const uint8_t* allSelectionStatus = selectionStatus.data();
+  const Utils::PCABatch<double>& pca = pcaBatch;
+
+  // Allocate the pooled residuals before sharing the pool between threads
+  if (residualsPool)
+    residualsPool->Reserve(nbPoints, this->Params.Parameterization);
 
+  // Loop over keypoints and try to build residuals
+  #pragma omp parallel for num_threads(this->Params.NbThreads) schedule(guided, 8)
+  for (int ptIndex = 0; ptIndex < nbPoints; ++ptIndex)
+  {
+    const Point& currentPoint = currPoints->points[ptIndex];
+    const int queryRank = allQueryRanks[ptIndex];
+    NeighborhoodModel model;
+    if (queryRank < 0)
+      model = iterationCache->Models[ptIndex];
+    else
+    {
+      if (modelCache)
+      {
+        Neighborhood knn = { allKnnIndices + queryRank * nbSearched,
+                             allKnnSqDist + queryRank * nbSearched,
+                             static_cast<unsigned int>(allKnnCounts[queryRank]) };
+        model = this->GetCachedModel(*modelCache, prevPoints, keypointType, knn, knearest);
+      }
+      else if (allSelectionStatus[queryRank] != MatchingResults::MatchStatus::SUCCESS)
+        model = RejectedModel(static_cast<MatchingResults::MatchStatus>(allSelectionStatus[queryRank]));
+      else
+        model = this->FitModel(keypointType, pca.GetMean(queryRank), pca.GetEigenVectors(queryRank), pca.GetEigenValues(queryRank));
+      if (iterationCache)
+        iterationCache->Store(ptIndex, allWorldPoints[ptIndex], this->Params.KnnEpsilon, model);
+    }
+    const auto& match = this->BuildMatch(model, currentPoint, residualsPool, ptIndex);
+    matchingResults.Rejections[ptIndex] = match.Status;
+    matchingResults.Weights[ptIndex] = match.Weight;
+    matchingResults.Residuals[ptIndex] = match.Cost;
+    if (this->Params.BatchedResiduals)
+      matchingResults.Matches[ptIndex] = match.Match;
+    #pragma omp atomic
+    matchingResults.RejectionsHistogram[match.Status]++;
+  }
+
+  return matchingResults;
+}
+
+
+//-----------------------------------------------------------------------------
+KeypointsMatcher::MatchingResults KeypointsMatcher::BuildVoxelMatchResiduals(const PointCloud::Ptr& currPoints,
+                                                                             const RollingGrid& map,
+                                                                             Keypoint keypointType,
+                                                                             CeresTools::ResidualsPool* residualsPool)
+{
   // Reset matching results
   MatchingResults matchingResults;
   matchingResults.Reset(currPoints->size());
+  if (this->Params.BatchedResiduals)
+    matchingResults.Matches.resize(currPoints->size());
+
+  if (currPoints->empty() || !map.Size())
+    return matchingResults;
+
+  // Allocate the pooled residuals before sharing the pool between threads
+  const int nbPoints = currPoints->size();
+  if (residualsPool)
+    residualsPool->Reserve(nbPoints, this->Params.Parameterization);
 
   // Loop over keypoints and try to build residuals
-  if (!currPoints->empty() && prevPoints.GetInputCloud() && !prevPoints.GetInputCloud()->empty())
+  #pragma omp parallel for num_threads(this->Params.NbThreads) schedule(guided, 8)
+  for (int ptIndex = 0; ptIndex < nbPoints; ++ptIndex)
   {
-    #pragma omp parallel for num_threads(this->Params.NbThreads) schedule(guided, 8)
-    for (int ptIndex = 0; ptIndex < static_cast<int>(currPoints->size()); ++ptIndex)
-    {
-      const Point& currentPoint = currPoints->points[ptIndex];
-      const auto& match = BuildMatchResidual(currentPoint);
-      matchingResults.Rejections[ptIndex] = match.Status;
-      matchingResults.Weights[ptIndex] = match.Weight;
-      matchingResults.Residuals[ptIndex] = match.Cost;
-      #pragma omp atomic
-      matchingResults.RejectionsHistogram[match.Status]++;
-    }
+    // Transform the keypoint using the current pose estimation,
+    // and get the statistics of the map voxels around it
+    const Point& currentPoint = currPoints->points[ptIndex];
+    Eigen::Vector3f worldPoint = (this->PosePrior * currentPoint.getVector3fMap().cast<double>()).cast<float>();
+    RollingGrid::VoxelStatistics stats = map.GetNeighborhoodStatistics(worldPoint);
+
+    NeighborhoodModel model = this->BuildVoxelModel(keypointType, stats, worldPoint);
+    const auto& match = this->BuildMatch(model, currentPoint, residualsPool, ptIndex);
+    matchingResults.Rejections[ptIndex] = match.Status;
+    matchingResults.Weights[ptIndex] = match.Weight;
+    matchingResults.Residuals[ptIndex] = match.Cost;
+    if (this->Params.BatchedResiduals)
+      matchingResults.Matches[ptIndex] = match.Match;
+    #pragma omp atomic
+    matchingResults.RejectionsHistogram[match.Status]++;
   }
 
   return matchingResults;
 }
 
+//-----------------------------------------------------------------------------
+void KeypointsMatcher::SelectMatches(std::map<Keypoint, MatchingResults>& matchingResults,
+                                     const Eigen::Isometry3d& pose, unsigned int budget)
+{
+  // Gather all successful matches
+  std::vector<std::pair<Keypoint, unsigned int>> matches;
+  for (const auto& kv : matchingResults)
+  {
+    for (unsigned int i = 0; i < kv.second.Matches.size(); ++i)
+      if (kv.second.Rejections[i] == MatchingResults::MatchStatus::SUCCESS && kv.second.Matches[i].Weight > 0.)
+        matches.emplace_back(kv.first, i);
+  }
+  const unsigned int nbMatches = matches.size();
+  if (nbMatches <= budget)
+    return;
+
+  // Jacobian of each weighted match residual wrt the translation (Jt = A) and
+  // the rotation (Jr = -A [R X]x) of the pose, and total information of each part
+  std::vector<Eigen::Matrix3d> Jt(nbMatches), Jr(nbMatches);
+  Eigen::Matrix3d infoT = Eigen::Matrix3d::Zero();
+  Eigen::Matrix3d infoR = Eigen::Matrix3d::Zero();
+  for (unsigned int m = 0; m < nbMatches; ++m)
+  {
+    const CeresTools::PointToModelMatch& match = matchingResults[matches[m].first].Matches[matches[m].second];
+    const Eigen::Vector3d Y = pose.linear() * match.X;
+    Eigen::Matrix3d skewY;
+    skewY <<    0., -Y.z(),  Y.y(),
+             Y.z(),     0., -Y.x(),
+            -Y.y(),  Y.x(),     0.;
+    Jt[m] = std::sqrt(match.Weight) * match.A;
+    Jr[m] = -Jt[m] * skewY;
+    infoT.noalias() += Jt[m].transpose() * Jt[m];
+    infoR.noalias() += Jr[m].transpose() * Jr[m];
+  }
+
+  // Principal directions of information, the less constrained ones first,
+  // alternating translation and rotation
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigT(infoT), eigR(infoR);
+  std::vector<std::pair<const Eigen::Matrix3d*, Eigen::Vector3d>> directions;
+  for (int d = 0; d < 3; ++d)
+  {
+    directions.emplace_back(&Jt[0], eigT.eigenvectors().col(d));
+    directions.emplace_back(&Jr[0], eigR.eigenvectors().col(d));
+  }
+
+  // Select the most informative matches along each direction
+  std::vector<bool> selected(nbMatches, false);
+  std::vector<std::pair<double, unsigned int>> scores(nbMatches);
+  unsigned int nbSelected = 0;
+  for (unsigned int d = 0; d < directions.size(); ++d)
+  {
+    // Budget of this direction, the remainder being given to the first ones
+    const unsigned int dirBudget = std::min(budget / 6 + (d < budget % 6), budget - nbSelected);
+    const Eigen::Matrix3d* J = directions[d].first;
+    const Eigen::Vector3d& u = directions[d].second;
+    for (unsigned int m = 0; m < nbMatches; ++m)
+      scores[m] = {selected[m] ? -1. : (J[m] * u).squaredNorm(), m};
+    std::nth_element(scores.begin(), scores.begin() + dirBudget, scores.end(), std::greater<std::pair<double, unsigned int>>());
+    for (unsigned int i = 0; i < dirBudget; ++i)
+    {
+      if (scores[i].first >= 0.)
+      {
+        selected[scores[i].second] = true;
+        ++nbSelected;
+      }
+    }
+  }
+
+  // Discard the matches not selected
+  for (unsigned int m = 0; m < nbMatches; ++m)
+  {
+    if (selected[m])
+      continue;
+    MatchingResults& results = matchingResults[matches[m].first];
+    const unsigned int i = matches[m].second;
+    results.Rejections[i] = MatchingResults::MatchStatus::NOT_SELECTED;
+    results.Weights[i] = 0.;
+    results.Matches[i].Weight = 0.;
+    results.RejectionsHistogram[MatchingResults::MatchStatus::SUCCESS]--;
+    results.RejectionsHistogram[MatchingResults::MatchStatus::NOT_SELECTED]++;
+  }
+}
 
 //----------------------------------------------------------------------------
-CeresTools::Residual KeypointsMatcher::BuildResidual(const Eigen::Matrix3d& A, const Eigen::Vector3d& P, const Eigen::Vector3d& X, double weight)
+void KeypointsMatcher::ScratchBuffers::Reserve(unsigned int nbNeighbors)
+{
+  // Grow only: no-op if the capacity is already sufficient
+  this->Indices.reserve(nbNeighbors);
+  this->SqDistances.reserve(nbNeighbors);
+}
+
+//-----------------------------------------------------------------------------
+KeypointsMatcher::ScratchBuffers& KeypointsMatcher::GetScratchBuffers()
+{
+  thread_local ScratchBuffers buffers;
+  return buffers;
+}
+
+//-----------------------------------------------------------------------------
+KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildMatch(const NeighborhoodModel& model, const Point& p,
+                                                                          CeresTools::ResidualsPool* pool, unsigned int poolIndex)
+{
+  if (model.Status != MatchingResults::MatchStatus::SUCCESS)
+    return { static_cast<MatchingResults::MatchStatus>(model.Status), 0., CeresTools::Residual(), CeresTools::PointToModelMatch() };
+
+  // basePoint is the raw local position in BASE coordinates, on which we need to apply the transform to optimize.
+  Eigen::Vector3d basePoint = p.getVector3fMap().cast<double>();
+
+  // Only store the match parameters if it is optimized within a batched residual
+  if (this->Params.BatchedResiduals)
+  {
+    CeresTools::PointToModelMatch match = { model.A, model.P, basePoint, this->Params.SaturationDistance, model.Weight };
+    return { MatchingResults::MatchStatus::SUCCESS, model.Weight, CeresTools::Residual(), match };
+  }
+
+  CeresTools::Residual res = this->BuildResidual(model.A, model.P, basePoint, model.Weight, pool, poolIndex);
+  return { MatchingResults::MatchStatus::SUCCESS, model.Weight, res, CeresTools::PointToModelMatch() };
+}
+
+//-----------------------------------------------------------------------------
+NeighborhoodModel KeypointsMatcher::GetCachedModel(NeighborhoodModelCache& modelCache,
+                                                   const SearchIndex& prevPoints,
+                                                   Keypoint keypointType,
+                                                   const Neighborhood& nearest,
+                                                   unsigned int knearest)
+{
+  // Check the nearest map point
+  if (nearest.Size == 0)
+    return RejectedModel(MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS);
+  if (nearest.SqDistances[0] > this->Params.MaxNeighborsDistance * this->Params.MaxNeighborsDistance)
+    return RejectedModel(MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR);
+
+  // Get the model fitted on the neighborhood of the nearest map point
+  const int mapIndex = nearest.Indices[0];
+  auto fitModel = [&]()
+  {
+    ScratchBuffers& scratch = GetScratchBuffers();
+    scratch.KnnIndices.resize(knearest);
+    scratch.KnnSqDistances.resize(knearest);
+    unsigned int neighborhoodSize = prevPoints.KnnSearch(prevPoints.GetPoint(mapIndex).data, knearest,
+                                                         scratch.KnnIndices.data(), scratch.KnnSqDistances.data());
+    Neighborhood knn = { scratch.KnnIndices.data(), scratch.KnnSqDistances.data(), neighborhoodSize };
+    const PointCloud* prevCloud = prevPoints.GetInputCloud().get();
+    if (prevCloud)
+      return this->BuildModel(keypointType, *prevCloud, knn);
+
+    // Gather the neighbors if the map points are not stored in a single pointcloud
+    scratch.Neighbors.resize(neighborhoodSize);
+    for (unsigned int i = 0; i < neighborhoodSize; ++i)
+    {
+      scratch.Neighbors[i] = prevPoints.GetPoint(scratch.KnnIndices[i]);
+      scratch.KnnIndices[i] = i;
+    }
+    return this->BuildModel(keypointType, scratch.Neighbors, knn);
+  };
+  return modelCache.Get(mapIndex, fitModel);
+}
+
+//-----------------------------------------------------------------------------
+void KeypointsMatcher::IterationCache::Resize(unsigned int nbPoints)
+{
+  // NaN positions are never valid
+  this->Positions.assign(nbPoints, Eigen::Vector3f::Constant(std::numeric_limits<float>::quiet_NaN()));
+  this->Epsilons.assign(nbPoints, 0.);
+  this->Models.assign(nbPoints, NeighborhoodModel());
+}
+
+//-----------------------------------------------------------------------------
+unsigned int KeypointsMatcher::WarmStartTable::GetBin(const Point& basePoint) const
+{
+  double azimuth = std::atan2(basePoint.y, basePoint.x);
+  unsigned int azimuthBin = static_cast<unsigned int>((azimuth + M_PI) / (2. * M_PI) * this->NbAzimuthBins);
+  azimuthBin = std::min(azimuthBin, this->NbAzimuthBins - 1);
+  return basePoint.laser_id * this->NbAzimuthBins + azimuthBin;
+}
+
+//-----------------------------------------------------------------------------
+float KeypointsMatcher::WarmStartTable::GetRadius(unsigned int bin, const Eigen::Vector3f& worldPoint) const
+{
+  if (bin >= this->Radii.size() || this->Radii[bin] <= 0.f)
+    return 0.f;
+  // By triangle inequality, the k neighbors of the last keypoint lie within
+  // this radius (if the target points did not change)
+  return this->Radii[bin] + ((this->WorldToFixed * worldPoint.cast<double>()).cast<float>() - this->Positions[bin]).norm();
+}
+
+//-----------------------------------------------------------------------------
+void KeypointsMatcher::WarmStartTable::Store(unsigned int bin, const Eigen::Vector3f& worldPoint, float radius)
+{
+  if (bin >= this->Radii.size())
+  {
+    // Allocate all bins of the new laser rings
+    unsigned int size = (bin / this->NbAzimuthBins + 1) * this->NbAzimuthBins;
+    this->Positions.resize(size, Eigen::Vector3f::Zero());
+    this->Radii.resize(size, 0.f);
+  }
+  this->Positions[bin] = (this->WorldToFixed * worldPoint.cast<double>()).cast<float>();
+  this->Radii[bin] = radius;
+}
+
+//-----------------------------------------------------------------------------
+KeypointsMatcher::MatchingResults::MatchStatus KeypointsMatcher::SelectNeighborhood(Keypoint keypointType, const PointCloud& prevPoints,
+                                                                                    const Neighborhood& knn, int* indicesBuffer,
+                                                                                    float* sqDistBuffer, Neighborhood& selected)
+{
+  // Call the correct neighbors selection method
+  switch(keypointType)
+  {
+    case Keypoint::EDGE:
+      return this->SelectLineNeighbors(prevPoints, knn, indicesBuffer, sqDistBuffer, selected);
+    case Keypoint::PLANE:
+      return this->SelectPlaneNeighbors(knn, selected);
+    case Keypoint::BLOB:
+      return this->SelectBlobNeighbors(knn, selected);
+    default:
+      return MatchingResults::MatchStatus::UNKOWN;
+  }
+}
+
+//-----------------------------------------------------------------------------
+NeighborhoodModel KeypointsMatcher::FitModel(Keypoint keypointType, const Eigen::Vector3d& mean,
+                                             const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const
+{
+  // Call the correct model fitting method
+  switch(keypointType)
+  {
+    case Keypoint::EDGE:
+      return this->FitLineModel(mean, eigVecs, eigVals);
+    case Keypoint::PLANE:
+      return this->FitPlaneModel(mean, eigVecs, eigVals);
+    case Keypoint::BLOB:
+      return this->FitBlobModel(mean, eigVecs, eigVals);
+    default:
+      return RejectedModel(MatchingResults::MatchStatus::UNKOWN);
+  }
+}
+
+//-----------------------------------------------------------------------------
+NeighborhoodModel KeypointsMatcher::BuildModel(Keypoint keypointType, const PointCloud& prevPoints, const Neighborhood& knn)
+{
+  // Select the neighbors to fit the model on
+  ScratchBuffers& scratch = GetScratchBuffers();
+  scratch.SelectedIndices.resize(knn.Size);
+  scratch.SelectedSqDistances.resize(knn.Size);
+  Neighborhood selected;
+  auto status = this->SelectNeighborhood(keypointType, prevPoints, knn, scratch.SelectedIndices.data(),
+                                         scratch.SelectedSqDistances.data(), selected);
+  if (status != MatchingResults::MatchStatus::SUCCESS)
+    return RejectedModel(status);
+
+  // Compute PCA to determine best model approximation of the neighborhood
+  Eigen::Vector3d mean;
+  Eigen::Vector3d eigVals;
+  Eigen::Matrix3d eigVecs;
+  Utils::ComputeMeanAndPCA(prevPoints, selected.Indices, selected.Size, mean, eigVecs, eigVals);
+  return this->FitModel(keypointType, mean, eigVecs, eigVals);
+}
+
+//-----------------------------------------------------------------------------
+NeighborhoodModel KeypointsMatcher::BuildVoxelModel(Keypoint keypointType, const RollingGrid::VoxelStatistics& stats,
+                                                    const Eigen::Vector3f& worldPoint) const
 {
+  // Min number of points needed to fit the model (at least 2 for a line,
+  // 3 for a plane and 4 for an ellipsoid)
+  unsigned int minNbPoints = 0;
+  unsigned int minModelPoints = 0;
+  switch(keypointType)
+  {
+    case Keypoint::EDGE:  minNbPoints = this->Params.EdgeMinNbNeighbors; minModelPoints = 2; break;
+    case Keypoint::PLANE: minNbPoints = this->Params.PlaneNbNeighbors;   minModelPoints = 3; break;
+    case Keypoint::BLOB:  minNbPoints = this->Params.BlobNbNeighbors;    minModelPoints = 4; break;
+    default: return RejectedModel(MatchingResults::MatchStatus::UNKOWN);
+  }
+  if (minNbPoints < minModelPoints)
+    return RejectedModel(MatchingResults::MatchStatus::BAD_MODEL_PARAMETRIZATION);
+
+  // It means that there is not enough map points around the keypoint
+  if (stats.N < minNbPoints)
+    return RejectedModel(MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS);
+
+  // If the neighborhood is too far from the current keypoint, we skip this point.
+  if ((stats.Mean - worldPoint).squaredNorm() > this->Params.MaxNeighborsDistance * this->Params.MaxNeighborsDistance)
+    return RejectedModel(MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR);
+
+  // Compute PCA of the neighborhood from its covariance
+  // (symmetrized to remove the incremental computation rounding errors)
+  Eigen::Matrix3d covariance = stats.Scatter.cast<double>() / stats.N;
+  covariance = 0.5 * (covariance + covariance.transpose()).eval();
+  Eigen::Matrix3d eigVecs;
+  Eigen::Vector3d eigVals;
+  pcl::eigen33(covariance, eigVecs, eigVals);
+  return this->FitModel(keypointType, stats.Mean.cast<double>(), eigVecs, eigVals);
+}
+
+//-----------------------------------------------------------------------------
+uint64_t KeypointsMatcher::GetModelParametersKey(Keypoint keypointType) const
+{
+  // Combine the hashes of all parameters used to fit the neighborhood models
+  std::size_t key = std::hash<int>()(static_cast<int>(keypointType));
+  auto combine = [&key](double value)
+  {
+    key ^= std::hash<double>()(value) + 0x9e3779b9 + (key << 6) + (key >> 2);
+  };
+  combine(this->Params.SingleEdgePerRing);
+  combine(this->Params.MaxNeighborsDistance);
+  combine(this->Params.EdgeNbNeighbors);
+  combine(this->Params.EdgeMinNbNeighbors);
+  combine(this->Params.EdgeMaxModelError);
+  combine(this->Params.PlaneNbNeighbors);
+  combine(this->Params.PlanarityThreshold);
+  combine(this->Params.PlaneMaxModelError);
+  combine(this->Params.BlobNbNeighbors);
+  return key;
+}
+
+//-----------------------------------------------------------------------------
+CeresTools::Residual KeypointsMatcher::BuildResidual(const Eigen::Matrix3d& A, const Eigen::Vector3d& P, const Eigen::Vector3d& X, double weight,
+                                                     CeresTools::ResidualsPool* pool, unsigned int poolIndex)
+{
+  // Recycle a pooled residual if available (same cost and robustifier)
+  if (pool)
+    return pool->Get(poolIndex, A, P, X, this->Params.SaturationDistance, weight);
+
   CeresTools::Residual res;
   // Create the point-to-line/plane/blob cost function
-  res.Cost = CeresCostFunctions::MahalanobisDistanceAffineIsometryResidual::Create(A, P, X);
+  res.Cost = CeresCostFunctions::MahalanobisDistanceAffineIsometryResidual::Create(this->Params.Parameterization, A, P, X);
 
   // Use a robustifier to limit the contribution of an outlier match
   // Tukey loss applied on residual square:
@@ -87,66 +642,62 @@ CeresTools::Residual KeypointsMatcher::BuildResidual(const Eigen::Matrix3d& A, c
   //   rho(residual^2) = a^2 / 3                                      for residual^2 >  a^2.
   // a is the scaling parameter of the function
   // See http://ceres-solver.org/nnls_modeling.html#theory for details
-  auto* robustifier = new ceres::TukeyLoss(this->Params.SaturationDistance);
-
-  // Weight the contribution of the given match by its reliability
-  // WARNING : in CERES version < 2.0.0, the Tukey loss is badly implemented, so we have to correct the weight by a factor 2
-  // See https://github.com/ceres-solver/ceres-solver/commit/6da364713f5b78ddf15b0e0ad92c76362c7c7683 for details
-  // This is important for covariance scaling 
-  #if (CERES_VERSION_MAJOR < 2)
-    res.Robustifier.reset(new ceres::ScaledLoss(robustifier, 2.0 * weight, ceres::TAKE_OWNERSHIP));
-  // If Ceres version >= 2.0.0, the Tukey loss is corrected.
-  #else
-    res.Robustifier.reset(new ceres::ScaledLoss(robustifier, weight, ceres::TAKE_OWNERSHIP));
-  #endif
+  // The contribution of the given match is weighted by its reliability.
+  // NOTE: This loss does not depend on the Ceres version (cf. ScaledTukeyLoss),
+  // which is important for covariance scaling.
+  res.Robustifier = std::make_shared<CeresTools::ScaledTukeyLoss>(this->Params.SaturationDistance, weight);
   return res;
 }
 
 //-----------------------------------------------------------------------------
-KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildLineMatch(const KDTree& previousEdges, const Point& p)
+KeypointsMatcher::MatchingResults::MatchStatus KeypointsMatcher::SelectLineNeighbors(const PointCloud& previousEdges, const Neighborhood& knn,
+                                                                                     int* indicesBuffer, float* sqDistBuffer,
+                                                                                     Neighborhood& selected)
 {
   // At least 2 points are needed to fit a line model
   if (this->Params.EdgeNbNeighbors < 2 || this->Params.EdgeMinNbNeighbors < 2)
-    return { MatchingResults::MatchStatus::BAD_MODEL_PARAMETRIZATION, 0., CeresTools::Residual() };
-
-  // =====================================================
-  // Transform the point using the current pose estimation
-
-  // basePoint is the raw local position in BASE coordinates, on which we need to apply the transform to optimize.
-  // worldPoint is the estimated position in WORLD coodinates, transformed using initial prior.
-  Eigen::Vector3d basePoint = p.getVector3fMap().cast<double>();
-  Eigen::Vector3d worldPoint = this->PosePrior * basePoint;
+    return MatchingResults::MatchStatus::BAD_MODEL_PARAMETRIZATION;
 
   // ===================================================
-  // Get neighboring points in previous set of keypoints
-
-  std::vector<int> knnIndices;
-  std::vector<float> knnSqDist;
+  // Select neighboring points in previous set of keypoints
+
+  ScratchBuffers& scratch = GetScratchBuffers();
+  scratch.Reserve(this->Params.EdgeNbNeighbors);
+  std::vector<int>& knnIndices = scratch.Indices;
+  std::vector<float>& knnSqDist = scratch.SqDistances;
+  knnIndices.clear();
+  knnSqDist.clear();
   if (this->Params.SingleEdgePerRing)
-    this->GetPerRingLineNeighbors(previousEdges, worldPoint.data(), this->Params.EdgeNbNeighbors, knnIndices, knnSqDist);
+    this->GetPerRingLineNeighbors(previousEdges, knn, knnIndices, knnSqDist);
   else
-    this->GetRansacLineNeighbors(previousEdges, worldPoint.data(), this->Params.EdgeNbNeighbors, this->Params.EdgeMaxModelError, knnIndices, knnSqDist);
+    this->GetRansacLineNeighbors(previousEdges, knn, this->Params.EdgeMaxModelError, knnIndices, knnSqDist);
 
   // If not enough neighbors, abort
   unsigned int neighborhoodSize = knnIndices.size();
   if (neighborhoodSize < this->Params.EdgeMinNbNeighbors)
-    return { MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS, 0., CeresTools::Residual() };
+    return MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS;
 
   // If the nearest edges are too far from the current edge keypoint,
   // we skip this point.
   if (knnSqDist.back() > this->Params.MaxNeighborsDistance * this->Params.MaxNeighborsDistance)
-    return { MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR, 0., CeresTools::Residual() };
+    return MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR;
+
+  // Output the selected neighbors (the buffers must be large enough to store all knn)
+  std::copy(knnIndices.begin(), knnIndices.end(), indicesBuffer);
+  std::copy(knnSqDist.begin(), knnSqDist.end(), sqDistBuffer);
+  selected = { indicesBuffer, sqDistBuffer, neighborhoodSize };
+  return MatchingResults::MatchStatus::SUCCESS;
+}
 
+//-----------------------------------------------------------------------------
+NeighborhoodModel KeypointsMatcher::FitLineModel(const Eigen::Vector3d& mean, const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const
+{
   // =======================================================
   // Check if neighborhood is a good line candidate with PCA
 
-  // Compute PCA to determine best line approximation of the neighborhood.
+  // The PCA of the neighborhood determines its best line approximation.
   // Thanks to the PCA we will check the shape of the neighborhood and keep it
   // if it is well distributed along a line.
-  Eigen::Vector3d mean;
-  Eigen::Vector3d eigVals;
-  Eigen::Matrix3d eigVecs;
-  Utils::ComputeMeanAndPCA(*previousEdges.GetInputCloud(), knnIndices, mean, eigVecs, eigVals);
 
   // =============================================
   // Compute point-to-line optimization parameters
@@ -167,12 +718,12 @@ KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildLineMatch(co
   // It would be the case if P1 = P2, for instance if the sensor has some dual
   // returns that hit the same point.
   if (!std::isfinite(A(0, 0)))
-    return { MatchingResults::MatchStatus::INVALID_NUMERICAL, 0., CeresTools::Residual() };
+    return RejectedModel(MatchingResults::MatchStatus::INVALID_NUMERICAL);
 
   // If the MSE is too high, the target model is not accurate enough, discard the match in optimization
   double mse = eigVals(0) + eigVals(1);
   if (mse >= std::pow(this->Params.EdgeMaxModelError, 2))
-    return { MatchingResults::MatchStatus::MSE_TOO_LARGE, 0., CeresTools::Residual() };
+    return RejectedModel(MatchingResults::MatchStatus::MSE_TOO_LARGE);
 
   // ===========================================
   // Add valid parameters for later optimization
@@ -182,57 +733,50 @@ KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildLineMatch(co
   // Otherwise, assign a weight relative to the points to model error and a user parameter maximum value
   double fitQualityCoeff = (mse <= 1e-6) ? 1. : 1. - std::sqrt(mse) / this->Params.EdgeMaxModelError;
 
-  CeresTools::Residual res = this->BuildResidual(A, mean, basePoint, fitQualityCoeff);
-  return { MatchingResults::MatchStatus::SUCCESS, fitQualityCoeff, res };
+  return { A, mean, fitQualityCoeff, MatchingResults::MatchStatus::SUCCESS };
 }
 
 //-----------------------------------------------------------------------------
-KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildPlaneMatch(const KDTree& previousPlanes, const Point& p)
+KeypointsMatcher::MatchingResults::MatchStatus KeypointsMatcher::SelectPlaneNeighbors(const Neighborhood& knn, Neighborhood& selected) const
 {
   // At least 3 points are needed to fit a plane model
   if (this->Params.PlaneNbNeighbors < 3)
-    return { MatchingResults::MatchStatus::BAD_MODEL_PARAMETRIZATION, 0., CeresTools::Residual() };
-
-  // =====================================================
-  // Transform the point using the current pose estimation
-
-  // basePoint is the raw local position in BASE coordinates, on which we need to apply the transform to optimize.
-  // worldPoint is the estimated position in WORLD coodinates, transformed using initial prior.
-  Eigen::Vector3d basePoint = p.getVector3fMap().cast<double>();
-  Eigen::Vector3d worldPoint = this->PosePrior * basePoint;
+    return MatchingResults::MatchStatus::BAD_MODEL_PARAMETRIZATION;
 
   // ===================================================
   // Get neighboring points in previous set of keypoints
 
-  std::vector<int> knnIndices;
-  std::vector<float> knnSqDist;
-  unsigned int neighborhoodSize = previousPlanes.KnnSearch(worldPoint.data(), this->Params.PlaneNbNeighbors, knnIndices, knnSqDist);
+  unsigned int neighborhoodSize = knn.Size;
 
   // It means that there is not enough keypoints in the neighborhood
   if (neighborhoodSize < this->Params.PlaneNbNeighbors)
-    return { MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS, 0., CeresTools::Residual() };
+    return MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS;
 
   // If the nearest planar points are too far from the current keypoint,
   // we skip this point.
-  if (knnSqDist.back() > this->Params.MaxNeighborsDistance * this->Params.MaxNeighborsDistance)
-    return { MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR, 0., CeresTools::Residual() };
+  if (knn.SqDistances[neighborhoodSize - 1] > this->Params.MaxNeighborsDistance * this->Params.MaxNeighborsDistance)
+    return MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR;
 
+  // All nearest neighbors are used
+  selected = knn;
+  return MatchingResults::MatchStatus::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+NeighborhoodModel KeypointsMatcher::FitPlaneModel(const Eigen::Vector3d& mean, const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const
+{
   // ========================================================
   // Check if neighborhood is a good plane candidate with PCA
 
-  // Compute PCA to determine best plane approximation of the neighborhood.
+  // The PCA of the neighborhood determines its best plane approximation.
   // Thanks to the PCA we will check the shape of the neighborhood and keep it
   // if it is well distributed along a plane.
-  Eigen::Vector3d mean;
-  Eigen::Vector3d eigVals;
-  Eigen::Matrix3d eigVecs;
-  Utils::ComputeMeanAndPCA(*previousPlanes.GetInputCloud(), knnIndices, mean, eigVecs, eigVals);
 
   // If the second eigen value is close to the highest one and bigger than the
   // smallest one, it means that the points are distributed along a plane.
   // Otherwise, discard this bad unstructured neighborhood.
   if (eigVals(1) / eigVals(2) < this->Params.PlanarityThreshold)
-    return { MatchingResults::MatchStatus::BAD_PCA_STRUCTURE, 0., CeresTools::Residual() };
+    return RejectedModel(MatchingResults::MatchStatus::BAD_PCA_STRUCTURE);
 
   // ==============================================
   // Compute point-to-plane optimization parameters
@@ -253,12 +797,12 @@ KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildPlaneMatch(c
   // It would be the case if P1 = P2, P1 = P3 or P3 = P2, for instance if the
   // sensor has some dual returns that hit the same point.
   if (!std::isfinite(A(0, 0)))
-    return { MatchingResults::MatchStatus::INVALID_NUMERICAL, 0., CeresTools::Residual() };
+    return RejectedModel(MatchingResults::MatchStatus::INVALID_NUMERICAL);
 
   // If the MSE is too high, the target model is not accurate enough, discard the match in optimization
   double mse = eigVals(0);
   if (mse >= std::pow(this->Params.PlaneMaxModelError, 2))
-    return { MatchingResults::MatchStatus::MSE_TOO_LARGE, 0., CeresTools::Residual() };
+    return RejectedModel(MatchingResults::MatchStatus::MSE_TOO_LARGE);
 
   // ===========================================
   // Add valid parameters for later optimization
@@ -268,55 +812,48 @@ KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildPlaneMatch(c
   // Otherwise, assign a weight relative to the points to model error and a user parameter maximum value
   double fitQualityCoeff = (mse <= 1e-6) ? 1. : 1. - std::sqrt(mse) / this->Params.PlaneMaxModelError;
 
-  CeresTools::Residual res = this->BuildResidual(A, mean, basePoint, fitQualityCoeff);
-  return { MatchingResults::MatchStatus::SUCCESS, fitQualityCoeff, res };
+  return { A, mean, fitQualityCoeff, MatchingResults::MatchStatus::SUCCESS };
 }
 
 //-----------------------------------------------------------------------------
-KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildBlobMatch(const KDTree& previousBlobs, const Point& p)
+KeypointsMatcher::MatchingResults::MatchStatus KeypointsMatcher::SelectBlobNeighbors(const Neighborhood& knn, Neighborhood& selected) const
 {
   // At least 4 points are needed to fit an ellipsoid model
   if (this->Params.BlobNbNeighbors < 4)
-    return { MatchingResults::MatchStatus::BAD_MODEL_PARAMETRIZATION, 0., CeresTools::Residual() };
-
-  // =====================================================
-  // Transform the point using the current pose estimation
-
-  // basePoint is the raw local position in BASE coordinates, on which we need to apply the transform to optimize.
-  // worldPoint is the estimated position in WORLD coodinates, transformed using initial prior.
-  Eigen::Vector3d basePoint = p.getVector3fMap().cast<double>();
-  Eigen::Vector3d worldPoint = this->PosePrior * basePoint;
+    return MatchingResults::MatchStatus::BAD_MODEL_PARAMETRIZATION;
 
   // ===================================================
   // Get neighboring points in previous set of keypoints
 
-  std::vector<int> knnIndices;
-  std::vector<float> knnSqDist;
-  unsigned int neighborhoodSize = previousBlobs.KnnSearch(worldPoint.data(), this->Params.BlobNbNeighbors, knnIndices, knnSqDist);
+  unsigned int neighborhoodSize = knn.Size;
 
   // It means that there is not enough keypoints in the neighborhood
   if (neighborhoodSize < this->Params.BlobNbNeighbors)
-    return { MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS, 0., CeresTools::Residual() };
+    return MatchingResults::MatchStatus::NOT_ENOUGH_NEIGHBORS;
 
   // If the nearest blob points are too far from the current keypoint,
   // we skip this point.
-  if (knnSqDist.back() > this->Params.MaxNeighborsDistance * this->Params.MaxNeighborsDistance)
-    return { MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR, 0., CeresTools::Residual() };
+  if (knn.SqDistances[neighborhoodSize - 1] > this->Params.MaxNeighborsDistance * this->Params.MaxNeighborsDistance)
+    return MatchingResults::MatchStatus::NEIGHBORS_TOO_FAR;
 
+  // All nearest neighbors are used
+  selected = knn;
+  return MatchingResults::MatchStatus::SUCCESS;
+}
+
+//-----------------------------------------------------------------------------
+NeighborhoodModel KeypointsMatcher::FitBlobModel(const Eigen::Vector3d& mean, const Eigen::Matrix3d& eigVecs, const Eigen::Vector3d& eigVals) const
+{
   // ======================================================
   // Compute point-to-blob optimization parameters with PCA
 
-  // Compute PCA to determine best ellipsoid approximation of the neighborhood.
+  // The PCA of the neighborhood determines its best ellipsoid approximation.
   // Thanks to the PCA we will check the shape of the neighborhood and tune a
   // distance function adapted to the distribution (Mahalanobis distance).
-  Eigen::Vector3d mean;
-  Eigen::Vector3d eigVals;
-  Eigen::Matrix3d eigVecs;
-  Utils::ComputeMeanAndPCA(*previousBlobs.GetInputCloud(), knnIndices, mean, eigVecs, eigVals);
 
   // Check PCA structure
   if (eigVals(0) <= 0. || eigVals(1) <= 0.)
-    return { MatchingResults::MatchStatus::BAD_PCA_STRUCTURE, 0., CeresTools::Residual()};
+    return RejectedModel(MatchingResults::MatchStatus::BAD_PCA_STRUCTURE);
 
   // Compute the inverse squared out covariance matrix
   // of the target neighborhood -> A = Covariance^(-1/2)
@@ -333,7 +870,7 @@ KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildBlobMatch(co
   // It would be the case if P1 = P2, for instance if the sensor has some dual
   // returns that hit the same point.
   if (!std::isfinite(A(0, 0)) || !std::isfinite(eigValsSqrtInv.prod()))
-    return { MatchingResults::MatchStatus::INVALID_NUMERICAL, 0., CeresTools::Residual() };
+    return RejectedModel(MatchingResults::MatchStatus::INVALID_NUMERICAL);
 
   // ===========================================
   // Add valid parameters for later optimization
@@ -341,26 +878,22 @@ KeypointsMatcher::MatchingResults::MatchInfo KeypointsMatcher::BuildBlobMatch(co
   // Quality score of the point-to-blob match
   // The aim is to prevent wrong matching pulling the pointcloud in a bad direction.
   double fitQualityCoeff = 1.0;
-  CeresTools::Residual res = this->BuildResidual(A, mean, basePoint, fitQualityCoeff);
-  return { MatchingResults::MatchStatus::SUCCESS, fitQualityCoeff, res };
+  return { A, mean, fitQualityCoeff, MatchingResults::MatchStatus::SUCCESS };
 }
 
 //-----------------------------------------------------------------------------
-void KeypointsMatcher::GetPerRingLineNeighbors(const KDTree& previousEdges, const double pos[3], unsigned int knearest,
+void KeypointsMatcher::GetPerRingLineNeighbors(const PointCloud& previousEdgesPoints, const Neighborhood& knn,
                                                std::vector<int>& validKnnIndices, std::vector<float>& validKnnSqDist) const
 {
-  // Get nearest neighbors of the query point
-  std::vector<int> knnIndices;
-  std::vector<float> knnSqDist;
-  unsigned int neighborhoodSize = previousEdges.KnnSearch(pos, knearest, knnIndices, knnSqDist);
+  // Nearest neighbors of the query point
+  const int* knnIndices = knn.Indices;
+  const float* knnSqDist = knn.SqDistances;
+  unsigned int neighborhoodSize = knn.Size;
 
   // If empty neighborhood, return
   if (neighborhoodSize == 0)
     return;
 
-  // Shortcut to keypoints cloud
-  const PointCloud& previousEdgesPoints = *previousEdges.GetInputCloud();
-
   // Take the closest point
   const Point& closest = previousEdgesPoints[knnIndices[0]];
   int closestLaserId = static_cast<int>(closest.laser_id);
@@ -377,7 +910,8 @@ void KeypointsMatcher::GetPerRingLineNeighbors(const KDTree& previousEdges, cons
   int nLasers = laserIdMax - laserIdMin + 1;
 
   // Invalid all points that are on the same scan line than the closest one
-  std::vector<uint8_t> idAlreadyTook(nLasers, 0);
+  std::vector<uint8_t>& idAlreadyTook = GetScratchBuffers().LaserIdTaken;
+  idAlreadyTook.assign(nLasers, 0);
   idAlreadyTook[closestLaserId - laserIdMin] = 1;
 
   // Invalid all points from scan lines that are too far from the closest one
@@ -405,77 +939,104 @@ void KeypointsMatcher::GetPerRingLineNeighbors(const KDTree& previousEdges, cons
 }
 
 //-----------------------------------------------------------------------------
-void KeypointsMatcher::GetRansacLineNeighbors(const KDTree& previousEdges, const double pos[3], unsigned int knearest, double maxDistInlier,
+void KeypointsMatcher::GetRansacLineNeighbors(const PointCloud& previousEdgesPoints, const Neighborhood& knn, double maxDistInlier,
                                               std::vector<int>& validKnnIndices, std::vector<float>& validKnnSqDist) const
 {
-  // Get nearest neighbors of the query point
-  std::vector<int> knnIndices;
-  std::vector<float> knnSqDist;
-  unsigned int neighborhoodSize = previousEdges.KnnSearch(pos, knearest, knnIndices, knnSqDist);
+  // Nearest neighbors of the query point
+  const int* knnIndices = knn.Indices;
+  const float* knnSqDist = knn.SqDistances;
+  const int neighborhoodSize = knn.Size;
 
   // If neighborhood contains less than 2 neighbors
   // no line can be fitted
   if (neighborhoodSize < 2)
     return;
 
-  // Shortcut to keypoints cloud
-  const PointCloud& previousEdgesPoints = *previousEdges.GetInputCloud();
-
   // To avoid square root when performing comparison
   const float squaredMaxDistInlier = maxDistInlier * maxDistInlier;
 
-  // Take the closest point
-  const Point& closest = previousEdgesPoints[knnIndices[0]];
-  const auto P1 = closest.getVector3fMap();
+  // Gather the neighbors positions relatively to the closest point, as
+  // structure of arrays to test them against a candidate line in SIMD lanes.
+  ScratchBuffers& scratch = GetScratchBuffers();
+  const int nbWords = (neighborhoodSize + 63) / 64;
+  scratch.RansacPoints.resize(3 * neighborhoodSize);
+  scratch.RansacInlierFlags.resize(nbWords * 64);
+  scratch.RansacInlierMasks.resize(2 * nbWords);
+  float* X = scratch.RansacPoints.data();
+  float* Y = X + neighborhoodSize;
+  float* Z = Y + neighborhoodSize;
+  uint8_t* inlierFlags = scratch.RansacInlierFlags.data();
+  uint64_t* inlierMask = scratch.RansacInlierMasks.data();
+  uint64_t* bestInlierMask = inlierMask + nbWords;
+  const auto P1 = previousEdgesPoints[knnIndices[0]].getVector3fMap();
+  for (int i = 0; i < neighborhoodSize; ++i)
+  {
+    const auto Pi = previousEdgesPoints[knnIndices[i]].getVector3fMap();
+    X[i] = Pi.x() - P1.x();
+    Y[i] = Pi.y() - P1.y();
+    Z[i] = Pi.z() - P1.z();
+  }
+  // The padding neighbors are never inliers
+  std::fill(inlierFlags + neighborhoodSize, inlierFlags + nbWords * 64, 0);
 
   // Loop over neighbors of the neighborhood. For each of them, compute the line
-  // between closest point and current point and compute the number of inliers
-  // that fit this line.
-  std::vector<std::vector<unsigned int>> inliersList;
-  inliersList.reserve(neighborhoodSize - 1);
-  for (unsigned int ptIndex = 1; ptIndex < neighborhoodSize; ++ptIndex)
+  // between closest point and current point and compute the set of inliers
+  // that fit this line, as a bitset. Only the best candidate is kept.
+  // NOTE: The closest point (bit 0) is not counted as an inlier, it is always kept.
+  unsigned int maxInliers = 0;
+  for (int ptIndex = 1; ptIndex < neighborhoodSize; ++ptIndex)
   {
     // Fit line that links P1 and P2
-    const auto P2 = previousEdgesPoints[knnIndices[ptIndex]].getVector3fMap();
-    Eigen::Vector3f dir = (P2 - P1).normalized();
+    // (as Eigen::normalized(), a null direction is left unchanged)
+    const float sqNorm = X[ptIndex] * X[ptIndex] + Y[ptIndex] * Y[ptIndex] + Z[ptIndex] * Z[ptIndex];
+    const float invNorm = sqNorm > 0.f ? 1.f / std::sqrt(sqNorm) : 1.f;
+    const float ux = X[ptIndex] * invNorm, uy = Y[ptIndex] * invNorm, uz = Z[ptIndex] * invNorm;
+
+    // Test the distance of all neighbors to this line at once
+    #pragma omp simd
+    for (int i = 0; i < neighborhoodSize; ++i)
+    {
+      const float cx = Y[i] * uz - Z[i] * uy;
+      const float cy = Z[i] * ux - X[i] * uz;
+      const float cz = X[i] * uy - Y[i] * ux;
+      inlierFlags[i] = (cx * cx + cy * cy + cz * cz) < squaredMaxDistInlier;
+    }
+    inlierFlags[0] = 0;
+    inlierFlags[ptIndex] = 1;
 
-    // Compute number of inliers of this model
-    std::vector<unsigned int> inlierIndex;
-    for (unsigned int candidateIndex = 1; candidateIndex < neighborhoodSize; ++candidateIndex)
+    // Pack the inliers flags to a bitset, and count them
+    unsigned int nbInliers = 0;
+    for (int w = 0; w < nbWords; ++w)
     {
-      if (candidateIndex == ptIndex)
-        inlierIndex.push_back(candidateIndex);
-      else
-      {
-        const auto Pcdt = previousEdgesPoints[knnIndices[candidateIndex]].getVector3fMap();
-        if (((Pcdt - P1).cross(dir)).squaredNorm() < squaredMaxDistInlier)
-          inlierIndex.push_back(candidateIndex);
-      }
+      uint64_t word = 0;
+      const uint8_t* wordFlags = inlierFlags + 64 * w;
+      for (int b = 0; b < 64; ++b)
+        word |= static_cast<uint64_t>(wordFlags[b]) << b;
+      inlierMask[w] = word;
+      nbInliers += std::bitset<64>(word).count();
     }
-    inliersList.push_back(inlierIndex);
-  }
 
-  // Keep the line and its inliers with the most inliers.
-  std::size_t maxInliers = 0;
-  int indexMaxInliers = -1;
-  for (unsigned int k = 0; k < inliersList.size(); ++k)
-  {
-    if (inliersList[k].size() > maxInliers)
+    // Keep the line with the most inliers
+    if (nbInliers > maxInliers)
     {
-      maxInliers = inliersList[k].size();
-      indexMaxInliers = k;
+      maxInliers = nbInliers;
+      std::copy(inlierMask, inlierMask + nbWords, bestInlierMask);
     }
   }
 
-  // fill vectors
-  validKnnIndices.clear(); validKnnIndices.reserve(inliersList[indexMaxInliers].size());
-  validKnnSqDist.clear(); validKnnSqDist.reserve(inliersList[indexMaxInliers].size());
+  // Fill vectors with the closest point and the inliers of the best line
+  // (keeping them sorted by increasing distance)
+  validKnnIndices.clear();
+  validKnnSqDist.clear();
   validKnnIndices.push_back(knnIndices[0]);
   validKnnSqDist.push_back(knnSqDist[0]);
-  for (unsigned int inlier: inliersList[indexMaxInliers])
+  for (int candidateIndex = 1; candidateIndex < neighborhoodSize; ++candidateIndex)
   {
-    validKnnIndices.push_back(knnIndices[inlier]);
-    validKnnSqDist.push_back(knnSqDist[inlier]);
+    if ((bestInlierMask[candidateIndex / 64] >> (candidateIndex % 64)) & 1)
+    {
+      validKnnIndices.push_back(knnIndices[candidateIndex]);
+      validKnnSqDist.push_back(knnSqDist[candidateIndex]);
+    }
   }
 }
 
@@ -22,6 +22,124 @@
 namespace LidarSlam
 {
 
+namespace
+{
+//----------------------------------------------------------------------------
+// Evaluate a residual block on a single pose parameters block, robustify it the
+// same way Ceres does (cf. ceres::Corrector), and add its contribution to the
+// cost and to the normal equations H = J^T J and g = J^T r, J being the jacobian
+// wrt the pose tangent space (using the pose increment jacobian, if any).
+bool AccumulateResidual(const ceres::CostFunction& cost, const ceres::LossFunction* loss,
+                        const double* pose, int poseSize, const Eigen::Matrix<double, 7, 6>* plusJacobian,
+                        std::vector<double>& residualsBuffer, std::vector<double>& jacobianBuffer,
+                        double& totalCost, Eigen::Matrix6d* H, Eigen::Vector6d* g)
+{
+  const int n = cost.num_residuals();
+  residualsBuffer.resize(n);
+  jacobianBuffer.resize(poseSize * n);
+  const double* parameters[1] = {pose};
+  double* jacobians[1] = {jacobianBuffer.data()};
+  if (!cost.Evaluate(parameters, residualsBuffer.data(), H ? jacobians : nullptr))
+    return false;
+
+  Eigen::Map<Eigen::VectorXd> r(residualsBuffer.data(), n);
+  Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> Jpose(jacobianBuffer.data(), n, poseSize);
+  Eigen::Matrix<double, Eigen::Dynamic, 6> J;
+  if (H)
+  {
+    if (plusJacobian)
+      J.noalias() = Jpose * plusJacobian->topRows(poseSize);
+    else
+      J = Jpose;
+  }
+  const double sqNorm = r.squaredNorm();
+  if (!loss)
+    totalCost += 0.5 * sqNorm;
+  else
+  {
+    double rho[3];
+    loss->Evaluate(sqNorm, rho);
+    totalCost += 0.5 * rho[0];
+    if (H)
+    {
+      // Second order correction of the robustified residual and jacobian
+      const double sqrtRho1 = std::sqrt(std::max(rho[1], 0.));
+      if (sqNorm > 0. && rho[1] > 0. && rho[2] > 0.)
+      {
+        const double alpha = 1. - std::sqrt(1. + 2. * sqNorm * rho[2] / rho[1]);
+        J = sqrtRho1 * (J - alpha / sqNorm * r * (r.transpose() * J));
+        r *= sqrtRho1 / (1. - alpha);
+      }
+      else
+      {
+        J *= sqrtRho1;
+        r *= sqrtRho1;
+      }
+    }
+  }
+
+  if (H)
+  {
+    H->noalias() += J.transpose() * J;
+    g->noalias() += J.transpose() * r;
+  }
+  return std::isfinite(totalCost);
+}
+
+//----------------------------------------------------------------------------
+// Indices of the planar DoF (X, Y, rZ) in the pose tangent space
+constexpr int PlanarIndices[3] = {0, 1, 5};
+
+// Index in the pose tangent space (X, Y, Z, rX, rY, rZ) of the i-th DoF of a
+// 3-DoF (planar) or 6-DoF state
+template<int DoF>
+inline int TangentIndex(int i)
+{
+  return DoF == 3 ? PlanarIndices[i] : i;
+}
+
+// Extract the DoF-sized block of a 6D tangent space vector or matrix
+template<int DoF>
+Eigen::Matrix<double, DoF, 1> FromTangent(const Eigen::Vector6d& v)
+{
+  Eigen::Matrix<double, DoF, 1> out;
+  for (int i = 0; i < DoF; ++i)
+    out(i) = v(TangentIndex<DoF>(i));
+  return out;
+}
+
+template<int DoF>
+Eigen::Matrix<double, DoF, DoF> FromTangent(const Eigen::Matrix6d& m)
+{
+  Eigen::Matrix<double, DoF, DoF> out;
+  for (int i = 0; i < DoF; ++i)
+    for (int j = 0; j < DoF; ++j)
+      out(i, j) = m(TangentIndex<DoF>(i), TangentIndex<DoF>(j));
+  return out;
+}
+
+// Scatter a DoF-sized vector or matrix in the 6D tangent space
+// (the held DoF are set to zero)
+template<int DoF>
+Eigen::Vector6d ToTangent(const Eigen::Matrix<double, DoF, 1>& v)
+{
+  Eigen::Vector6d out = Eigen::Vector6d::Zero();
+  for (int i = 0; i < DoF; ++i)
+    out(TangentIndex<DoF>(i)) = v(i);
+  return out;
+}
+
+template<int DoF>
+Eigen::Matrix6d ToTangent(const Eigen::Matrix<double, DoF, DoF>& m)
+{
+  Eigen::Matrix6d out = Eigen::Matrix6d::Zero();
+  for (int i = 0; i < DoF; ++i)
+    for (int j = 0; j < DoF; ++j)
+      out(TangentIndex<DoF>(i), TangentIndex<DoF>(j)) = m(i, j);
+  return out;
+}
+} // end of anonymous namespace
+
 //----------------------------------------------------------------------------
 // Set params
 //----------------------------------------------------------------------------
@@ -41,10 +159,31 @@ void LocalOptimizer::SetNbThreads(unsigned int nbThreads)
   this->NbThreads = nbThreads;
 }
 
+void LocalOptimizer::SetSolver(PoseSolver solver)
+{
+  this->Solver = solver;
+}
+
+void LocalOptimizer::SetPoseParameterization(PoseParameterization parameterization)
+{
+  this->Parameterization = parameterization;
+  this->LidarMatches->SetPoseParameterization(parameterization);
+}
+
 void LocalOptimizer::SetPosePrior(const Eigen::Isometry3d& posePrior)
 {
+  // Convert isometry to 7D state vector : X, Y, Z, qX, qY, qZ, qW
+  if (this->Parameterization == PoseParameterization::QUATERNION)
+  {
+    this->PoseArray.head<3>() = posePrior.translation();
+    this->PoseArray.tail<4>() = Eigen::Quaterniond(posePrior.linear()).coeffs();
+  }
   // Convert isometry to 6D state vector : X, Y, Z, rX, rY, rZ
-  this->PoseArray = Utils::IsometryToXYZRPY(posePrior);
+  else
+  {
+    this->PoseArray.head<6>() = Utils::IsometryToXYZRPY(posePrior);
+    this->PoseArray(6) = 0.;
+  }
 }
 
 //----------------------------------------------------------------------------
@@ -54,16 +193,34 @@ void LocalOptimizer::SetPosePrior(const Eigen::Isometry3d& posePrior)
 void LocalOptimizer::AddResidual(const CeresTools::Residual& res)
 {
   this->Residuals.push_back(res);
+  this->ProblemUpToDate = false;
+  this->NormalMatrixValid = false;
 }
 
 void LocalOptimizer::AddResiduals(const std::vector<CeresTools::Residual>& residuals)
 {
   this->Residuals.insert(this->Residuals.end(), residuals.begin(), residuals.end());
+  this->ProblemUpToDate = false;
+  this->NormalMatrixValid = false;
+}
+
+void LocalOptimizer::AddLidarMatches(const std::vector<CeresTools::PointToModelMatch>& matches)
+{
+  for (const CeresTools::PointToModelMatch& match : matches)
+  {
+    if (match.Weight > 0.)
+      this->LidarMatches->Add(match);
+  }
+  this->ProblemUpToDate = false;
+  this->NormalMatrixValid = false;
 }
 
 void LocalOptimizer::Clear()
 {
   this->Residuals.clear();
+  this->LidarMatches->Clear();
+  this->ProblemUpToDate = false;
+  this->NormalMatrixValid = false;
 }
 
 //----------------------------------------------------------------------------
@@ -73,21 +230,18 @@ void LocalOptimizer::Clear()
 //----------------------------------------------------------------------------
 ceres::Solver::Summary LocalOptimizer::Solve()
 {
-  ceres::Problem::Options  option;
-  option.loss_function_ownership = ceres::Ownership::DO_NOT_TAKE_OWNERSHIP;
-  option.cost_function_ownership = ceres::Ownership::DO_NOT_TAKE_OWNERSHIP;
-
-  // Clear problem and add residuals to optimize
-  this->Problem = std::make_unique<ceres::Problem>(option);
-  for (const CeresTools::Residual& res : this->Residuals)
+  // Try the dedicated solver first, if enabled
+  ceres::Solver::Summary summary;
+  if (this->Solver == PoseSolver::DENSE_LM)
   {
-    if (res.Cost)
-      this->Problem->AddResidualBlock(res.Cost.get(), res.Robustifier.get(), this->PoseArray.data());
+    // In 2D mode, the planar problem is solved on (X, Y, rZ) only
+    bool solved = this->TwoDMode ? this->SolveDenseLM<3>(summary) : this->SolveDenseLM<6>(summary);
+    if (solved)
+      return summary;
+    PRINT_WARNING("Dedicated LM solver failed (" << summary.message << "), falling back to Ceres.");
   }
 
-  // If 2D mode is enabled, hold Z, rX and rY constant
-  if (this->TwoDMode)
-    this->Problem->SetParameterization(this->PoseArray.data(), new ceres::SubsetParameterization(6, {2, 3, 4}));
+  this->UpdateProblem();
 
   // LM solver options
   ceres::Solver::Options options;
@@ -96,16 +250,352 @@ ceres::Solver::Summary LocalOptimizer::Solve()
   options.num_threads = this->NbThreads;
 
   // Run optimization
-  ceres::Solver::Summary summary;
+  summary = ceres::Solver::Summary();
   ceres::Solve(options, this->Problem.get(), &summary);
+  this->NormalMatrixValid = false;
   return summary;
 }
 
+//----------------------------------------------------------------------------
+void LocalOptimizer::UpdateProblem()
+{
+  // Create the problem if needed.
+  // The parameterization of the pose can not be changed afterwards.
+  if (!this->Problem || this->ProblemTwoDMode != this->TwoDMode || this->ProblemParameterization != this->Parameterization)
+  {
+    ceres::Problem::Options  option;
+    option.loss_function_ownership = ceres::Ownership::DO_NOT_TAKE_OWNERSHIP;
+    option.cost_function_ownership = ceres::Ownership::DO_NOT_TAKE_OWNERSHIP;
+    // Allow to update the residuals efficiently
+    option.enable_fast_removal = true;
+    this->Problem = std::make_unique<ceres::Problem>(option);
+    this->ResidualBlocks.clear();
+    this->DuplicatedResidualBlocks.clear();
+    this->LidarMatchesBlock = nullptr;
+
+    // Quaternion is updated in its tangent space.
+    // If 2D mode is enabled, hold Z, rX and rY constant.
+    if (this->Parameterization == PoseParameterization::QUATERNION)
+      this->Problem->AddParameterBlock(this->PoseArray.data(), 7, new CeresTools::PoseQuaternionParameterization(this->TwoDMode));
+    else
+    {
+      this->Problem->AddParameterBlock(this->PoseArray.data(), 6);
+      if (this->TwoDMode)
+        this->Problem->SetParameterization(this->PoseArray.data(), new ceres::SubsetParameterization(6, {2, 3, 4}));
+    }
+    this->ProblemTwoDMode = this->TwoDMode;
+    this->ProblemParameterization = this->Parameterization;
+  }
+
+  // Update the problem with the residuals to optimize :
+  // the residual blocks already added (with the same robustifier) are kept,
+  // the other ones are removed, and the new ones are added.
+  for (const ResidualBlock& block : this->DuplicatedResidualBlocks)
+    this->Problem->RemoveResidualBlock(block.Id);
+  this->DuplicatedResidualBlocks.clear();
+  // The batched residual block size may have changed : always add it back
+  if (this->LidarMatchesBlock)
+    this->Problem->RemoveResidualBlock(this->LidarMatchesBlock);
+  this->LidarMatchesBlock = nullptr;
+  if (this->LidarMatches->Size())
+  {
+    this->LidarMatches->SetNbThreads(this->NbThreads);
+    this->LidarMatchesBlock = this->Problem->AddResidualBlock(this->LidarMatches.get(), nullptr, this->PoseArray.data());
+  }
+  for (auto& costBlock : this->ResidualBlocks)
+    costBlock.second.Used = false;
+  for (const CeresTools::Residual& res : this->Residuals)
+  {
+    if (!res.Cost)
+      continue;
+    auto it = this->ResidualBlocks.find(res.Cost.get());
+    if (it != this->ResidualBlocks.end())
+    {
+      ResidualBlock& block = it->second;
+      if (block.Used)
+      {
+        ceres::ResidualBlockId id = this->Problem->AddResidualBlock(res.Cost.get(), res.Robustifier.get(), this->PoseArray.data());
+        this->DuplicatedResidualBlocks.push_back({id, res, true});
+        continue;
+      }
+      if (block.Res.Robustifier != res.Robustifier)
+      {
+        this->Problem->RemoveResidualBlock(block.Id);
+        block.Id = this->Problem->AddResidualBlock(res.Cost.get(), res.Robustifier.get(), this->PoseArray.data());
+        block.Res = res;
+      }
+      block.Used = true;
+    }
+    else
+    {
+      ceres::ResidualBlockId id = this->Problem->AddResidualBlock(res.Cost.get(), res.Robustifier.get(), this->PoseArray.data());
+      this->ResidualBlocks.emplace(res.Cost.get(), ResidualBlock{id, res, true});
+    }
+  }
+  for (auto it = this->ResidualBlocks.begin(); it != this->ResidualBlocks.end();)
+  {
+    if (it->second.Used)
+      ++it;
+    else
+    {
+      this->Problem->RemoveResidualBlock(it->second.Id);
+      it = this->ResidualBlocks.erase(it);
+    }
+  }
+  this->ProblemUpToDate = true;
+}
+
+//----------------------------------------------------------------------------
+bool LocalOptimizer::IsPoseOnlyProblem() const
+{
+  const int poseSize = CeresTools::PoseParametersSize(this->Parameterization);
+  for (const CeresTools::Residual& res : this->Residuals)
+  {
+    if (res.Cost && (res.Cost->parameter_block_sizes().size() != 1 || res.Cost->parameter_block_sizes()[0] != poseSize))
+      return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+LocalOptimizer::PoseVector LocalOptimizer::PosePlus(const PoseVector& pose, const Eigen::Vector6d& delta) const
+{
+  PoseVector newPose = pose;
+  if (this->Parameterization == PoseParameterization::QUATERNION)
+    CeresTools::PoseQuaternionParameterization().Plus(pose.data(), delta.data(), newPose.data());
+  else
+    newPose.head<6>() += delta;
+  return newPose;
+}
+
+//----------------------------------------------------------------------------
+Eigen::Matrix<double, 7, 6> LocalOptimizer::PosePlusJacobian(const PoseVector& pose) const
+{
+  Eigen::Matrix<double, 7, 6, Eigen::RowMajor> jacobian = Eigen::Matrix<double, 7, 6, Eigen::RowMajor>::Identity();
+  if (this->Parameterization == PoseParameterization::QUATERNION)
+    CeresTools::PoseQuaternionParameterization().ComputeJacobian(pose.data(), jacobian.data());
+  return jacobian;
+}
+
+//----------------------------------------------------------------------------
+template<int DoF>
+bool LocalOptimizer::SolveDenseLM(ceres::Solver::Summary& summary)
+{
+  using MatrixD = Eigen::Matrix<double, DoF, DoF>;
+  using VectorD = Eigen::Matrix<double, DoF, 1>;
+
+  // The dedicated solver only handles residuals of the pose
+  if (!this->IsPoseOnlyProblem())
+  {
+    summary.message = "Unsupported residual parameters";
+    return false;
+  }
+
+  // Linearize the problem at the initial pose.
+  // The normal equations are expressed in the pose tangent space.
+  PoseVector pose = this->PoseArray;
+  MatrixD H;
+  VectorD g;
+  double cost;
+  if (!this->EvaluateNormalEquations<DoF>(pose, cost, &H, &g))
+  {
+    summary.message = "Residual evaluation failed";
+    return false;
+  }
+  summary.initial_cost = cost;
+  // As with Ceres, the initial evaluation is counted as a successful step
+  summary.num_successful_steps = 1;
+  summary.num_unsuccessful_steps = 0;
+  summary.termination_type = ceres::NO_CONVERGENCE;
+
+  // Levenberg-Marquardt loop, with the same trust region strategy and
+  // default tolerances as Ceres
+  double radius = 1e4;
+  double decreaseFactor = 2.;
+  for (unsigned int iter = 0; iter < this->LMMaxIter; ++iter)
+  {
+    if (g.template lpNorm<Eigen::Infinity>() <= 1e-10)
+    {
+      summary.termination_type = ceres::CONVERGENCE;
+      break;
+    }
+
+    // Solve the damped normal equations (H + D / radius) step = -g,
+    // with D the diagonal of H
+    MatrixD damped = H;
+    for (int i = 0; i < DoF; ++i)
+      damped(i, i) += std::min(std::max(H(i, i), 1e-6), 1e32) / radius;
+    VectorD step = damped.ldlt().solve(-g);
+    if (!step.allFinite())
+    {
+      summary.message = "Invalid step";
+      return false;
+    }
+    if (step.norm() <= 1e-8 * (pose.norm() + 1e-8))
+    {
+      summary.termination_type = ceres::CONVERGENCE;
+      break;
+    }
+
+    // Evaluate the step quality, relatively to the linear model
+    const double modelDecrease = -(step.dot(g) + 0.5 * step.dot(H * step));
+    PoseVector newPose = this->PosePlus(pose, ToTangent(step));
+    double newCost;
+    bool valid = this->EvaluateNormalEquations<DoF>(newPose, newCost);
+    const double ratio = (cost - newCost) / modelDecrease;
+    if (valid && modelDecrease > 0. && ratio > 1e-3)
+    {
+      // Accept the step, and expand the trust region
+      ++summary.num_successful_steps;
+      const double decrease = cost - newCost;
+      pose = newPose;
+      if (!this->EvaluateNormalEquations<DoF>(pose, cost, &H, &g))
+      {
+        summary.message = "Residual evaluation failed";
+        return false;
+      }
+      radius = std::min(radius / std::max(1. / 3., 1. - std::pow(2. * ratio - 1., 3)), 1e16);
+      decreaseFactor = 2.;
+      if (decrease <= 1e-6 * (cost + decrease))
+      {
+        summary.termination_type = ceres::CONVERGENCE;
+        break;
+      }
+    }
+    else
+    {
+      // Reject the step, and shrink the trust region
+      ++summary.num_unsuccessful_steps;
+      radius /= decreaseFactor;
+      decreaseFactor *= 2.;
+      if (radius < 1e-32)
+      {
+        summary.termination_type = ceres::CONVERGENCE;
+        break;
+      }
+    }
+  }
+
+  this->PoseArray = pose;
+  // Keep the final normal equations for the covariance estimation
+  this->NormalMatrix = ToTangent(H);
+  this->NormalMatrixValid = true;
+  summary.final_cost = cost;
+  summary.message = DoF == 3 ? "Dedicated planar LM solver" : "Dedicated LM solver";
+  return true;
+}
+
+//----------------------------------------------------------------------------
+template<int DoF>
+bool LocalOptimizer::EvaluateNormalEquations(const PoseVector& pose, double& cost,
+                                             Eigen::Matrix<double, DoF, DoF>* H, Eigen::Matrix<double, DoF, 1>* g) const
+{
+  cost = 0.;
+  if (H)
+  {
+    H->setZero();
+    g->setZero();
+  }
+
+  // Jacobian of the pose increment, to express the normal equations in the
+  // tangent space of the pose (not needed with Euler angles)
+  const int poseSize = CeresTools::PoseParametersSize(this->Parameterization);
+  Eigen::Matrix<double, 7, 6> plusJacobianStorage;
+  const Eigen::Matrix<double, 7, 6>* plusJacobian = nullptr;
+  if (this->Parameterization == PoseParameterization::QUATERNION)
+  {
+    plusJacobianStorage = this->PosePlusJacobian(pose);
+    plusJacobian = &plusJacobianStorage;
+  }
+
+  // The batched LiDAR matches are evaluated with their own parallelization.
+  // In the planar case, their normal equations are directly computed wrt (X, Y, rZ).
+  std::vector<double> residualsBuffer, jacobianBuffer;
+  if (this->LidarMatches->Size() && DoF == 3)
+  {
+    const Eigen::Isometry3d transform = this->ToIsometry(pose);
+    Eigen::Matrix3d planarH;
+    Eigen::Vector3d planarG;
+    this->LidarMatches->SetNbThreads(this->NbThreads);
+    cost += this->LidarMatches->EvaluatePlanar(transform.linear(), transform.translation(),
+                                               H ? &planarH : nullptr, &planarG);
+    if (!std::isfinite(cost))
+      return false;
+    if (H)
+    {
+      H->template topLeftCorner<3, 3>() += planarH;
+      g->template head<3>() += planarG;
+    }
+  }
+  else if (this->LidarMatches->Size())
+  {
+    Eigen::Matrix6d lidarH;
+    Eigen::Vector6d lidarG = Eigen::Vector6d::Zero();
+    if (H)
+      lidarH.setZero();
+    this->LidarMatches->SetNbThreads(this->NbThreads);
+    if (!AccumulateResidual(*this->LidarMatches, nullptr, pose.data(), poseSize, plusJacobian,
+                            residualsBuffer, jacobianBuffer, cost, H ? &lidarH : nullptr, &lidarG))
+      return false;
+    if (H)
+    {
+      *H += FromTangent<DoF>(lidarH);
+      *g += FromTangent<DoF>(lidarG);
+    }
+  }
+
+  // The other residuals are evaluated in parallel, in the 6D tangent space
+  bool valid = true;
+  const int nbResiduals = this->Residuals.size();
+  if (!nbResiduals)
+    return valid;
+  #pragma omp parallel num_threads(this->NbThreads) firstprivate(residualsBuffer, jacobianBuffer)
+  {
+    double threadCost = 0.;
+    Eigen::Matrix6d threadH = Eigen::Matrix6d::Zero();
+    Eigen::Vector6d threadG = Eigen::Vector6d::Zero();
+    bool threadValid = true;
+    #pragma omp for schedule(static)
+    for (int i = 0; i < nbResiduals; ++i)
+    {
+      const CeresTools::Residual& res = this->Residuals[i];
+      if (res.Cost && threadValid)
+        threadValid = AccumulateResidual(*res.Cost, res.Robustifier.get(), pose.data(), poseSize, plusJacobian,
+                                         residualsBuffer, jacobianBuffer, threadCost, H ? &threadH : nullptr, &threadG);
+    }
+    #pragma omp critical
+    {
+      cost += threadCost;
+      valid = valid && threadValid;
+      if (H)
+      {
+        *H += FromTangent<DoF>(threadH);
+        *g += FromTangent<DoF>(threadG);
+      }
+    }
+  }
+  return valid;
+}
+
 //----------------------------------------------------------------------------
 Eigen::Isometry3d LocalOptimizer::GetOptimizedPose() const
 {
+  return this->ToIsometry(this->PoseArray);
+}
+
+//----------------------------------------------------------------------------
+Eigen::Isometry3d LocalOptimizer::ToIsometry(const PoseVector& pose) const
+{
+  // Convert 7D state vector (X, Y, Z, qX, qY, qZ, qW) to isometry
+  if (this->Parameterization == PoseParameterization::QUATERNION)
+  {
+    Eigen::Isometry3d isometry = Eigen::Isometry3d::Identity();
+    isometry.linear() = Eigen::Quaterniond(pose.tail<4>()).normalized().toRotationMatrix();
+    isometry.translation() = pose.head<3>();
+    return isometry;
+  }
   // Convert 6D state vector (X, Y, Z, rX, rY, rZ) to isometry
-  return Utils::XYZRPYtoIsometry(this->PoseArray);
+  return Utils::XYZRPYtoIsometry(pose);
 }
 
 //----------------------------------------------------------------------------
@@ -113,6 +603,94 @@ LocalOptimizer::RegistrationError LocalOptimizer::EstimateRegistrationError()
 {
   RegistrationError err;
 
+  // Get the normal equations J^T J at the optimized pose, either from the
+  // dedicated solver or by evaluating the residuals jacobians.
+  // The loss functions are applied as in Ceres covariance estimation.
+  bool fastCovariance = this->NormalMatrixValid;
+  if (!fastCovariance && this->IsPoseOnlyProblem())
+  {
+    double cost;
+    if (this->TwoDMode)
+    {
+      Eigen::Matrix3d H;
+      Eigen::Vector3d g;
+      fastCovariance = this->EvaluateNormalEquations<3>(this->PoseArray, cost, &H, &g);
+      this->NormalMatrix = ToTangent(H);
+    }
+    else
+    {
+      Eigen::Vector6d g;
+      fastCovariance = this->EvaluateNormalEquations<6>(this->PoseArray, cost, &this->NormalMatrix, &g);
+    }
+    this->NormalMatrixValid = fastCovariance;
+  }
+
+  // Invert the normal equations on the free parameters, if well conditioned.
+  // The held parameters (in 2D mode) have a null covariance.
+  if (fastCovariance)
+  {
+    std::vector<int> freeParameters = {0, 1, 2, 3, 4, 5};
+    if (this->TwoDMode)
+      freeParameters = {0, 1, 5};
+    const int n = freeParameters.size();
+    Eigen::MatrixXd H(n, n);
+    for (int i = 0; i < n; ++i)
+      for (int j = 0; j < n; ++j)
+        H(i, j) = this->NormalMatrix(freeParameters[i], freeParameters[j]);
+    Eigen::LLT<Eigen::MatrixXd> llt(H);
+    fastCovariance = llt.info() == Eigen::Success && llt.rcond() > 1e-10;
+    if (fastCovariance)
+    {
+      Eigen::MatrixXd covariance = llt.solve(Eigen::MatrixXd::Identity(n, n));
+      for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+          err.Covariance(freeParameters[i], freeParameters[j]) = covariance(i, j);
+    }
+  }
+
+  // Fall back to Ceres SVD estimation if the problem is ill-conditioned
+  if (!fastCovariance)
+    this->EstimateCovarianceSVD(err.Covariance);
+
+  // With quaternion, the covariance is estimated in the pose tangent space :
+  // convert its rotation part to Euler angles (cf. RegistrationError).
+  // The rotation increment w in world frame is related to the Euler angles
+  // increments by w = E d(rX, rY, rZ), E being singular for a pitch of +/-90°.
+  if (this->Parameterization == PoseParameterization::QUATERNION)
+  {
+    Eigen::Vector6d xyzrpy = Utils::IsometryToXYZRPY(this->GetOptimizedPose());
+    const double cy = std::cos(xyzrpy(4)), sy = std::sin(xyzrpy(4));
+    const double cz = std::cos(xyzrpy(5)), sz = std::sin(xyzrpy(5));
+    if (std::abs(cy) > 1e-6)
+    {
+      Eigen::Matrix3d E;
+      E << cy * cz, -sz, 0.,
+           cy * sz,  cz, 0.,
+               -sy,  0., 1.;
+      Eigen::Matrix6d G = Eigen::Matrix6d::Identity();
+      G.bottomRightCorner<3, 3>() = E.inverse();
+      err.Covariance = G * err.Covariance * G.transpose();
+    }
+  }
+
+  // Estimate max position/orientation errors and directions from covariance
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigPosition(err.Covariance.topLeftCorner<3, 3>());
+  err.PositionError = std::sqrt(eigPosition.eigenvalues()(2));
+  err.PositionErrorDirection = eigPosition.eigenvectors().col(2);
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigOrientation(err.Covariance.bottomRightCorner<3, 3>());
+  err.OrientationError = Utils::Rad2Deg(std::sqrt(eigOrientation.eigenvalues()(2)));
+  err.OrientationErrorDirection = eigOrientation.eigenvectors().col(2);
+
+  return err;
+}
+
+//----------------------------------------------------------------------------
+void LocalOptimizer::EstimateCovarianceSVD(Eigen::Matrix6d& covariance)
+{
+  // The problem may not be up to date if the dedicated solver was used
+  if (!this->ProblemUpToDate)
+    this->UpdateProblem();
+
   // Covariance computation options
   ceres::Covariance::Options covOptions;
   covOptions.apply_loss_function = true;
@@ -126,17 +704,24 @@ LocalOptimizer::RegistrationError LocalOptimizer::EstimateRegistrationError()
   const double* paramBlock = this->PoseArray.data();
   covarianceBlocks.emplace_back(paramBlock, paramBlock);
   covarianceSolver.Compute(covarianceBlocks, &(*this->Problem));
-  covarianceSolver.GetCovarianceBlock(paramBlock, paramBlock, err.Covariance.data());
-
-  // Estimate max position/orientation errors and directions from covariance
-  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigPosition(err.Covariance.topLeftCorner<3, 3>());
-  err.PositionError = std::sqrt(eigPosition.eigenvalues()(2));
-  err.PositionErrorDirection = eigPosition.eigenvectors().col(2);
-  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigOrientation(err.Covariance.bottomRightCorner<3, 3>());
-  err.OrientationError = Utils::Rad2Deg(std::sqrt(eigOrientation.eigenvalues()(2)));
-  err.OrientationErrorDirection = eigOrientation.eigenvectors().col(2);
+  if (this->Parameterization != PoseParameterization::QUATERNION)
+  {
+    covarianceSolver.GetCovarianceBlock(paramBlock, paramBlock, covariance.data());
+    return;
+  }
 
-  return err;
+  // With quaternion, get the covariance in the pose tangent space
+  // (X, Y, rZ only in 2D mode, the other parameters having a null covariance)
+  std::vector<int> freeParameters = {0, 1, 2, 3, 4, 5};
+  if (this->TwoDMode)
+    freeParameters = {0, 1, 5};
+  const int n = freeParameters.size();
+  Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> tangentCovariance(n, n);
+  covarianceSolver.GetCovarianceBlockInTangentSpace(paramBlock, paramBlock, tangentCovariance.data());
+  covariance.setZero();
+  for (int i = 0; i < n; ++i)
+    for (int j = 0; j < n; ++j)
+      covariance(freeParameters[i], freeParameters[j]) = tangentCovariance(i, j);
 }
 
 } // end of LidarSlam namespace
\ No newline at end of file
@@ -0,0 +1,156 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-16
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+#include "LidarSlam/PriorMap.h"
+#include "LidarSlam/Utilities.h"
+
+#include <pcl/io/pcd_io.h>
+
+#include <algorithm>
+#include <numeric>
+
+namespace LidarSlam
+{
+
+namespace
+{
+//------------------------------------------------------------------------------
+bool LexicographicLess(const Eigen::Array3i& a, const Eigen::Array3i& b)
+{
+  return std::lexicographical_compare(a.data(), a.data() + 3, b.data(), b.data() + 3);
+}
+} // end of anonymous namespace
+
+//------------------------------------------------------------------------------
+PriorMap::PriorMap(PointCloud::Ptr cloud, double tileResolution, const std::string& indexCacheFile)
+  : TileResolution(tileResolution)
+{
+  // Compute the tile of each point
+  const unsigned int nbPoints = cloud->size();
+  std::vector<Eigen::Array3i> coords(nbPoints);
+  for (unsigned int i = 0; i < nbPoints; ++i)
+    coords[i] = (cloud->points[i].getArray3fMap() / this->TileResolution).floor().cast<int>();
+
+  // Sort the points by tile so that each tile is a contiguous range
+  std::vector<unsigned int> order(nbPoints);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+  {
+    return LexicographicLess(coords[a], coords[b]);
+  });
+
+  // Fill the sorted cloud and the tiles ranges
+  this->Cloud.reset(new PointCloud);
+  this->Cloud->header = cloud->header;
+  this->Cloud->reserve(nbPoints);
+  for (unsigned int i = 0; i < nbPoints; ++i)
+  {
+    const Eigen::Array3i& tileCoords = coords[order[i]];
+    if (this->Tiles.empty() || (this->Tiles.back().Coords != tileCoords).any())
+      this->Tiles.push_back({tileCoords, i, i});
+    this->Cloud->push_back(cloud->points[order[i]]);
+    this->Tiles.back().End = i + 1;
+  }
+
+  // Build the KD-tree once for all, or reload it from cache.
+  // As the points order is deterministic, the cached index stays valid as long
+  // as the map is unchanged (which is checked when loading it).
+  if (indexCacheFile.empty())
+  {
+    this->KdTree = std::make_shared<KDTree>(this->Cloud);
+    return;
+  }
+  auto kdTree = std::make_shared<KDTree>();
+  if (kdTree->LoadIndex(this->Cloud, indexCacheFile))
+    std::cout << "KD-tree index successfully loaded from " << indexCacheFile << std::endl;
+  else if (kdTree->SaveIndex(indexCacheFile))
+    std::cout << "KD-tree index cached to " << indexCacheFile << std::endl;
+  else
+    PRINT_WARNING("Unable to cache KD-tree index to " << indexCacheFile);
+  this->KdTree = kdTree;
+}
+
+//------------------------------------------------------------------------------
+size_t PriorMap::GetMemorySize() const
+{
+  return sizeof(PointCloud) + this->Cloud->size() * sizeof(Point)
+       + this->Tiles.size() * sizeof(Tile)
+       + this->KdTree->GetMemorySize();
+}
+
+//------------------------------------------------------------------------------
+void PriorMap::ExtractPoints(const Eigen::Array3f& minPoint, const Eigen::Array3f& maxPoint, PointCloud& output) const
+{
+  Eigen::Array3i minTile = (minPoint / this->TileResolution).floor().cast<int>();
+  Eigen::Array3i maxTile = (maxPoint / this->TileResolution).floor().cast<int>();
+  auto addTile = [&](const Tile& tile)
+  {
+    output.insert(output.end(), this->Cloud->begin() + tile.Begin, this->Cloud->begin() + tile.End);
+  };
+
+  // If the box covers more (X, Y) columns than there are tiles, scan all tiles
+  Eigen::Array3i nbTiles = maxTile - minTile + 1;
+  if ((nbTiles <= 0).any())
+    return;
+  if (static_cast<double>(nbTiles.x()) * nbTiles.y() > this->Tiles.size())
+  {
+    for (const Tile& tile : this->Tiles)
+    {
+      if (((minTile <= tile.Coords) && (tile.Coords <= maxTile)).all())
+        addTile(tile);
+    }
+    return;
+  }
+
+  // As the tiles are sorted by (X, Y, Z), the tiles of each (X, Y) column
+  // are contiguous : find the first one by binary search
+  auto tileLess = [](const Tile& tile, const Eigen::Array3i& coords) { return LexicographicLess(tile.Coords, coords); };
+  for (int x = minTile.x(); x <= maxTile.x(); ++x)
+  {
+    for (int y = minTile.y(); y <= maxTile.y(); ++y)
+    {
+      auto it = std::lower_bound(this->Tiles.begin(), this->Tiles.end(), Eigen::Array3i(x, y, minTile.z()), tileLess);
+      for (; it != this->Tiles.end() && it->Coords.x() == x && it->Coords.y() == y && it->Coords.z() <= maxTile.z(); ++it)
+        addTile(*it);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+std::map<Keypoint, std::shared_ptr<const PriorMap>> LoadPriorMapsFromPCD(const std::string& filePrefix, double tileResolution,
+                                                                         bool cacheIndices)
+{
+  std::map<Keypoint, std::shared_ptr<const PriorMap>> priorMaps;
+  for (auto k : KeypointTypes)
+  {
+    std::string path = filePrefix + Utils::Plural(KeypointTypeNames.at(k)) + ".pcd";
+    PriorMap::PointCloud::Ptr keypoints(new PriorMap::PointCloud);
+    if (pcl::io::loadPCDFile(path, *keypoints) == 0)
+    {
+      std::cout << "SLAM prior keypoints map successfully loaded from " << path << std::endl;
+      // Prior map points are fixed
+      for (auto& point : *keypoints)
+        point.label = 1;
+      std::string indexPath = cacheIndices ? filePrefix + Utils::Plural(KeypointTypeNames.at(k)) + ".kdtree" : "";
+      priorMaps[k] = std::make_shared<PriorMap>(keypoints, tileResolution, indexPath);
+    }
+  }
+  return priorMaps;
+}
+
+} // end of LidarSlam namespace
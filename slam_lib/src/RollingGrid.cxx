@@ -22,6 +22,9 @@
 
 #include <pcl/common/common.h>
 
+#include <algorithm>
+#include <functional>
+
 namespace LidarSlam
 {
 
@@ -52,7 +55,9 @@ void RollingGrid::Clear()
 {
   this->NbPoints = 0;
   this->Voxels.clear();
-  this->KdTree.Reset();
+  this->VoxelsStatistics.clear();
+  this->ClearKdTree();
+  this->BuildVoxelSearch();
 }
 
 //------------------------------------------------------------------------------
@@ -87,6 +92,44 @@ void RollingGrid::SetVoxelResolution(double resolution)
     this->Add(prevMap);
 }
 
+//------------------------------------------------------------------------------
+void RollingGrid::SetLeafSize(double leafSize)
+{
+  this->LeafSize = leafSize;
+  // The hashed voxels size depends on the leaf size
+  if (this->VoxelSearch)
+  {
+    this->ClearKdTree();
+    this->BuildVoxelSearch();
+  }
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::SetSearchBackend(NeighborSearchBackend backend)
+{
+  if (backend == this->SearchBackend)
+    return;
+  this->SearchBackend = backend;
+  this->ClearKdTree();
+  this->BuildVoxelSearch();
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::SetPriorMap(const std::shared_ptr<const PriorMap>& prior)
+{
+  this->Prior = prior;
+  this->ClearKdTree();
+  this->BuildVoxelSearch();
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::SetKeepVoxelStatistics(bool keep)
+{
+  this->KeepVoxelStatistics = keep;
+  if (!keep)
+    this->VoxelsStatistics.clear();
+}
+
 //==============================================================================
 //   Main use
 //==============================================================================
@@ -148,16 +191,29 @@ void RollingGrid::Roll(const Eigen::Array3f& minPoint, const Eigen::Array3f& max
       newNbPoints += kvOut.second.size();
       newVoxels[newIdx1d] = std::move(kvOut.second);
     }
+    // Remove the dropped points from the hashed voxels
+    else if (this->VoxelSearch)
+      this->RemoveFromVoxelSearch(kvOut.second);
+  }
+
+  // Move the voxels statistics the same way
+  StatisticsVG newStatistics;
+  for (auto& kvOut : this->VoxelsStatistics)
+  {
+    Eigen::Array3i newIdx3d = this->To3d(kvOut.first) - voxelsOffset;
+    if (((0 <= newIdx3d) && (newIdx3d < this->GridSize)).all())
+      newStatistics[this->To1d(newIdx3d)] = std::move(kvOut.second);
   }
 
   // Update the voxel grid
   this->NbPoints = newNbPoints;
   this->Voxels.swap(newVoxels);
+  this->VoxelsStatistics.swap(newStatistics);
   this->VoxelGridPosition += voxelsOffset.cast<float>() * this->VoxelResolution;
 }
 
 //------------------------------------------------------------------------------
-void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double currentTime, bool roll)
+void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double currentTime, bool roll, int anchor)
 {
   if (pointcloud->empty())
   {
@@ -205,6 +261,9 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
           !this->Voxels[idxOut].count(idxIn))
       {
         this->Voxels[idxOut][idxIn].point = point;
+        this->Voxels[idxOut][idxIn].anchor = anchor;
+        if (this->KeepVoxelStatistics)
+          this->AddToStatistics(idxOut, idxIn, anchor, point.getVector3fMap());
         ++this->NbPoints;
         // Notify that the voxel point has been updated
         updated = true;
@@ -214,6 +273,10 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
         // Shortcut to voxel
         auto& voxel = this->Voxels[idxOut][idxIn];
 
+        // Update the statistics of all points added to the voxel
+        if (this->KeepVoxelStatistics)
+          this->AddToStatistics(idxOut, idxIn, anchor, point.getVector3fMap());
+
         // Check if the voxel contains a fixed point
         if (voxel.point.label == 1)
           continue;
@@ -233,6 +296,7 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
           {
             // Update the point
             voxel.point = point;
+            voxel.anchor = anchor;
             // Notify that the voxel point has been updated
             updated = true;
             break;
@@ -244,6 +308,7 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
             if (point.intensity > voxel.point.intensity)
             {
               voxel.point = point;
+              voxel.anchor = anchor;
               // Notify that the voxel point has been updated
               updated = true;
             }
@@ -258,6 +323,7 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
             if ((point.getVector3fMap()- voxelCenter).norm() < (voxel.point.getVector3fMap() - voxelCenter).norm())
             {
               voxel.point = point;
+              voxel.anchor = anchor;
               // Notify that the voxel point has been updated
               updated = true;
             }
@@ -292,6 +358,7 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
             auto& voxel = this->Voxels[idxOut][idxIn];
             // Update the voxel point computing the centroid of all mean points laying in it
             voxel.point.getVector3fMap() = (voxel.point.getVector3fMap() * voxel.count + vIn.second.point.getVector3fMap()) / (voxel.count + 1);
+            voxel.anchor = anchor;
           }
         }
       }
@@ -312,9 +379,319 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
     }
   }
 
+  // Insert the new points in the hashed voxels, and move the modified ones
+  if (this->VoxelSearch)
+  {
+    for (const auto& kvOut : seen)
+    {
+      SamplingVG& voxelsIn = this->Voxels[kvOut.first];
+      for (const auto& kvIn : kvOut.second)
+      {
+        Voxel& voxel = voxelsIn[kvIn.first];
+        if (voxel.searchIndex < 0)
+          voxel.searchIndex = this->VoxelSearch->Insert(voxel.point);
+        else
+          this->VoxelSearch->Update(voxel.searchIndex, voxel.point);
+      }
+    }
+  }
+
   // Clear the deprecated KD-tree if the map has been updated
   if (updated)
-    this->KdTree.Reset();
+    this->ClearKdTree();
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::RemoveAnchoredPoints(const std::unordered_set<int>& anchors)
+{
+  if (anchors.empty())
+    return;
+
+  bool updated = false;
+  // Loop on the outer voxels (rolling vg)
+  auto itVoxelsOut = this->Voxels.begin();
+  while(itVoxelsOut != this->Voxels.end())
+  {
+    // Loop on the inner voxels (sampling vg)
+    auto itVoxelsIn = itVoxelsOut->second.begin();
+    while(itVoxelsIn != itVoxelsOut->second.end())
+    {
+      // Shortcut to voxel
+      const Voxel& voxel = itVoxelsIn->second;
+      // Remove the voxel if its point is not fixed and comes from one of the anchors
+      if (voxel.point.label != 1 && anchors.count(voxel.anchor))
+      {
+        if (this->VoxelSearch && voxel.searchIndex >= 0)
+          this->VoxelSearch->Remove(voxel.searchIndex);
+        itVoxelsIn = itVoxelsOut->second.erase(itVoxelsIn);
+        --this->NbPoints;
+        updated = true;
+      }
+      else
+        ++itVoxelsIn;
+    }
+
+    // Remove empty outer voxels
+    if (itVoxelsOut->second.empty())
+      itVoxelsOut = this->Voxels.erase(itVoxelsOut);
+    else
+      ++itVoxelsOut;
+  }
+
+  // Remove the contribution of these anchors to all voxels statistics,
+  // as their points will be added again at their corrected positions
+  auto itStatsOut = this->VoxelsStatistics.begin();
+  while (itStatsOut != this->VoxelsStatistics.end())
+  {
+    auto itStatsIn = itStatsOut->second.begin();
+    while (itStatsIn != itStatsOut->second.end())
+    {
+      AnchoredStatistics& stats = itStatsIn->second;
+      stats.erase(std::remove_if(stats.begin(), stats.end(),
+                                 [&anchors](const std::pair<int, VoxelStatistics>& s) { return anchors.count(s.first); }),
+                  stats.end());
+      if (stats.empty())
+        itStatsIn = itStatsOut->second.erase(itStatsIn);
+      else
+        ++itStatsIn;
+    }
+    if (itStatsOut->second.empty())
+      itStatsOut = this->VoxelsStatistics.erase(itStatsOut);
+    else
+      ++itStatsOut;
+  }
+
+  // Clear the deprecated KD-tree if the map has been updated
+  if (updated)
+    this->ClearKdTree();
+}
+
+//------------------------------------------------------------------------------
+unsigned int RollingGrid::RemoveFarthestVoxels(const Eigen::Array3f& position, unsigned int nbPoints)
+{
+  // Sort the outer voxels from the farthest to the closest to position
+  Eigen::Array3f voxelGridOrigin = this->VoxelGridPosition - int(this->GridSize / 2) * this->VoxelResolution;
+  std::vector<std::pair<float, int>> voxelsDistances;
+  voxelsDistances.reserve(this->Voxels.size());
+  for (const auto& kvOut : this->Voxels)
+  {
+    Eigen::Array3f voxelCenter = voxelGridOrigin + this->To3d(kvOut.first).cast<float>() * this->VoxelResolution;
+    voxelsDistances.emplace_back((voxelCenter - position).matrix().squaredNorm(), kvOut.first);
+  }
+  std::sort(voxelsDistances.begin(), voxelsDistances.end(), std::greater<std::pair<float, int>>());
+
+  // Remove the farthest voxels until enough points have been removed
+  unsigned int nbRemovedPoints = 0;
+  for (const auto& distVoxel : voxelsDistances)
+  {
+    if (nbRemovedPoints >= nbPoints)
+      break;
+    auto itVoxelsOut = this->Voxels.find(distVoxel.second);
+    nbRemovedPoints += itVoxelsOut->second.size();
+    if (this->VoxelSearch)
+      this->RemoveFromVoxelSearch(itVoxelsOut->second);
+    this->Voxels.erase(itVoxelsOut);
+    this->VoxelsStatistics.erase(distVoxel.second);
+  }
+  this->NbPoints -= std::min(nbRemovedPoints, this->NbPoints);
+
+  // Clear the deprecated KD-tree if the map has been updated
+  if (nbRemovedPoints)
+    this->ClearKdTree();
+  return nbRemovedPoints;
+}
+
+//------------------------------------------------------------------------------
+size_t RollingGrid::GetMemorySize() const
+{
+  // Each inner voxel is stored in a hash map node (key, value and next pointer)
+  // with an additional bucket pointer. Each outer voxel holds an inner hash map.
+  constexpr size_t innerNodeSize = sizeof(SamplingVG::value_type) + 2 * sizeof(void*);
+  constexpr size_t outerNodeSize = sizeof(RollingVG::value_type) + 2 * sizeof(void*);
+  size_t memory = this->Voxels.size() * outerNodeSize;
+  for (const auto& kvOut : this->Voxels)
+    memory += kvOut.second.size() * innerNodeSize;
+
+  // Voxels statistics, stored the same way with a vector per inner voxel
+  constexpr size_t statsInnerNodeSize = sizeof(StatisticsVG::mapped_type::value_type) + 2 * sizeof(void*);
+  constexpr size_t statsOuterNodeSize = sizeof(StatisticsVG::value_type) + 2 * sizeof(void*);
+  memory += this->VoxelsStatistics.size() * statsOuterNodeSize;
+  for (const auto& kvOut : this->VoxelsStatistics)
+  {
+    memory += kvOut.second.size() * statsInnerNodeSize;
+    for (const auto& kvIn : kvOut.second)
+      memory += kvIn.second.capacity() * sizeof(AnchoredStatistics::value_type);
+  }
+  return memory;
+}
+
+//------------------------------------------------------------------------------
+RollingGrid::VoxelStatistics RollingGrid::GetNeighborhoodStatistics(const Eigen::Vector3f& position, int radius) const
+{
+  VoxelStatistics stats;
+  Eigen::Array3f voxelGridOrigin = this->VoxelGridPosition - int(this->GridSize / 2) * this->VoxelResolution;
+  for (int dz = -radius; dz <= radius; ++dz)
+  {
+    for (int dy = -radius; dy <= radius; ++dy)
+    {
+      for (int dx = -radius; dx <= radius; ++dx)
+      {
+        // Center of the neighbor inner voxel, which may lie in another outer voxel
+        Eigen::Array3f neighbor = position.array() + Eigen::Array3f(dx, dy, dz) * this->LeafSize;
+        int idxOut, idxIn;
+        if (!this->GetVoxelIndices(neighbor, voxelGridOrigin, idxOut, idxIn))
+          continue;
+
+        // Merge its statistics from all anchors
+        auto itStatsOut = this->VoxelsStatistics.find(idxOut);
+        if (itStatsOut != this->VoxelsStatistics.end())
+        {
+          auto itStatsIn = itStatsOut->second.find(idxIn);
+          if (itStatsIn != itStatsOut->second.end())
+          {
+            for (const auto& anchorStats : itStatsIn->second)
+              stats.Merge(anchorStats.second);
+            continue;
+          }
+        }
+
+        // Or its single point if no statistics are available
+        const Voxel* voxel = this->FindVoxel(neighbor, voxelGridOrigin);
+        if (voxel)
+          stats.Add(voxel->point.getVector3fMap());
+      }
+    }
+  }
+  return stats;
+}
+
+//------------------------------------------------------------------------------
+bool RollingGrid::IsOccupied(const Eigen::Vector3f& position) const
+{
+  Eigen::Array3f voxelGridOrigin = this->VoxelGridPosition - int(this->GridSize / 2) * this->VoxelResolution;
+  return this->FindVoxel(position.array(), voxelGridOrigin) != nullptr;
+}
+
+//------------------------------------------------------------------------------
+bool RollingGrid::GetVoxelIndices(const Eigen::Array3f& position, const Eigen::Array3f& voxelGridOrigin, int& idxOut, int& idxIn) const
+{
+  // Find the outer voxel containing this position
+  Eigen::Array3i voxelCoordOut = Utils::PositionToVoxel<Eigen::Array3f>(position, voxelGridOrigin, this->VoxelResolution);
+  if (!((0 <= voxelCoordOut) && (voxelCoordOut < this->GridSize)).all())
+    return false;
+  idxOut = this->To1d(voxelCoordOut);
+
+  // Find the inner voxel containing this position
+  Eigen::Array3f voxelGridCenterIn = voxelCoordOut.cast<float>() * this->VoxelResolution + voxelGridOrigin;
+  Eigen::Array3i voxelCoordIn = Utils::PositionToVoxel<Eigen::Array3f>(position, voxelGridCenterIn, this->LeafSize);
+  idxIn = this->To1d(voxelCoordIn);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+const RollingGrid::Voxel* RollingGrid::FindVoxel(const Eigen::Array3f& position, const Eigen::Array3f& voxelGridOrigin) const
+{
+  int idxOut, idxIn;
+  if (!this->GetVoxelIndices(position, voxelGridOrigin, idxOut, idxIn))
+    return nullptr;
+  auto itVoxelOut = this->Voxels.find(idxOut);
+  if (itVoxelOut == this->Voxels.end())
+    return nullptr;
+  auto itVoxelIn = itVoxelOut->second.find(idxIn);
+  if (itVoxelIn == itVoxelOut->second.end())
+    return nullptr;
+  return &itVoxelIn->second;
+}
+
+//------------------------------------------------------------------------------
+RollingGrid::Snapshot RollingGrid::GetSnapshot() const
+{
+  Snapshot snapshot;
+  snapshot.GridSize = this->GridSize;
+  snapshot.VoxelResolution = this->VoxelResolution;
+  snapshot.LeafSize = this->LeafSize;
+  snapshot.VoxelGridPosition = this->VoxelGridPosition;
+  snapshot.VoxelsOut.reserve(this->Voxels.size());
+  snapshot.VoxelsIn.reserve(this->NbPoints);
+  // Loop on the outer voxels (rolling vg)
+  for (const auto& kvOut : this->Voxels)
+  {
+    snapshot.VoxelsOut.emplace_back(kvOut.first, kvOut.second.size());
+    // Loop on the inner voxels (sampling vg)
+    for (const auto& kvIn : kvOut.second)
+      snapshot.VoxelsIn.push_back({kvIn.first, kvIn.second.point, kvIn.second.count, kvIn.second.anchor});
+  }
+  return snapshot;
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::Snapshot::Save(std::ostream& out) const
+{
+  Utils::WriteBinary(out, this->GridSize);
+  Utils::WriteBinary(out, this->VoxelResolution);
+  Utils::WriteBinary(out, this->LeafSize);
+  Utils::WriteBinary(out, this->VoxelGridPosition);
+  Utils::WriteBinary(out, static_cast<uint64_t>(this->VoxelsOut.size()));
+  auto itVoxelIn = this->VoxelsIn.begin();
+  for (const auto& voxelOut : this->VoxelsOut)
+  {
+    Utils::WriteBinary(out, voxelOut.first);
+    Utils::WriteBinary(out, voxelOut.second);
+    for (uint64_t i = 0; i < voxelOut.second; ++i, ++itVoxelIn)
+    {
+      Utils::WriteBinary(out, itVoxelIn->Id);
+      Utils::WriteBinary(out, itVoxelIn->point);
+      Utils::WriteBinary(out, itVoxelIn->count);
+      Utils::WriteBinary(out, itVoxelIn->anchor);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+bool RollingGrid::Load(std::istream& in)
+{
+  this->Clear();
+
+  int gridSize;
+  double voxelResolution, leafSize;
+  Eigen::Array3f voxelGridPosition;
+  uint64_t nbVoxelsOut;
+  if (!Utils::ReadBinary(in, gridSize) || !Utils::ReadBinary(in, voxelResolution) ||
+      !Utils::ReadBinary(in, leafSize) || !Utils::ReadBinary(in, voxelGridPosition) ||
+      !Utils::ReadBinary(in, nbVoxelsOut))
+    return false;
+
+  RollingVG voxels;
+  voxels.reserve(nbVoxelsOut);
+  unsigned int nbPoints = 0;
+  for (uint64_t i = 0; i < nbVoxelsOut; ++i)
+  {
+    int idOut;
+    uint64_t nbVoxelsIn;
+    if (!Utils::ReadBinary(in, idOut) || !Utils::ReadBinary(in, nbVoxelsIn))
+      return false;
+    SamplingVG& voxelsIn = voxels[idOut];
+    voxelsIn.reserve(nbVoxelsIn);
+    for (uint64_t j = 0; j < nbVoxelsIn; ++j)
+    {
+      int idIn;
+      Voxel voxel;
+      if (!Utils::ReadBinary(in, idIn) || !Utils::ReadBinary(in, voxel.point) ||
+          !Utils::ReadBinary(in, voxel.count) || !Utils::ReadBinary(in, voxel.anchor))
+        return false;
+      voxelsIn.emplace(idIn, voxel);
+    }
+    nbPoints += nbVoxelsIn;
+  }
+
+  this->GridSize = gridSize;
+  this->VoxelResolution = voxelResolution;
+  this->LeafSize = leafSize;
+  this->VoxelGridPosition = voxelGridPosition;
+  this->Voxels.swap(voxels);
+  this->NbPoints = nbPoints;
+  this->BuildVoxelSearch();
+  return true;
 }
 
 //==============================================================================
@@ -324,6 +701,7 @@ void RollingGrid::Add(const PointCloud::Ptr& pointcloud, bool fixed, double curr
 //------------------------------------------------------------------------------
 void RollingGrid::ClearOldPoints(double currentTime)
 {
+  bool updated = false;
   // Loop on the outer voxels (rolling vg)
   auto itVoxelsOut = this->Voxels.begin();
   while(itVoxelsOut != this->Voxels.end())
@@ -336,7 +714,13 @@ void RollingGrid::ClearOldPoints(double currentTime)
       Voxel& voxel = itVoxelsIn->second;
       // If voxel is removable and too old, remove it
       if (!voxel.point.label && currentTime - voxel.point.time > this->DecayingThreshold)
+      {
+        if (this->VoxelSearch && voxel.searchIndex >= 0)
+          this->VoxelSearch->Remove(voxel.searchIndex);
+        this->RemoveStatistics(itVoxelsOut->first, itVoxelsIn->first);
         itVoxelsIn = itVoxelsOut->second.erase(itVoxelsIn);
+        updated = true;
+      }
       else
         ++itVoxelsIn;
     }
@@ -347,20 +731,41 @@ void RollingGrid::ClearOldPoints(double currentTime)
     else
       ++itVoxelsOut;
   }
+
+  // Clear the deprecated KD-tree if the map has been updated
+  if (updated)
+    this->ClearKdTree();
 }
 
 //------------------------------------------------------------------------------
 void RollingGrid::BuildSubMapKdTree()
 {
+  // The hashed voxels are always up to date
+  if (this->VoxelSearch)
+    return;
+
+  // The cached models refer to the previous KD-tree points
+  this->ModelCache.Clear();
+
   // Get all points from all voxels
   this->SubMap = this->Get();
+  this->SubMapMinPoint.setConstant(-std::numeric_limits<float>::infinity());
+  this->SubMapMaxPoint.setConstant(std::numeric_limits<float>::infinity());
   // Build the internal KD-Tree for fast NN queries in map
-  this->KdTree.Reset(this->SubMap);
+  this->KdTree = std::make_shared<KDTree>(this->SubMap);
+  this->UpdateSubMapSearch();
 }
 
 //------------------------------------------------------------------------------
 void RollingGrid::BuildSubMapKdTree(const Eigen::Array3f& minPoint, const Eigen::Array3f& maxPoint, int minNbPoints)
 {
+  // The hashed voxels are always up to date
+  if (this->VoxelSearch)
+    return;
+
+  // The cached models refer to the previous KD-tree points
+  this->ModelCache.Clear();
+
   // Compute the position of the origin cell (0, 0, 0) of the grid
   Eigen::Array3f voxelGridOrigin = this->VoxelGridPosition - int(this->GridSize / 2) * this->VoxelResolution;
 
@@ -435,22 +840,161 @@ void RollingGrid::BuildSubMapKdTree(const Eigen::Array3f& minPoint, const Eigen:
     }
   }
 
-  if (this->SubMap->empty())
+  // Build the internal KD-Tree for fast NN queries in sub-map.
+  // The prior map points are not added to it, their prebuilt KD-tree covers
+  // the whole prior map, which does not change the NN queries results but
+  // avoids copying them and rebuilding their KD-tree for each frame.
+  this->SubMapMinPoint = minPoint;
+  this->SubMapMaxPoint = maxPoint;
+  this->KdTree = std::make_shared<KDTree>(this->SubMap);
+  this->UpdateSubMapSearch();
+  if (!this->SubMapSearch->Size())
     PRINT_WARNING("No intersecting voxels found with current scan");
-  // Build the internal KD-Tree for fast NN queries in sub-map
-  this->KdTree.Reset(this->SubMap);
+}
+
+//------------------------------------------------------------------------------
+RollingGrid::PointCloud::ConstPtr RollingGrid::GetSubMap() const
+{
+  if (!this->Prior)
+    return this->SubMap;
+
+  // Add the prior map points lying in the sub-map bounding box
+  PointCloud::Ptr subMap(new PointCloud(*this->SubMap));
+  if (this->SubMapMinPoint.allFinite() && this->SubMapMaxPoint.allFinite())
+    this->Prior->ExtractPoints(this->SubMapMinPoint, this->SubMapMaxPoint, *subMap);
+  else
+    *subMap += *this->Prior->GetCloud();
+  return subMap;
+}
+
+//------------------------------------------------------------------------------
+size_t RollingGrid::GetSubMapMemorySize() const
+{
+  size_t memory = this->ModelCache.GetMemorySize();
+  if (this->VoxelSearch)
+    return memory + this->VoxelSearch->GetMemorySize() + sizeof(PointCloud) + this->VoxelSearch->GetIndicesRange() * sizeof(Point);
+  memory += this->KdTree->GetMemorySize();
+  if (this->SubMap)
+    memory += sizeof(PointCloud) + this->SubMap->size() * sizeof(Point);
+  return memory;
 }
 
 //==============================================================================
 //   Helpers
 //==============================================================================
 
+//------------------------------------------------------------------------------
+void RollingGrid::VoxelStatistics::Add(const Eigen::Vector3f& point)
+{
+  ++this->N;
+  Eigen::Vector3f delta = point - this->Mean;
+  this->Mean += delta / this->N;
+  this->Scatter += delta * (point - this->Mean).transpose();
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::VoxelStatistics::Merge(const VoxelStatistics& other)
+{
+  if (!other.N)
+    return;
+  unsigned int n = this->N + other.N;
+  Eigen::Vector3f delta = other.Mean - this->Mean;
+  this->Scatter += other.Scatter + delta * delta.transpose() * (static_cast<float>(this->N) * other.N / n);
+  this->Mean += delta * (static_cast<float>(other.N) / n);
+  this->N = n;
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::AddToStatistics(int idxOut, int idxIn, int anchor, const Eigen::Vector3f& point)
+{
+  AnchoredStatistics& stats = this->VoxelsStatistics[idxOut][idxIn];
+  // The points are usually added by the last anchor
+  auto it = std::find_if(stats.rbegin(), stats.rend(), [anchor](const std::pair<int, VoxelStatistics>& s) { return s.first == anchor; });
+  if (it == stats.rend())
+  {
+    stats.emplace_back(anchor, VoxelStatistics());
+    stats.back().second.Add(point);
+  }
+  else
+    it->second.Add(point);
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::RemoveStatistics(int idxOut, int idxIn)
+{
+  auto itStatsOut = this->VoxelsStatistics.find(idxOut);
+  if (itStatsOut == this->VoxelsStatistics.end())
+    return;
+  itStatsOut->second.erase(idxIn);
+  if (itStatsOut->second.empty())
+    this->VoxelsStatistics.erase(itStatsOut);
+}
+
 //------------------------------------------------------------------------------
 int RollingGrid::To1d(const Eigen::Array3i& voxelId3d) const
 {
   return voxelId3d.z() * this->GridSize * this->GridSize + voxelId3d.y() * this->GridSize + voxelId3d.x();
 }
 
+//------------------------------------------------------------------------------
+void RollingGrid::ClearKdTree()
+{
+  this->KdTree = std::make_shared<KDTree>();
+  // The hashed voxels are updated in place, their search structure stays valid
+  if (!this->VoxelSearch)
+    this->SubMapSearch = this->KdTree;
+  this->ModelCache.Clear();
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::UpdateSubMapSearch()
+{
+  // The hashed voxels may be empty for now, they are always merged with the prior map
+  if (this->VoxelSearch)
+  {
+    if (this->Prior)
+      this->SubMapSearch = std::make_shared<MergedSearch>(this->Prior->GetKdTree(), this->VoxelSearch);
+    else
+      this->SubMapSearch = this->VoxelSearch;
+  }
+  else if (!this->Prior)
+    this->SubMapSearch = this->KdTree;
+  // Only the prior map is available, use its KD-tree directly
+  else if (!this->KdTree->Size())
+    this->SubMapSearch = this->Prior->GetKdTree();
+  else
+    this->SubMapSearch = std::make_shared<MergedSearch>(this->Prior->GetKdTree(), this->KdTree);
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::BuildVoxelSearch()
+{
+  if (this->SearchBackend != NeighborSearchBackend::HASHED_VOXELS)
+  {
+    if (this->VoxelSearch)
+    {
+      this->VoxelSearch.reset();
+      this->SubMapSearch = this->KdTree;
+    }
+    return;
+  }
+
+  // The prior map points are not copied : they are searched in its own KD-tree
+  this->VoxelSearch = std::make_shared<HashedVoxels>(3. * this->LeafSize);
+  for (auto& kvOut : this->Voxels)
+    for (auto& kvIn : kvOut.second)
+      kvIn.second.searchIndex = this->VoxelSearch->Insert(kvIn.second.point);
+  this->UpdateSubMapSearch();
+}
+
+//------------------------------------------------------------------------------
+void RollingGrid::RemoveFromVoxelSearch(const SamplingVG& voxels)
+{
+  for (const auto& kvIn : voxels)
+    if (kvIn.second.searchIndex >= 0)
+      this->VoxelSearch->Remove(kvIn.second.searchIndex);
+}
+
 //------------------------------------------------------------------------------
 Eigen::Array3i RollingGrid::To3d(int voxelId1d) const
 {
@@ -72,7 +72,13 @@
 //   initial position. The output trajectory describes BASE origin in WORLD.
 
 // GENERIC
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <ctime>
+#include <fstream>
+#include <set>
+#include <sstream>
 
 // LOCAL
 #include "LidarSlam/Slam.h"
@@ -113,6 +119,72 @@ inline size_t PointCloudMemorySize(const Slam::PointCloud& cloud)
   return (sizeof(cloud) + (sizeof(Slam::PointCloud::PointType) * cloud.size()));
 }
 
+//-----------------------------------------------------------------------------
+//! Approximate RAM size of a logged pointcloud (PCD files are stored on disk)
+inline size_t StorageMemorySize(const Slam::PCStorage& storage)
+{
+  if (storage.StorageType() == PCL_CLOUD || storage.StorageType() == OCTREE_COMPRESSED)
+    return storage.MemorySize();
+  return 0;
+}
+
+//-----------------------------------------------------------------------------
+//! Checkpoint file signature and format version
+//! The version must be incremented each time the checkpoint content changes.
+constexpr char CheckpointMagic[8] = {'L', 'S', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr uint32_t CheckpointVersion = 1;
+
+//-----------------------------------------------------------------------------
+//! Path of the checkpoint keypoints file of a given generation
+inline std::string CheckpointKeypointsPath(const std::string& filePrefix, unsigned int generation)
+{
+  return filePrefix + "." + std::to_string(generation) + ".kpts";
+}
+
+//-----------------------------------------------------------------------------
+//! Check if a pose increment is below translation [m] and rotation [°] thresholds
+inline bool IsSmallMotion(const Eigen::Isometry3d& increment, double maxTranslation, double maxRotation)
+{
+  return increment.translation().norm() < maxTranslation &&
+         Rad2Deg(Eigen::AngleAxisd(increment.linear()).angle()) < maxRotation;
+}
+
+//-----------------------------------------------------------------------------
+//! Check if a keypoint has been matched (even if its match was not selected)
+inline bool IsMatched(KeypointsMatcher::MatchingResults::MatchStatus status)
+{
+  return status == KeypointsMatcher::MatchingResults::SUCCESS ||
+         status == KeypointsMatcher::MatchingResults::NOT_SELECTED;
+}
+
+//-----------------------------------------------------------------------------
+//! Number of keypoints whose matching status (matched or not) changed between
+//! two ICP iterations
+inline unsigned int NbMatchStatusChanges(const std::vector<KeypointsMatcher::MatchingResults::MatchStatus>& previous,
+                                         const std::vector<KeypointsMatcher::MatchingResults::MatchStatus>& current)
+{
+  if (previous.size() != current.size())
+    return current.size();
+  unsigned int nbChanges = 0;
+  for (unsigned int i = 0; i < current.size(); ++i)
+    nbChanges += IsMatched(previous[i]) != IsMatched(current[i]);
+  return nbChanges;
+}
+
+//-----------------------------------------------------------------------------
+//! Subsample a keypoints cloud, keeping the given ratio of points uniformly
+//! spread along their Morton order (which must have been computed beforehand)
+inline Slam::PointCloud::Ptr MortonSubsample(const Slam::PointCloud::Ptr& cloud, const std::vector<size_t>& mortonOrder, double ratio)
+{
+  Slam::PointCloud::Ptr subsampled(new Slam::PointCloud);
+  CopyPointCloudMetadata(*cloud, *subsampled);
+  const unsigned int nbPoints = std::ceil(ratio * mortonOrder.size());
+  subsampled->reserve(nbPoints);
+  for (unsigned int i = 0; i < nbPoints; ++i)
+    subsampled->push_back(cloud->at(mortonOrder[std::min(static_cast<size_t>(i / ratio), mortonOrder.size() - 1)]));
+  return subsampled;
+}
+
 } // end of anonymous namespace
 } // end of Utils namespace
 
@@ -129,6 +201,7 @@ Slam::Slam()
   // Allocate maps
   for (auto k : KeypointTypes)
     this->LocalMaps[k] = std::make_shared<RollingGrid>();
+  this->UpdateMapsVoxelStatistics();
 
   // Set default maps parameters
   this->SetVoxelGridResolution(10.);
@@ -176,6 +249,8 @@ void Slam::Reset(bool resetLog)
     this->EgoMotionMatchingResults[k] = KeypointsMatcher::MatchingResults();
   for (auto k : KeypointTypes)
     this->LocalizationMatchingResults[k] = KeypointsMatcher::MatchingResults();
+  this->EgoMotionWarmStart.clear();
+  this->LocalizationWarmStart.clear();
 
   // Reset external sensor managers
   this->WheelOdomManager.SetRefDistance(FLT_MAX);
@@ -188,6 +263,10 @@ void Slam::Reset(bool resetLog)
     this->NbrFrameProcessed = 0;
     this->LogStates.clear();
 
+    // Next checkpoint will not be able to reuse the previous logged keypoints
+    this->CheckpointPrefix.clear();
+    this->CheckpointKeypointsOffsets.clear();
+
     // Reset processing duration timers
     Utils::Timer::Reset();
   }
@@ -314,6 +393,14 @@ void Slam::AddFrames(const std::vector<PointCloud::Ptr>& frames)
     IF_VERBOSE(3, Utils::Timer::StopAndDisplay("Logging"));
   }
 
+  // Free some memory if the memory budget is exceeded
+  if (this->MemoryBudget > 0.)
+  {
+    IF_VERBOSE(3, Utils::Timer::Init("Memory budget"));
+    this->EnforceMemoryBudget();
+    IF_VERBOSE(3, Utils::Timer::StopAndDisplay("Memory budget"));
+  }
+
   // Motion and localization parameters estimation information display
   if (this->Verbosity >= 2)
   {
@@ -339,8 +426,8 @@ void Slam::AddFrames(const std::vector<PointCloud::Ptr>& frames)
   {
     SET_COUT_FIXED_PRECISION(3);
     std::cout << "========== Memory usage ==========\n";
-    std::map<Keypoint, unsigned int> points;
-    std::map<Keypoint, unsigned int> memory;
+    std::map<Keypoint, size_t> points;
+    std::map<Keypoint, size_t> memory;
     // Initialize number of points and memory per keypoint type
     for (auto k : KeypointTypes)
     {
@@ -363,9 +450,21 @@ void Slam::AddFrames(const std::vector<PointCloud::Ptr>& frames)
       std::cout << Utils::Capitalize(Utils::Plural(KeypointTypeNames.at(k)))<< " log  : "
                 << LogStates.size() << " frames, "
                 << points[k] * 1e-6 << " points, "
-                << memory[k] << " MB\n";
+                << memory[k] * 1e-6 << " MB\n";
 
     }
+
+    // Print memory usage of each subsystem
+    double totalMemory = 0.;
+    for (const auto& kv : this->GetMemoryUsage())
+    {
+      std::cout << MemorySubsystemNames.at(kv.first) << " : " << kv.second << " MB\n";
+      totalMemory += kv.second;
+    }
+    std::cout << "Total : " << totalMemory << " MB";
+    if (this->MemoryBudget > 0.)
+      std::cout << " (budget : " << this->MemoryBudget << " MB)";
+    std::cout << std::endl;
     RESET_COUT_FIXED_PRECISION;
   }
 
@@ -379,6 +478,9 @@ void Slam::AddFrames(const std::vector<PointCloud::Ptr>& frames)
 void Slam::ComputeSensorConstraints()
 {
   double currLidarTime = Utils::PclStampToSec(this->CurrentFrames[0]->header.stamp);
+  // The constraints must use the same pose parameterization as the optimizer
+  this->WheelOdomManager.SetParameterization(this->OptimizationParameterization);
+  this->ImuManager.SetParameterization(this->OptimizationParameterization);
   if (this->WheelOdomManager.ComputeConstraint(currLidarTime, this->Verbosity >= 3))
     PRINT_VERBOSE(3, "Adding wheel odometry constraint")
   if (this->ImuManager.ComputeConstraint(currLidarTime, this->Verbosity >= 3))
@@ -386,6 +488,7 @@ void Slam::ComputeSensorConstraints()
   for (auto& idLm : this->LandmarksManagers)
   {
     PRINT_VERBOSE(3, "Checking state of tag #" << idLm.first)
+    idLm.second.SetParameterization(this->OptimizationParameterization);
     if (idLm.second.ComputeConstraint(currLidarTime, this->Verbosity >= 3))
       PRINT_VERBOSE(3, "\t Adding constraint for tag #" << idLm.first)
   }
@@ -478,29 +581,43 @@ void Slam::OptimizeGraph()
 
   // Update the maps
   IF_VERBOSE(3, Utils::Timer::Init("PGO : maps update"));
-  // The iteration is not directly on Keypoint types
-  // because of openMP behaviour which needs int iteration on MSVC
-  int nbKeypointTypes = static_cast<int>(KeypointTypes.size());
-  #pragma omp parallel for num_threads(std::min(this->NbThreads, nbKeypointTypes))
-  for (int i = 0; i < nbKeypointTypes; ++i)
+  if (this->KfAnchoredMaps)
+    this->UpdateAnchoredMaps();
+  else
   {
-    Keypoint k = static_cast<Keypoint>(KeypointTypes[i]);
-    if (!this->UseKeypoints[k])
-      continue;
-    this->LocalMaps[k]->Clear();
-    PointCloud::Ptr keypoints(new PointCloud);
-    for (auto& state : this->LogStates)
+    // The iteration is not directly on Keypoint types
+    // because of openMP behaviour which needs int iteration on MSVC
+    int nbKeypointTypes = static_cast<int>(KeypointTypes.size());
+    #pragma omp parallel for num_threads(std::min(this->NbThreads, nbKeypointTypes))
+    for (int i = 0; i < nbKeypointTypes; ++i)
     {
-      if (!state.IsKeyFrame)
+      Keypoint k = static_cast<Keypoint>(KeypointTypes[i]);
+      if (!this->UseKeypoints[k])
         continue;
-      keypoints.reset(new PointCloud);
-      pcl::transformPointCloud(*state.Keypoints[k]->GetCloud(), *keypoints, state.Isometry.matrix().cast<float>());
-      this->LocalMaps[k]->Add(keypoints, false);
+      this->LocalMaps[k]->Clear();
+      PointCloud::Ptr keypoints(new PointCloud);
+      for (auto& state : this->LogStates)
+      {
+        if (!state.IsKeyFrame)
+          continue;
+        keypoints.reset(new PointCloud);
+        pcl::transformPointCloud(*state.Keypoints[k]->GetCloud(), *keypoints, state.Isometry.matrix().cast<float>());
+        this->LocalMaps[k]->Add(keypoints, false, -1., true, state.Index);
+      }
+      // Roll to center onto last pose
+      Eigen::Vector4f minPoint, maxPoint;
+      pcl::getMinMax3D(*keypoints, minPoint, maxPoint);
+      this->LocalMaps[k]->Roll(minPoint.head<3>().array(), maxPoint.head<3>().array());
+    }
+    // All keyframes are now anchored to their optimized pose
+    for (auto& state : this->LogStates)
+    {
+      if (state.IsKeyFrame && this->MapUpdate != MappingMode::NONE)
+      {
+        state.IsMapAnchor = true;
+        state.AnchorIsometry = state.Isometry;
+      }
     }
-    // Roll to center onto last pose
-    Eigen::Vector4f minPoint, maxPoint;
-    pcl::getMinMax3D(*keypoints, minPoint, maxPoint);
-    this->LocalMaps[k]->Roll(minPoint.head<3>().array(), maxPoint.head<3>().array());
   }
 
   IF_VERBOSE(3, Utils::Timer::StopAndDisplay("PGO : maps update"));
@@ -712,6 +829,316 @@ void Slam::LoadMapsFromPCD(const std::string& filePrefix, bool resetMaps)
   IF_VERBOSE(3, Utils::Timer::StopAndDisplay("Keypoints maps loading from PCD"));
 }
 
+//-----------------------------------------------------------------------------
+void Slam::SetPriorMaps(const std::map<Keypoint, std::shared_ptr<const PriorMap>>& priorMaps)
+{
+  for (auto k : KeypointTypes)
+  {
+    auto it = priorMaps.find(k);
+    this->LocalMaps[k]->SetPriorMap(it != priorMaps.end() ? it->second : nullptr);
+  }
+  // Refresh the overlap method warning
+  this->SetOverlapMethod(this->OverlapMethod);
+}
+
+//-----------------------------------------------------------------------------
+std::shared_ptr<const PriorMap> Slam::GetPriorMap(Keypoint k) const
+{
+  return this->LocalMaps.at(k)->GetPrior();
+}
+
+//-----------------------------------------------------------------------------
+bool Slam::UsePriorMaps() const
+{
+  return std::any_of(KeypointTypes.begin(), KeypointTypes.end(),
+                     [this](Keypoint k) { return this->UseKeypoints.at(k) && this->LocalMaps.at(k)->GetPrior(); });
+}
+
+//-----------------------------------------------------------------------------
+bool Slam::SaveCheckpoint(const std::string& filePrefix, bool async)
+{
+  // If the previous checkpoint is still being written in background, skip this
+  // one rather than blocking the frames processing
+  if (async && this->CheckpointWriting.valid() &&
+      this->CheckpointWriting.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+  {
+    PRINT_WARNING("Previous checkpoint is still being written, skipping this one.");
+    return false;
+  }
+
+  IF_VERBOSE(3, Utils::Timer::Init("Checkpoint saving"));
+
+  // Wait for the previous checkpoint to be written.
+  // If it failed, the keypoints file may be corrupted and must be rewritten.
+  bool newGeneration = filePrefix != this->CheckpointPrefix;
+  if (this->CheckpointWriting.valid() && !this->CheckpointWriting.get())
+    newGeneration = true;
+
+  // Forget the keypoints of the states which are not logged anymore
+  std::map<unsigned int, std::map<Keypoint, uint64_t>> offsets;
+  for (const auto& state : this->LogStates)
+  {
+    auto it = this->CheckpointKeypointsOffsets.find(state.Index);
+    if (it != this->CheckpointKeypointsOffsets.end())
+      offsets.insert(*it);
+  }
+  this->CheckpointKeypointsOffsets.swap(offsets);
+
+  // Rewrite the keypoints file if it mostly contains forgotten states
+  // (states are appended in the order of their indices)
+  uint64_t firstOffset = this->CheckpointKeypointsOffsets.empty() ? this->CheckpointKeypointsSize
+                                                                   : this->CheckpointKeypointsOffsets.begin()->second.at(EDGE);
+  if (2 * firstOffset > this->CheckpointKeypointsSize)
+    newGeneration = true;
+
+  std::string previousKeypointsPath;
+  if (newGeneration)
+  {
+    // Only remove the previous keypoints file if it is replaced by the new one
+    if (filePrefix == this->CheckpointPrefix)
+      previousKeypointsPath = Utils::CheckpointKeypointsPath(filePrefix, this->CheckpointGeneration);
+    // Never overwrite an existing keypoints file, which may be used by a previous checkpoint
+    do
+      ++this->CheckpointGeneration;
+    while (std::ifstream(Utils::CheckpointKeypointsPath(filePrefix, this->CheckpointGeneration)).good());
+    this->CheckpointPrefix = filePrefix;
+    this->CheckpointKeypointsSize = 0;
+    this->CheckpointKeypointsOffsets.clear();
+  }
+
+  // Serialize the keypoints of the new logged states.
+  // As they are expressed in BASE coordinates, they never change once logged.
+  std::ostringstream keypointsData(std::ios::binary);
+  for (const auto& state : this->LogStates)
+  {
+    if (this->CheckpointKeypointsOffsets.count(state.Index))
+      continue;
+    auto& stateOffsets = this->CheckpointKeypointsOffsets[state.Index];
+    for (auto k : KeypointTypes)
+    {
+      stateOffsets[k] = this->CheckpointKeypointsSize + static_cast<uint64_t>(keypointsData.tellp());
+      Utils::WriteBinaryCloud(keypointsData, *state.Keypoints.at(k)->GetCloud());
+    }
+  }
+  this->CheckpointKeypointsSize += static_cast<uint64_t>(keypointsData.tellp());
+
+  // Serialize the SLAM state
+  std::ostringstream stateData(std::ios::binary);
+  stateData.write(Utils::CheckpointMagic, sizeof(Utils::CheckpointMagic));
+  Utils::WriteBinary(stateData, Utils::CheckpointVersion);
+  Utils::WriteBinary(stateData, static_cast<uint32_t>(sizeof(Point)));
+  Utils::WriteBinary(stateData, this->CheckpointGeneration);
+  Utils::WriteBinary(stateData, this->CheckpointKeypointsSize);
+
+  // Motion
+  Utils::WriteBinary(stateData, this->NbrFrameProcessed);
+  Utils::WriteBinary(stateData, this->CurrentTime);
+  Utils::WriteBinary(stateData, this->Tworld.matrix());
+  Utils::WriteBinary(stateData, this->PreviousTworld.matrix());
+  Utils::WriteBinary(stateData, this->Trelative.matrix());
+  Utils::WriteBinary(stateData, this->WithinFrameMotion.GetH0().matrix());
+  Utils::WriteBinary(stateData, this->WithinFrameMotion.GetH1().matrix());
+  Utils::WriteBinary(stateData, this->WithinFrameMotion.GetTime0());
+  Utils::WriteBinary(stateData, this->WithinFrameMotion.GetTime1());
+  Utils::WriteBinary(stateData, this->KfLastPose.matrix());
+  Utils::WriteBinary(stateData, this->KfCounter);
+
+  // Last frame keypoints, used by the ego-motion registration of next frame
+  for (auto k : KeypointTypes)
+    Utils::WriteBinaryCloud(stateData, *this->CurrentRawKeypoints[k]);
+
+  // Logged states
+  Utils::WriteBinary(stateData, static_cast<uint64_t>(this->LogStates.size()));
+  for (const auto& state : this->LogStates)
+  {
+    Utils::WriteBinary(stateData, state.BaseToSensor.matrix());
+    Utils::WriteBinary(stateData, state.Isometry.matrix());
+    Utils::WriteBinary(stateData, state.Covariance);
+    Utils::WriteBinary(stateData, state.Time);
+    Utils::WriteBinary(stateData, state.Index);
+    Utils::WriteBinary(stateData, static_cast<uint8_t>(state.IsKeyFrame));
+    Utils::WriteBinary(stateData, static_cast<uint8_t>(state.IsMapAnchor));
+    Utils::WriteBinary(stateData, state.AnchorIsometry.matrix());
+    for (auto k : KeypointTypes)
+      Utils::WriteBinary(stateData, this->CheckpointKeypointsOffsets[state.Index][k]);
+  }
+
+  // Maps, which are only copied here : their serialization is the most
+  // expensive part, it is done while writing the files
+  std::vector<RollingGrid::Snapshot> maps;
+  for (auto k : KeypointTypes)
+    maps.push_back(this->LocalMaps[k]->GetSnapshot());
+
+  IF_VERBOSE(3, Utils::Timer::StopAndDisplay("Checkpoint saving"));
+
+  // Write the files
+  auto writeFiles = [filePrefix, newGeneration, previousKeypointsPath,
+                     keypointsPath = Utils::CheckpointKeypointsPath(filePrefix, this->CheckpointGeneration),
+                     keypoints = keypointsData.str(), state = stateData.str(), maps = std::move(maps)]()
+  {
+    // Append the new keypoints
+    std::ofstream keypointsFile(keypointsPath, std::ios::binary | (newGeneration ? std::ios::trunc : std::ios::app));
+    keypointsFile.write(keypoints.data(), keypoints.size());
+    keypointsFile.close();
+    if (!keypointsFile)
+    {
+      PRINT_ERROR("Unable to write checkpoint keypoints to " << keypointsPath);
+      return false;
+    }
+
+    // Write the state to a temporary file before replacing the previous checkpoint,
+    // so that a valid checkpoint is always available, even after a crash
+    std::string path = filePrefix + ".ckpt";
+    std::string tmpPath = path + ".tmp";
+    std::ofstream stateFile(tmpPath, std::ios::binary | std::ios::trunc);
+    stateFile.write(state.data(), state.size());
+    for (const auto& map : maps)
+      map.Save(stateFile);
+    stateFile.close();
+    #ifdef _WIN32
+    std::remove(path.c_str());
+    #endif
+    if (!stateFile || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+      PRINT_ERROR("Unable to write checkpoint to " << path);
+      return false;
+    }
+
+    // The previous keypoints file is not used anymore
+    if (!previousKeypointsPath.empty())
+      std::remove(previousKeypointsPath.c_str());
+    return true;
+  };
+
+  if (async)
+  {
+    this->CheckpointWriting = std::async(std::launch::async, std::move(writeFiles));
+    return true;
+  }
+  return writeFiles();
+}
+
+//-----------------------------------------------------------------------------
+bool Slam::LoadCheckpoint(const std::string& filePrefix)
+{
+  IF_VERBOSE(3, Utils::Timer::Init("Checkpoint loading"));
+
+  // Wait for the checkpoint being written
+  if (this->CheckpointWriting.valid())
+    this->CheckpointWriting.get();
+
+  // Check the checkpoint header
+  std::string path = filePrefix + ".ckpt";
+  std::ifstream stateFile(path, std::ios::binary);
+  char magic[sizeof(Utils::CheckpointMagic)];
+  uint32_t version, pointSize;
+  unsigned int generation;
+  uint64_t keypointsSize;
+  if (!stateFile.read(magic, sizeof(magic)) || std::memcmp(magic, Utils::CheckpointMagic, sizeof(magic)) != 0 ||
+      !Utils::ReadBinary(stateFile, version) || !Utils::ReadBinary(stateFile, pointSize) ||
+      !Utils::ReadBinary(stateFile, generation) || !Utils::ReadBinary(stateFile, keypointsSize))
+  {
+    PRINT_ERROR("Unable to read checkpoint from " << path);
+    return false;
+  }
+  if (version != Utils::CheckpointVersion || pointSize != sizeof(Point))
+  {
+    PRINT_ERROR("Checkpoint " << path << " was written with an incompatible version (" << version << ").");
+    return false;
+  }
+  std::string keypointsPath = Utils::CheckpointKeypointsPath(filePrefix, generation);
+  std::ifstream keypointsFile(keypointsPath, std::ios::binary);
+  if (!keypointsFile)
+  {
+    PRINT_ERROR("Unable to read checkpoint keypoints from " << keypointsPath);
+    return false;
+  }
+
+  // Reset SLAM state before restoring it
+  this->Reset(true);
+  auto failure = [&]()
+  {
+    PRINT_ERROR("Checkpoint " << path << " is corrupted.");
+    this->Reset(true);
+    return false;
+  };
+
+  // Motion
+  Eigen::Isometry3d h0, h1;
+  double t0, t1;
+  if (!Utils::ReadBinary(stateFile, this->NbrFrameProcessed) ||
+      !Utils::ReadBinary(stateFile, this->CurrentTime) ||
+      !Utils::ReadBinary(stateFile, this->Tworld.matrix()) ||
+      !Utils::ReadBinary(stateFile, this->PreviousTworld.matrix()) ||
+      !Utils::ReadBinary(stateFile, this->Trelative.matrix()) ||
+      !Utils::ReadBinary(stateFile, h0.matrix()) ||
+      !Utils::ReadBinary(stateFile, h1.matrix()) ||
+      !Utils::ReadBinary(stateFile, t0) ||
+      !Utils::ReadBinary(stateFile, t1) ||
+      !Utils::ReadBinary(stateFile, this->KfLastPose.matrix()) ||
+      !Utils::ReadBinary(stateFile, this->KfCounter))
+    return failure();
+  this->WithinFrameMotion.SetH0(h0, t0);
+  this->WithinFrameMotion.SetH1(h1, t1);
+
+  // Last frame keypoints
+  for (auto k : KeypointTypes)
+  {
+    if (!Utils::ReadBinaryCloud(stateFile, *this->CurrentRawKeypoints[k]))
+      return failure();
+  }
+
+  // Logged states
+  uint64_t nbStates;
+  if (!Utils::ReadBinary(stateFile, nbStates))
+    return failure();
+  for (uint64_t i = 0; i < nbStates; ++i)
+  {
+    LidarState state;
+    uint8_t isKeyFrame, isMapAnchor;
+    if (!Utils::ReadBinary(stateFile, state.BaseToSensor.matrix()) ||
+        !Utils::ReadBinary(stateFile, state.Isometry.matrix()) ||
+        !Utils::ReadBinary(stateFile, state.Covariance) ||
+        !Utils::ReadBinary(stateFile, state.Time) ||
+        !Utils::ReadBinary(stateFile, state.Index) ||
+        !Utils::ReadBinary(stateFile, isKeyFrame) ||
+        !Utils::ReadBinary(stateFile, isMapAnchor) ||
+        !Utils::ReadBinary(stateFile, state.AnchorIsometry.matrix()))
+      return failure();
+    state.IsKeyFrame = isKeyFrame;
+    state.IsMapAnchor = isMapAnchor;
+    auto& stateOffsets = this->CheckpointKeypointsOffsets[state.Index];
+    for (auto k : KeypointTypes)
+    {
+      PointCloud::Ptr keypoints(new PointCloud);
+      if (!Utils::ReadBinary(stateFile, stateOffsets[k]) ||
+          !keypointsFile.seekg(stateOffsets[k]) ||
+          !Utils::ReadBinaryCloud(keypointsFile, *keypoints))
+        return failure();
+      state.Keypoints[k] = std::make_shared<PCStorage>(keypoints, this->LoggingStorage);
+    }
+    this->LogStates.push_back(state);
+  }
+
+  // Maps
+  for (auto k : KeypointTypes)
+  {
+    if (!this->LocalMaps[k]->Load(stateFile))
+      return failure();
+  }
+  this->UpdateMapsVoxelStatistics();
+
+  // Next checkpoints will append new keypoints to the loaded ones
+  this->CheckpointPrefix = filePrefix;
+  this->CheckpointGeneration = generation;
+  this->CheckpointKeypointsSize = keypointsSize;
+
+  std::cout << "SLAM state successfully restored from checkpoint " << path
+            << " (" << this->LogStates.size() << " logged states)" << std::endl;
+  IF_VERBOSE(3, Utils::Timer::StopAndDisplay("Checkpoint loading"));
+  return true;
+}
+
 //==============================================================================
 //   SLAM results getters
 //==============================================================================
@@ -767,6 +1194,8 @@ std::unordered_map<std::string, double> Slam::GetDebugInformation() const
     map[name] = this->LocalizationMatchingResults.at(k).NbMatches();
   }
 
+  map["EgoMotion: ICP iterations"]         = this->EgoMotionICPIterations;
+  map["Localization: ICP iterations"]      = this->LocalizationICPIterations;
   map["Localization: position error"]      = this->LocalizationUncertainty.PositionError;
   map["Localization: orientation error"]   = this->LocalizationUncertainty.OrientationError;
   map["Confidence: overlap"]               = this->OverlapEstimation;
@@ -823,7 +1252,8 @@ Slam::PointCloud::Ptr Slam::GetMap(Keypoint k, bool clean) const
 //-----------------------------------------------------------------------------
 Slam::PointCloud::Ptr Slam::GetTargetSubMap(Keypoint k) const
 {
-  PointCloud::Ptr subMap = this->LocalMaps.at(k)->GetSubMap();
+  // The sub-map is copied, as it may be shared with the prior map
+  PointCloud::Ptr subMap(new PointCloud(*this->LocalMaps.at(k)->GetSubMap()));
   subMap->header = Utils::BuildPclHeader(this->CurrentFrames[0]->header.stamp,
                                          this->WorldFrameId,
                                          this->NbrFrameProcessed);
@@ -960,6 +1390,7 @@ void Slam::ComputeEgoMotion()
 
   // Reset ego-motion
   this->Trelative = Eigen::Isometry3d::Identity();
+  this->EgoMotionICPIterations = 0;
 
   // Linearly extrapolate previous motion to estimate new pose
   if (this->LogStates.size() >= 2 &&
@@ -1021,6 +1452,10 @@ void Slam::ComputeEgoMotion()
     // Init matching parameters
     KeypointsMatcher::Parameters matchingParams;
     matchingParams.NbThreads = this->NbThreads;
+    // The planar dedicated solver evaluates batched matches without the 6D jacobians
+    matchingParams.BatchedResiduals = this->BatchedLidarResiduals ||
+                                      (this->TwoDMode && this->OptimizationSolver == PoseSolver::DENSE_LM);
+    matchingParams.Parameterization = this->OptimizationParameterization;
     matchingParams.SingleEdgePerRing = true;
     matchingParams.MaxNeighborsDistance = this->EgoMotionMaxNeighborsDistance;
     matchingParams.EdgeNbNeighbors = this->EgoMotionEdgeNbNeighbors;
@@ -1029,6 +1464,28 @@ void Slam::ComputeEgoMotion()
     matchingParams.PlaneNbNeighbors = this->EgoMotionPlaneNbNeighbors;
     matchingParams.PlanarityThreshold = this->EgoMotionPlanarityThreshold;
     matchingParams.PlaneMaxModelError = this->EgoMotionPlaneMaxModelError;
+    matchingParams.InitKnnEpsilon = this->EgoMotionInitKnnEpsilon;
+    matchingParams.NbExactKnnIterations = this->EgoMotionNbExactKnnIterations;
+
+    // Keypoints neighborhoods models, reused across ICP iterations
+    std::map<Keypoint, KeypointsMatcher::IterationCache> iterationCaches;
+    for (auto k : {EDGE, PLANE})
+      iterationCaches.emplace(k, KeypointsMatcher::IterationCache(this->EgoMotionNeighborhoodReuseRatio * this->LocalMaps[k]->GetLeafSize()));
+
+    // Reset the warm start tables if their resolution changed.
+    // The matched keypoints are expressed in the previous frame BASE coordinates,
+    // which change every frame : the warm start positions are stored in WORLD.
+    for (auto k : {EDGE, PLANE})
+    {
+      if (this->EgoMotionWarmStart[k].NbAzimuthBins != this->EgoMotionWarmStartAzimuthBins)
+        this->EgoMotionWarmStart[k] = KeypointsMatcher::WarmStartTable(this->EgoMotionWarmStartAzimuthBins);
+      this->EgoMotionWarmStart[k].WorldToFixed = this->Tworld;
+    }
+
+    // Matching status of the keypoints at previous ICP iteration
+    std::map<Keypoint, std::vector<KeypointsMatcher::MatchingResults::MatchStatus>> previousRejections;
+    // Matching results optimized at previous ICP iteration
+    std::map<Keypoint, KeypointsMatcher::MatchingResults> optimizedMatchingResults;
 
     // ICP - Levenberg-Marquardt loop
     // At each step of this loop an ICP matching is performed. Once the keypoints
@@ -1049,11 +1506,18 @@ void Slam::ComputeEgoMotion()
       // At each ICP iteration, the outliers removal is refined to be stricter
       double iterRatio = icpIter / static_cast<double>(this->EgoMotionICPMaxIter - 1);
       matchingParams.SaturationDistance = (1 - iterRatio) * this->EgoMotionInitSaturationDistance + iterRatio * this->EgoMotionFinalSaturationDistance;
+      matchingParams.KnnEpsilon = matchingParams.GetKnnEpsilon(icpIter, this->EgoMotionICPMaxIter);
       KeypointsMatcher matcher(matchingParams, this->Trelative);
 
       // Loop over keypoints to build the residuals
       for (auto k : {EDGE, PLANE})
-        this->EgoMotionMatchingResults[k] = matcher.BuildMatchResiduals(this->CurrentRawKeypoints[k], kdtreePrevious[k], k);
+      {
+        optimizedMatchingResults[k] = std::move(this->EgoMotionMatchingResults[k]);
+        KeypointsMatcher::IterationCache* iterationCache = this->EgoMotionNeighborhoodReuseRatio > 0. ? &iterationCaches.at(k) : nullptr;
+        KeypointsMatcher::WarmStartTable* warmStart = this->EgoMotionWarmStartAzimuthBins > 0 ? &this->EgoMotionWarmStart[k] : nullptr;
+        this->EgoMotionMatchingResults[k] = matcher.BuildMatchResiduals(this->CurrentRawKeypoints[k], kdtreePrevious[k], k, nullptr,
+                                                                        iterationCache, warmStart, &this->EgoMotionResidualsPools[k]);
+      }
 
       // Count matches and skip this frame
       // if there are too few geometric keypoints matched
@@ -1068,31 +1532,67 @@ void Slam::ComputeEgoMotion()
       }
 
       IF_VERBOSE(3, Utils::Timer::StopAndDisplay("  Ego-Motion : ICP"));
+      this->EgoMotionICPIterations = icpIter + 1;
+
+      // If the correspondences barely changed since the previous ICP iteration,
+      // they have already been optimized : keep the last optimized pose.
+      // Convergence is only accepted on exact neighbors search iterations.
+      const bool exactSearch = matchingParams.KnnEpsilon <= 0.;
+      if (icpIter > 0 && exactSearch && this->EgoMotionConvergenceMatchesRatio > 0.)
+      {
+        unsigned int nbChanges = 0;
+        for (auto k : {EDGE, PLANE})
+          nbChanges += Utils::NbMatchStatusChanges(previousRejections[k], this->EgoMotionMatchingResults[k].Rejections);
+        if (nbChanges < this->EgoMotionConvergenceMatchesRatio * this->TotalMatchedKeypoints)
+        {
+          PRINT_VERBOSE(3, "Ego-Motion ICP converged : " << nbChanges << " matches changed");
+          // Restore the matching results which gave the kept pose
+          // NOTE: Their residuals have been recycled for the new matches (cf. ResidualsPool).
+          this->EgoMotionMatchingResults.swap(optimizedMatchingResults);
+          this->TotalMatchedKeypoints = 0;
+          for (auto k : {EDGE, PLANE})
+            this->TotalMatchedKeypoints += this->EgoMotionMatchingResults[k].NbMatches();
+          break;
+        }
+      }
+      for (auto k : {EDGE, PLANE})
+        previousRejections[k] = this->EgoMotionMatchingResults[k].Rejections;
       IF_VERBOSE(3, Utils::Timer::Init("  Ego-Motion : LM optim"));
 
       // Init the optimizer with initial pose and parameters
-      LocalOptimizer optimizer;
+      LocalOptimizer& optimizer = this->EgoMotionOptimizer;
+      optimizer.Clear();
       optimizer.SetTwoDMode(this->TwoDMode);
+      optimizer.SetPoseParameterization(this->OptimizationParameterization);
       optimizer.SetPosePrior(this->Trelative);
       optimizer.SetLMMaxIter(this->EgoMotionLMMaxIter);
       optimizer.SetNbThreads(this->NbThreads);
+      optimizer.SetSolver(this->OptimizationSolver);
 
       // Add LiDAR ICP matches
       for (auto k : {EDGE, PLANE})
+      {
         optimizer.AddResiduals(this->EgoMotionMatchingResults[k].Residuals);
+        optimizer.AddLidarMatches(this->EgoMotionMatchingResults[k].Matches);
+      }
 
       // Run LM optimization
       ceres::Solver::Summary summary = optimizer.Solve();
       PRINT_VERBOSE(4, summary.BriefReport());
 
       // Get back optimized Trelative
+      Eigen::Isometry3d increment = this->Trelative.inverse();
       this->Trelative = optimizer.GetOptimizedPose();
+      increment = increment * this->Trelative;
 
       IF_VERBOSE(3, Utils::Timer::StopAndDisplay("  Ego-Motion : LM optim"));
 
       // If no L-M iteration has been made since the last ICP matching, it means
       // that we reached a local minimum for the ICP-LM algorithm.
-      if (summary.num_successful_steps == 1)
+      // If the pose barely moved, the next matches would be almost the same.
+      if (exactSearch &&
+          (summary.num_successful_steps == 1 ||
+           Utils::IsSmallMotion(increment, this->EgoMotionConvergenceTranslation, this->EgoMotionConvergenceRotation)))
       {
         break;
       }
@@ -1104,7 +1604,7 @@ void Slam::ComputeEgoMotion()
       std::cout << "Matched keypoints: " << this->TotalMatchedKeypoints << " (";
       for (auto k : {EDGE, PLANE})
         std::cout << this->EgoMotionMatchingResults[k].NbMatches() << " " << Utils::Plural(KeypointTypeNames.at(k)) << " ";
-      std::cout << ")" << std::endl;
+      std::cout << ")\nICP iterations: " << this->EgoMotionICPIterations << "/" << this->EgoMotionICPMaxIter << std::endl;
     }
   }
 
@@ -1149,8 +1649,19 @@ void Slam::Localization()
   #pragma omp parallel for num_threads(std::min(this->NbThreads, nbKeypointTypes))
   for (int i = 0; i < nbKeypointTypes; ++i)
   {
-    // If the map has been updated, the KD-tree needs to be updated
     Keypoint k = static_cast<Keypoint>(KeypointTypes[i]);
+
+    // The voxel-Gaussian engine directly uses the maps voxels, and the hashed
+    // voxels search structures are updated along with the maps : no sub-map
+    // nor KD-tree is needed, only the too old points have to be removed
+    if (this->LocalizationEngine == RegistrationEngine::VOXEL_GAUSSIAN || this->LocalMaps[k]->IsIncrementalSearch())
+    {
+      if (this->UseKeypoints[k] && this->MapUpdate != MappingMode::NONE && this->LocalMaps[k]->IsTimeThreshold())
+        this->LocalMaps[k]->ClearOldPoints(this->CurrentTime);
+      continue;
+    }
+
+    // If the map has been updated, the KD-tree needs to be updated
     if (this->UseKeypoints[k] && !this->LocalMaps[k]->IsSubMapKdTreeValid())
     {
       // If maps are fixed, we can build a single KD-tree
@@ -1186,8 +1697,11 @@ void Slam::Localization()
   {
     std::cout << "Keypoints extracted from map : ";
     for (auto k : KeypointTypes)
-      std::cout << this->LocalMaps[k]->GetSubMapKdTree().GetInputCloud()->size()
-                << " " << Utils::Plural(KeypointTypeNames.at(k)) << " ";
+    {
+      bool wholeMap = this->LocalizationEngine == RegistrationEngine::VOXEL_GAUSSIAN || this->LocalMaps[k]->IsIncrementalSearch();
+      unsigned int nbMapPoints = wholeMap ? this->LocalMaps[k]->Size() : this->LocalMaps[k]->GetSubMapKdTree().Size();
+      std::cout << nbMapPoints << " " << Utils::Plural(KeypointTypeNames.at(k)) << " ";
+    }
     std::cout << std::endl;
   }
 
@@ -1200,6 +1714,11 @@ void Slam::Localization()
   // Init matching parameters
   KeypointsMatcher::Parameters matchingParams;
   matchingParams.NbThreads = this->NbThreads;
+  // The planar dedicated solver evaluates batched matches without the 6D jacobians,
+  // and the residuals budget selects batched matches
+  matchingParams.BatchedResiduals = this->BatchedLidarResiduals || this->LocalizationResidualsBudget > 0 ||
+                                    (this->TwoDMode && this->OptimizationSolver == PoseSolver::DENSE_LM);
+  matchingParams.Parameterization = this->OptimizationParameterization;
   matchingParams.SingleEdgePerRing = false;
   matchingParams.MaxNeighborsDistance = this->LocalizationMaxNeighborsDistance;
   matchingParams.EdgeNbNeighbors = this->LocalizationEdgeNbNeighbors;
@@ -1209,6 +1728,46 @@ void Slam::Localization()
   matchingParams.PlanarityThreshold = this->LocalizationPlanarityThreshold;
   matchingParams.PlaneMaxModelError = this->LocalizationPlaneMaxModelError;
   matchingParams.BlobNbNeighbors = this->LocalizationBlobNbNeighbors;
+  matchingParams.InitKnnEpsilon = this->LocalizationInitKnnEpsilon;
+  matchingParams.NbExactKnnIterations = this->LocalizationNbExactKnnIterations;
+
+  // Keypoints neighborhoods models, reused across ICP iterations
+  std::map<Keypoint, KeypointsMatcher::IterationCache> iterationCaches;
+  for (auto k : KeypointTypes)
+    iterationCaches.emplace(k, KeypointsMatcher::IterationCache(this->LocalizationNeighborhoodReuseRatio * this->LocalMaps[k]->GetLeafSize()));
+
+  // Reset the warm start tables if their resolution changed
+  for (auto k : KeypointTypes)
+    if (this->LocalizationWarmStart[k].NbAzimuthBins != this->LocalizationWarmStartAzimuthBins)
+      this->LocalizationWarmStart[k] = KeypointsMatcher::WarmStartTable(this->LocalizationWarmStartAzimuthBins);
+
+  // Matching status of the keypoints at previous ICP iteration
+  std::map<Keypoint, std::vector<KeypointsMatcher::MatchingResults::MatchStatus>> previousRejections;
+  // Matching results optimized at previous ICP iteration, and the uncertainty of the resulting pose
+  std::map<Keypoint, KeypointsMatcher::MatchingResults> optimizedMatchingResults;
+  LocalOptimizer::RegistrationError optimizedUncertainty;
+  this->LocalizationICPIterations = 0;
+
+  // Sort the keypoints along the Morton curve if the first ICP iterations use
+  // subsampled keypoints
+  std::map<Keypoint, std::vector<size_t>> mortonOrders;
+  if (std::any_of(this->LocalizationSamplingRatios.begin(), this->LocalizationSamplingRatios.end(), [](double r) { return r < 1.; }))
+  {
+    for (auto k : KeypointTypes)
+    {
+      const PointCloud& keypoints = *this->CurrentUndistortedKeypoints[k];
+      if (keypoints.empty())
+        continue;
+      std::vector<float> xyz(3 * keypoints.size());
+      for (unsigned int i = 0; i < keypoints.size(); ++i)
+      {
+        xyz[3 * i]     = keypoints[i].x;
+        xyz[3 * i + 1] = keypoints[i].y;
+        xyz[3 * i + 2] = keypoints[i].z;
+      }
+      mortonOrders[k] = KDTree::MortonOrder(xyz.data(), keypoints.size());
+    }
+  }
 
   // ICP - Levenberg-Marquardt loop
   // At each step of this loop an ICP matching is performed. Once the keypoints
@@ -1229,19 +1788,45 @@ void Slam::Localization()
     // At each ICP iteration, the outliers removal is refined to be stricter
     double iterRatio = icpIter / static_cast<double>(this->LocalizationICPMaxIter - 1);
     matchingParams.SaturationDistance = (1 - iterRatio) * this->LocalizationInitSaturationDistance + iterRatio * this->LocalizationFinalSaturationDistance;
+    matchingParams.KnnEpsilon = matchingParams.GetKnnEpsilon(icpIter, this->LocalizationICPMaxIter);
     KeypointsMatcher matcher(matchingParams, this->Tworld);
 
+    // Ratio of keypoints to match at this ICP iteration (all at last iteration)
+    double samplingRatio = 1.;
+    if (icpIter < this->LocalizationSamplingRatios.size() && icpIter < this->LocalizationICPMaxIter - 1 &&
+        this->LocalizationSamplingRatios[icpIter] > 0.)
+      samplingRatio = std::min(this->LocalizationSamplingRatios[icpIter], 1.);
+    const bool allKeypoints = samplingRatio >= 1.;
+
     // Loop over keypoints to build the point to line residuals
     for (auto k : KeypointTypes)
-      this->LocalizationMatchingResults[k] = matcher.BuildMatchResiduals(this->CurrentUndistortedKeypoints[k], this->LocalMaps[k]->GetSubMapKdTree(), k);
+    {
+      optimizedMatchingResults[k] = std::move(this->LocalizationMatchingResults[k]);
+      PointCloud::Ptr keypoints = this->CurrentUndistortedKeypoints[k];
+      if (!allKeypoints && mortonOrders.count(k))
+        keypoints = Utils::MortonSubsample(keypoints, mortonOrders[k], samplingRatio);
+      if (this->LocalizationEngine == RegistrationEngine::VOXEL_GAUSSIAN)
+      {
+        this->LocalizationMatchingResults[k] = matcher.BuildVoxelMatchResiduals(keypoints, *this->LocalMaps[k], k,
+                                                                                &this->LocalizationResidualsPools[k]);
+        continue;
+      }
+      NeighborhoodModelCache* modelCache = this->LocalizationMapModelCache ? &this->LocalMaps[k]->GetSubMapModelCache() : nullptr;
+      KeypointsMatcher::IterationCache* iterationCache = this->LocalizationNeighborhoodReuseRatio > 0. ? &iterationCaches.at(k) : nullptr;
+      KeypointsMatcher::WarmStartTable* warmStart = this->LocalizationWarmStartAzimuthBins > 0 ? &this->LocalizationWarmStart[k] : nullptr;
+      this->LocalizationMatchingResults[k] = matcher.BuildMatchResiduals(keypoints, this->LocalMaps[k]->GetSubMapKdTree(), k,
+                                                                         modelCache, iterationCache, warmStart,
+                                                                         &this->LocalizationResidualsPools[k]);
+    }
 
     // Count matches and skip this frame
     // if there is too few geometric keypoints matched
+    // (relatively to the ratio of keypoints used)
     this->TotalMatchedKeypoints = 0;
     for (auto k : KeypointTypes)
       this->TotalMatchedKeypoints += this->LocalizationMatchingResults[k].NbMatches();
 
-    if (this->TotalMatchedKeypoints < this->MinNbMatchedKeypoints)
+    if (this->TotalMatchedKeypoints < samplingRatio * this->MinNbMatchedKeypoints)
     {
       // Reset state to previous one to avoid instability
       this->Trelative = Eigen::Isometry3d::Identity();
@@ -1254,18 +1839,60 @@ void Slam::Localization()
     }
 
     IF_VERBOSE(3, Utils::Timer::StopAndDisplay("  Localization : ICP"));
+    this->LocalizationICPIterations = icpIter + 1;
+
+    LocalOptimizer& optimizer = this->LocalizationOptimizer;
+
+    // If the correspondences barely changed since the previous ICP iteration,
+    // they have already been optimized : keep the last optimized pose.
+    // Convergence is only accepted on exact neighbors search iterations.
+    const bool exactSearch = matchingParams.KnnEpsilon <= 0.;
+    if (icpIter > 0 && allKeypoints && exactSearch && this->LocalizationConvergenceMatchesRatio > 0.)
+    {
+      unsigned int nbChanges = 0;
+      for (auto k : KeypointTypes)
+        nbChanges += Utils::NbMatchStatusChanges(previousRejections[k], this->LocalizationMatchingResults[k].Rejections);
+      if (nbChanges < this->LocalizationConvergenceMatchesRatio * this->TotalMatchedKeypoints)
+      {
+        PRINT_VERBOSE(3, "Localization ICP converged : " << nbChanges << " matches changed");
+        // Restore the matching results which gave the kept pose, and its uncertainty
+        // NOTE: Their residuals have been recycled for the new matches (cf. ResidualsPool).
+        this->LocalizationMatchingResults.swap(optimizedMatchingResults);
+        this->TotalMatchedKeypoints = 0;
+        for (auto k : KeypointTypes)
+          this->TotalMatchedKeypoints += this->LocalizationMatchingResults[k].NbMatches();
+        this->LocalizationUncertainty = optimizedUncertainty;
+        break;
+      }
+    }
+    for (auto k : KeypointTypes)
+      previousRejections[k] = this->LocalizationMatchingResults[k].Rejections;
+
+    // Only keep the most informative matches within the residuals budget
+    if (this->LocalizationResidualsBudget > 0)
+    {
+      IF_VERBOSE(3, Utils::Timer::Init("  Localization : matches selection"));
+      KeypointsMatcher::SelectMatches(this->LocalizationMatchingResults, this->Tworld, this->LocalizationResidualsBudget);
+      IF_VERBOSE(3, Utils::Timer::StopAndDisplay("  Localization : matches selection"));
+    }
+
     IF_VERBOSE(3, Utils::Timer::Init("  Localization : LM optim"));
 
     // Init the optimizer with initial pose and parameters
-    LocalOptimizer optimizer;
+    optimizer.Clear();
     optimizer.SetTwoDMode(this->TwoDMode);
+    optimizer.SetPoseParameterization(this->OptimizationParameterization);
     optimizer.SetPosePrior(this->Tworld);
     optimizer.SetLMMaxIter(this->LocalizationLMMaxIter);
     optimizer.SetNbThreads(this->NbThreads);
+    optimizer.SetSolver(this->OptimizationSolver);
 
     // Add LiDAR ICP matches
     for (auto k : KeypointTypes)
+    {
       optimizer.AddResiduals(this->LocalizationMatchingResults[k].Residuals);
+      optimizer.AddLidarMatches(this->LocalizationMatchingResults[k].Matches);
+    }
 
     // Add odometry constraint
     // if constraint has been successfully created
@@ -1291,22 +1918,35 @@ void Slam::Localization()
     PRINT_VERBOSE(4, summary.BriefReport());
 
     // Update Tworld and Trelative from optimization results
+    Eigen::Isometry3d increment = this->Tworld.inverse();
     this->Tworld = optimizer.GetOptimizedPose();
     this->Trelative = this->PreviousTworld.inverse() * this->Tworld;
+    increment = increment * this->Tworld;
 
     // Optionally refine undistortion
     if (this->Undistortion == UndistortionMode::REFINED)
       this->RefineUndistortion();
 
+    // If the next ICP iteration may converge on the matches changes and keep
+    // this pose, estimate its uncertainty now : the next matching step will
+    // recycle the residuals of the optimizer.
+    const bool uncertaintyEstimated = this->LocalizationConvergenceMatchesRatio > 0.;
+    if (uncertaintyEstimated)
+      optimizedUncertainty = optimizer.EstimateRegistrationError();
+
     IF_VERBOSE(3, Utils::Timer::StopAndDisplay("  Localization : LM optim"));
 
     // If no L-M iteration has been made since the last ICP matching, it means
     // that we reached a local minimum for the ICP-LM algorithm.
+    // If the pose barely moved, the next matches would be almost the same.
     // We evaluate the quality of the Tworld optimization using an approximate
     // computation of the variance covariance matrix.
-    if ((summary.num_successful_steps == 1) || (icpIter == this->LocalizationICPMaxIter - 1))
+    // These criteria are only checked once all keypoints are used, with exact search.
+    if ((icpIter == this->LocalizationICPMaxIter - 1) ||
+        (allKeypoints && exactSearch && ((summary.num_successful_steps == 1) ||
+                          Utils::IsSmallMotion(increment, this->LocalizationConvergenceTranslation, this->LocalizationConvergenceRotation))))
     {
-      this->LocalizationUncertainty = optimizer.EstimateRegistrationError();
+      this->LocalizationUncertainty = uncertaintyEstimated ? optimizedUncertainty : optimizer.EstimateRegistrationError();
       break;
     }
   }
@@ -1321,6 +1961,7 @@ void Slam::Localization()
     for (auto k : KeypointTypes)
       std::cout << this->LocalizationMatchingResults[k].NbMatches() << " " << Utils::Plural(KeypointTypeNames.at(k)) << " ";
     std::cout << ")"
+              << "\nICP iterations: " << this->LocalizationICPIterations << "/" << this->LocalizationICPMaxIter
               << "\nPosition uncertainty    = " << this->LocalizationUncertainty.PositionError    << " m"
               << " (along [" << this->LocalizationUncertainty.PositionErrorDirection.transpose()    << "])"
               << "\nOrientation uncertainty = " << this->LocalizationUncertainty.OrientationError << " °"
@@ -1384,10 +2025,75 @@ void Slam::UpdateMapsUsingTworld()
   for (int i = 0; i < nbKeypointTypes; ++i)
   {
     Keypoint k = static_cast<Keypoint>(KeypointTypes[i]);
-    // Add not fixed points
+    // Add not fixed points, anchored to current frame
     if (this->UseKeypoints[k])
-      this->LocalMaps[k]->Add(this->CurrentWorldKeypoints[k], false, this->CurrentTime);
+      this->LocalMaps[k]->Add(this->CurrentWorldKeypoints[k], false, this->CurrentTime, true, this->NbrFrameProcessed);
+  }
+}
+
+//-----------------------------------------------------------------------------
+void Slam::UpdateAnchoredMaps()
+{
+  // Get the keyframes whose pose has been corrected since they were added to the maps
+  std::unordered_set<int> movedAnchors;
+  std::vector<LidarState*> movedStates;
+  for (auto& state : this->LogStates)
+  {
+    if (!state.IsKeyFrame || !state.IsMapAnchor)
+      continue;
+    Eigen::Isometry3d correction = state.AnchorIsometry.inverse() * state.Isometry;
+    if (correction.translation().norm() < this->KfAnchorDistanceTolerance &&
+        Eigen::AngleAxisd(correction.linear()).angle() < Utils::Deg2Rad(this->KfAnchorAngleTolerance))
+      continue;
+    movedAnchors.insert(state.Index);
+    movedStates.push_back(&state);
+  }
+
+  PRINT_VERBOSE(3, movedStates.size() << " keyframes moved and need to be updated in maps");
+  if (movedStates.empty())
+    return;
+
+  // Get the latest keyframe, which may not have moved, to center the maps on it
+  auto lastKeyFrame = std::find_if(this->LogStates.rbegin(), this->LogStates.rend(),
+                                   [](const LidarState& state) { return state.IsKeyFrame; });
+
+  // The iteration is not directly on Keypoint types
+  // because of openMP behaviour which needs int iteration on MSVC
+  int nbKeypointTypes = static_cast<int>(KeypointTypes.size());
+  #pragma omp parallel for num_threads(std::min(this->NbThreads, nbKeypointTypes))
+  for (int i = 0; i < nbKeypointTypes; ++i)
+  {
+    Keypoint k = static_cast<Keypoint>(KeypointTypes[i]);
+    if (!this->UseKeypoints[k])
+      continue;
+
+    // Remove the points of the moved keyframes
+    this->LocalMaps[k]->RemoveAnchoredPoints(movedAnchors);
+
+    // Roll to center onto the latest keyframe, like when rebuilding the whole map.
+    // The older keyframes points which do not fit in the rolled map are dropped.
+    PointCloud::Ptr keypoints(new PointCloud);
+    pcl::transformPointCloud(*lastKeyFrame->Keypoints[k]->GetCloud(), *keypoints, lastKeyFrame->Isometry.matrix().cast<float>());
+    if (!keypoints->empty())
+    {
+      Eigen::Vector4f minPoint, maxPoint;
+      pcl::getMinMax3D(*keypoints, minPoint, maxPoint);
+      this->LocalMaps[k]->Roll(minPoint.head<3>().array(), maxPoint.head<3>().array());
+    }
+
+    // Add back the moved keyframes points using their new pose
+    for (LidarState* state : movedStates)
+    {
+      keypoints.reset(new PointCloud);
+      pcl::transformPointCloud(*state->Keypoints[k]->GetCloud(), *keypoints, state->Isometry.matrix().cast<float>());
+      if (!keypoints->empty())
+        this->LocalMaps[k]->Add(keypoints, false, state->Time, false, state->Index);
+    }
   }
+
+  // Update the anchors
+  for (LidarState* state : movedStates)
+    state->AnchorIsometry = state->Isometry;
 }
 
 //-----------------------------------------------------------------------------
@@ -1408,6 +2114,10 @@ void Slam::LogCurrentFrameState(double time)
   }
   state.Time = time;
   state.Index = this->NbrFrameProcessed;
+  // Keyframes keypoints have been added to the maps using current pose
+  state.IsMapAnchor = this->IsKeyFrame && (this->MapUpdate == MappingMode::ADD_KPTS_TO_FIXED_MAP ||
+                                           this->MapUpdate == MappingMode::UPDATE);
+  state.AnchorIsometry = this->Tworld;
   for (auto k : KeypointTypes)
     state.Keypoints[k] = std::make_shared<PCStorage>(this->CurrentUndistortedKeypoints[k], this->LoggingStorage);
   this->LogStates.emplace_back(state);
@@ -1529,6 +2239,15 @@ void Slam::SetOverlapSamplingRatio (float _arg)
     this->OverlapEstimation = -1.f;
 }
 
+//-----------------------------------------------------------------------------
+void Slam::SetOverlapMethod(OverlapEstimator method)
+{
+  this->OverlapMethod = method;
+  if (method == OverlapEstimator::VOXEL_OCCUPANCY && this->UsePriorMaps())
+    PRINT_WARNING("The voxels occupancy overlap ignores the prior maps points : "
+                  "the nearest neighbors overlap will be estimated instead.");
+}
+
 //-----------------------------------------------------------------------------
 void Slam::EstimateOverlap()
 {
@@ -1536,16 +2255,21 @@ void Slam::EstimateOverlap()
   PointCloud::Ptr aggregatedPoints = this->GetRegisteredFrame();
 
   // Keep only the maps to use
+  // (the voxels occupancy does not require the KD-trees, but ignores the prior maps)
+  const bool occupancy = this->OverlapMethod == OverlapEstimator::VOXEL_OCCUPANCY && !this->UsePriorMaps();
   std::map<Keypoint, std::shared_ptr<RollingGrid>> mapsToUse;
   for (auto k : KeypointTypes)
   {
-    if (this->UseKeypoints[k] && this->LocalMaps[k]->IsSubMapKdTreeValid())
+    if (this->UseKeypoints[k] && (occupancy ? this->LocalMaps[k]->Size() > 0 : this->LocalMaps[k]->IsSubMapKdTreeValid()))
       mapsToUse[k] = this->LocalMaps[k];
   }
 
   // Compute LCP like estimator
   // (see http://geometry.cs.ucl.ac.uk/projects/2014/super4PCS/ for more info)
-  this->OverlapEstimation = Confidence::LCPEstimator(aggregatedPoints, mapsToUse, this->OverlapSamplingRatio, this->NbThreads);
+  if (occupancy)
+    this->OverlapEstimation = Confidence::OccupancyLCPEstimator(aggregatedPoints, mapsToUse, this->OverlapSamplingRatio, this->NbThreads);
+  else
+    this->OverlapEstimation = Confidence::LCPEstimator(aggregatedPoints, mapsToUse, this->OverlapSamplingRatio, this->NbThreads);
   PRINT_VERBOSE(3, "Overlap : " << this->OverlapEstimation << ", estimated on : "
                                 << static_cast<int>(aggregatedPoints->size() * this->OverlapSamplingRatio) << " points.");
 }
@@ -1900,6 +2624,7 @@ void Slam::ClearMaps()
 {
   for (auto k : KeypointTypes)
     this->LocalMaps[k]->Reset();
+  this->UpdateMapsVoxelStatistics();
 }
 
 //-----------------------------------------------------------------------------
@@ -1927,6 +2652,18 @@ void Slam::SetVoxelGridSamplingMode(Keypoint k, SamplingMode sm)
   this->LocalMaps[k]->SetSampling(sm);
 }
 
+//-----------------------------------------------------------------------------
+NeighborSearchBackend Slam::GetVoxelGridSearchBackend(Keypoint k)
+{
+  return this->LocalMaps[k]->GetSearchBackend();
+}
+
+//-----------------------------------------------------------------------------
+void Slam::SetVoxelGridSearchBackend(Keypoint k, NeighborSearchBackend backend)
+{
+  this->LocalMaps[k]->SetSearchBackend(backend);
+}
+
 //-----------------------------------------------------------------------------
 void Slam::SetVoxelGridLeafSize(Keypoint k, double size)
 {
@@ -1954,6 +2691,21 @@ void Slam::SetVoxelGridMinFramesPerVoxel(unsigned int minFrames)
     this->LocalMaps[k]->SetMinFramesPerVoxel(minFrames);
 }
 
+//-----------------------------------------------------------------------------
+void Slam::SetLocalizationEngine(RegistrationEngine engine)
+{
+  this->LocalizationEngine = engine;
+  this->UpdateMapsVoxelStatistics();
+}
+
+//-----------------------------------------------------------------------------
+void Slam::UpdateMapsVoxelStatistics()
+{
+  // The voxel-Gaussian engine needs the maps voxels statistics
+  for (auto k : KeypointTypes)
+    this->LocalMaps[k]->SetKeepVoxelStatistics(this->LocalizationEngine == RegistrationEngine::VOXEL_GAUSSIAN);
+}
+
 //==============================================================================
 //   Memory parameters setting
 //==============================================================================
@@ -1971,4 +2723,125 @@ void Slam::SetLoggingTimeout(double lMax)
   }
 }
 
+//-----------------------------------------------------------------------------
+std::map<MemorySubsystem, double> Slam::GetMemoryUsage() const
+{
+  std::map<MemorySubsystem, size_t> memory;
+  for (const auto& kv : MemorySubsystemNames)
+    memory[kv.first] = 0;
+
+  // Logged keypoints
+  for (const auto& state : this->LogStates)
+  {
+    for (const auto& kv : state.Keypoints)
+      memory[MemorySubsystem::LOGGED_STATES] += Utils::StorageMemorySize(*kv.second);
+  }
+
+  // Maps, submaps and prior maps (which may be shared by several maps)
+  std::set<const PriorMap*> priorMaps;
+  for (const auto& kv : this->LocalMaps)
+  {
+    memory[MemorySubsystem::MAPS] += kv.second->GetMemorySize();
+    memory[MemorySubsystem::SUBMAPS] += kv.second->GetSubMapMemorySize();
+    auto prior = kv.second->GetPrior();
+    if (prior && priorMaps.insert(prior.get()).second)
+      memory[MemorySubsystem::PRIOR_MAPS] += prior->GetMemorySize();
+  }
+
+  // Convert to MB
+  std::map<MemorySubsystem, double> memoryMB;
+  for (const auto& kv : memory)
+    memoryMB[kv.first] = kv.second * 1e-6;
+  return memoryMB;
+}
+
+//-----------------------------------------------------------------------------
+void Slam::EnforceMemoryBudget()
+{
+  // Check if the budget is exceeded
+  std::map<MemorySubsystem, double> usage = this->GetMemoryUsage();
+  double totalMemory = 0.;
+  for (const auto& kv : usage)
+    totalMemory += kv.second;
+  // [bytes] Memory to free
+  double excess = (totalMemory - this->MemoryBudget) * 1e6;
+  if (excess <= 0.)
+    return;
+
+  // The last logged states are never modified as they are used
+  // for ego-motion extrapolation and undistortion
+  const unsigned int nbProtectedStates = 2;
+
+  for (MemoryEvictionPolicy policy : this->MemoryEvictionPolicies)
+  {
+    if (excess <= 0.)
+      break;
+
+    switch (policy)
+    {
+      case MemoryEvictionPolicy::COMPRESS_OLD_STATES:
+      case MemoryEvictionPolicy::DROP_NON_KEYFRAME_CLOUDS:
+      {
+        // Non keyframes keypoints are only needed to build the maps if they are not updated
+        if (policy == MemoryEvictionPolicy::DROP_NON_KEYFRAME_CLOUDS && this->MapUpdate == MappingMode::NONE)
+        {
+          PRINT_VERBOSE(2, "Memory budget exceeded : non keyframes keypoints are not dropped as the maps are not updated");
+          break;
+        }
+        // Loop over the logged states from the oldest one
+        unsigned int nbStates = 0;
+        double freed = 0.;
+        auto itSt = this->LogStates.begin();
+        for (unsigned int i = 0; i + nbProtectedStates < this->LogStates.size() && excess > 0.; ++i, ++itSt)
+        {
+          if (policy == MemoryEvictionPolicy::DROP_NON_KEYFRAME_CLOUDS && itSt->IsMapAnchor)
+            continue;
+          bool modified = false;
+          for (auto& kv : itSt->Keypoints)
+          {
+            size_t previousSize = Utils::StorageMemorySize(*kv.second);
+            if (policy == MemoryEvictionPolicy::COMPRESS_OLD_STATES && kv.second->StorageType() == PCL_CLOUD)
+              kv.second = std::make_shared<PCStorage>(kv.second->GetCloud(), OCTREE_COMPRESSED);
+            else if (policy == MemoryEvictionPolicy::DROP_NON_KEYFRAME_CLOUDS && kv.second->PointsSize())
+              kv.second = std::make_shared<PCStorage>(PointCloud::Ptr(new PointCloud), PCL_CLOUD);
+            else
+              continue;
+            double stateFreed = static_cast<double>(previousSize) - Utils::StorageMemorySize(*kv.second);
+            excess -= stateFreed;
+            freed += stateFreed;
+            modified = true;
+          }
+          nbStates += modified;
+        }
+        PRINT_VERBOSE(2, "Memory budget exceeded : " << (policy == MemoryEvictionPolicy::COMPRESS_OLD_STATES ? "compressed " : "dropped keypoints of ")
+                         << nbStates << " logged states (" << freed * 1e-6 << " MB freed)");
+        break;
+      }
+
+      case MemoryEvictionPolicy::DROP_FAR_MAP_VOXELS:
+      {
+        // Remove from each map a part of its points proportional to the memory to free
+        double mapsMemory = usage[MemorySubsystem::MAPS] * 1e6;
+        if (mapsMemory <= 0.)
+          break;
+        double ratio = std::min(excess / mapsMemory, 1.);
+        Eigen::Array3f position = this->Tworld.translation().cast<float>().array();
+        unsigned int nbRemovedPoints = 0;
+        for (auto& kv : this->LocalMaps)
+        {
+          size_t previousSize = kv.second->GetMemorySize();
+          unsigned int nbPoints = std::ceil(ratio * kv.second->Size());
+          nbRemovedPoints += kv.second->RemoveFarthestVoxels(position, nbPoints);
+          excess -= static_cast<double>(previousSize) - kv.second->GetMemorySize();
+        }
+        PRINT_VERBOSE(2, "Memory budget exceeded : removed " << nbRemovedPoints << " far points from the maps");
+        break;
+      }
+    }
+  }
+
+  if (excess > 0.)
+    PRINT_WARNING("Memory budget exceeded by " << excess * 1e-6 << " MB after applying all eviction policies.");
+}
+
 } // end of LidarSlam namespace
\ No newline at end of file
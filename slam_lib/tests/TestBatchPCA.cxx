@@ -0,0 +1,154 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-17
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+// Check that the batched PCA of neighborhoods (ComputeMeanAndPCABatch) and the
+// raw indices overload of Utils::ComputeMeanAndPCA give the same centroids,
+// eigen values and eigen vectors as Utils::ComputeMeanAndPCA, including for neighborhoods lying far (km-scale) from the origin.
+// As older PCL versions accumulate unshifted moments, the reference PCA is
+// computed on a copy of each neighborhood moved close to the origin.
+// Returns 0 if all checks pass.
+
+#include "LidarSlam/BatchPCA.h"
+#include "LidarSlam/LidarPoint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace LidarSlam;
+
+namespace
+{
+using Point = LidarPoint;
+using PointCloud = pcl::PointCloud<Point>;
+
+constexpr unsigned int NB_NEIGHBORS = 10;
+constexpr double TOLERANCE = 1e-6;
+
+//------------------------------------------------------------------------------
+//! Generate a noisy planar or linear neighborhood of NB_NEIGHBORS points around center
+void AddNeighborhood(const Eigen::Vector3d& center, bool linear, std::mt19937& gen, PointCloud& cloud)
+{
+  std::uniform_real_distribution<double> unit(-1., 1.);
+  Eigen::Vector3d u = Eigen::Vector3d::NullaryExpr([&]() { return unit(gen); }).normalized();
+  Eigen::Vector3d v = u.unitOrthogonal();
+  for (unsigned int k = 0; k < NB_NEIGHBORS; ++k)
+  {
+    Eigen::Vector3d noise = 0.01 * Eigen::Vector3d::NullaryExpr([&]() { return unit(gen); });
+    Eigen::Vector3d pos = center + unit(gen) * u + (linear ? 0. : unit(gen)) * v + noise;
+    Point p;
+    p.getVector3fMap() = pos.cast<float>();
+    cloud.push_back(p);
+  }
+}
+
+//------------------------------------------------------------------------------
+//! Check that two values are equal up to TOLERANCE, relatively to scale
+bool Check(const std::string& name, double value, double reference, double scale)
+{
+  if (std::abs(value - reference) <= TOLERANCE * std::max(1., scale))
+    return true;
+  std::cerr << "  " << name << " mismatch : " << value << " instead of " << reference << std::endl;
+  return false;
+}
+
+//------------------------------------------------------------------------------
+//! Compare a PCA to the reference one. Eigen vectors are defined up to their
+//! sign, and only the k-th one, well separated from the others, is compared.
+bool CheckPCA(const std::string& prefix, const Eigen::Vector3d& mean, const Eigen::Vector3d& eigVals, const Eigen::Matrix3d& eigVecs,
+              const Eigen::Vector3d& refMean, const Eigen::Vector3d& refEigVals, const Eigen::Matrix3d& refEigVecs, int k)
+{
+  bool success = true;
+  for (int i = 0; i < 3; ++i)
+  {
+    success &= Check(prefix + "mean[" + std::to_string(i) + "]", mean(i), refMean(i), 1.);
+    success &= Check(prefix + "eigen value " + std::to_string(i), eigVals(i), refEigVals(i), refEigVals(2));
+  }
+  double dot = std::abs(eigVecs.col(k).dot(refEigVecs.col(k)));
+  success &= Check(prefix + "eigen vector " + std::to_string(k) + " alignment", dot, 1., 1.);
+  return success;
+}
+} // end of anonymous namespace
+
+//------------------------------------------------------------------------------
+int main()
+{
+  std::mt19937 gen(42);
+  const std::vector<double> offsets = {0., 100., 700., 1000., 1500., 2000., 5000.};
+
+  // Build one planar and one linear neighborhood at each offset from the origin
+  PointCloud cloud;
+  std::vector<int> indices;
+  std::vector<unsigned int> sizes;
+  std::vector<Eigen::Vector3d> centers;
+  for (double offset : offsets)
+  {
+    Eigen::Vector3d center = offset * Eigen::Vector3d(0.6, -0.7, 0.1).normalized();
+    for (bool linear : {false, true})
+    {
+      AddNeighborhood(center, linear, gen, cloud);
+      centers.push_back(center);
+      sizes.push_back(NB_NEIGHBORS);
+    }
+  }
+  indices.resize(cloud.size());
+  std::iota(indices.begin(), indices.end(), 0);
+
+  Utils::PCABatch<double> batch;
+  Utils::ComputeMeanAndPCABatch(cloud, indices.data(), sizes.data(), NB_NEIGHBORS, sizes.size(), batch);
+
+  bool success = true;
+  for (unsigned int i = 0; i < sizes.size(); ++i)
+  {
+    // Reference PCA of the neighborhood moved close to the origin
+    PointCloud neighbors;
+    for (unsigned int k = i * NB_NEIGHBORS; k < (i + 1) * NB_NEIGHBORS; ++k)
+    {
+      Point p = cloud[k];
+      p.getVector3fMap() = (cloud[k].getVector3fMap().cast<double>() - centers[i]).cast<float>();
+      neighbors.push_back(p);
+    }
+    std::vector<int> neighborsIndices(NB_NEIGHBORS);
+    std::iota(neighborsIndices.begin(), neighborsIndices.end(), 0);
+    Eigen::Vector3d mean, eigVals;
+    Eigen::Matrix3d eigVecs;
+    Utils::ComputeMeanAndPCA(neighbors, neighborsIndices, mean, eigVecs, eigVals);
+    mean += centers[i];
+
+    // The well separated eigen vector is the normal of a plane, or the direction of a line
+    const int k = i % 2 ? 2 : 0;
+    const std::string prefix = "neighborhood " + std::to_string(i) + " ";
+    bool neighborhoodSuccess = CheckPCA(prefix + "batched ", batch.GetMean(i), batch.GetEigenValues(i), batch.GetEigenVectors(i),
+                                        mean, eigVals, eigVecs, k);
+
+    // Raw indices overload, on the neighborhood far from the origin
+    Eigen::Vector3d rawMean, rawEigVals;
+    Eigen::Matrix3d rawEigVecs;
+    Utils::ComputeMeanAndPCA(cloud, indices.data() + i * NB_NEIGHBORS, NB_NEIGHBORS, rawMean, rawEigVecs, rawEigVals);
+    neighborhoodSuccess &= CheckPCA(prefix + "raw indices ", rawMean, rawEigVals, rawEigVecs, mean, eigVals, eigVecs, k);
+
+    std::cout << "Neighborhood " << i << " at " << offsets[i / 2] << " m : " << (neighborhoodSuccess ? "OK" : "FAILED") << std::endl;
+    success &= neighborhoodSuccess;
+  }
+
+  return success ? 0 : 1;
+}
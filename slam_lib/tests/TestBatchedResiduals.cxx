@@ -0,0 +1,230 @@
+//==============================================================================
+// Copyright 2019-2020 Kitware, Inc., Kitware SAS
+// Author: Kitware SAS
+// Creation date: 2026-10-17
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//==============================================================================
+
+// Check that the batched analytic LiDAR residual block
+// (BatchedMahalanobisDistanceAffineIsometryResidual) gives the same cost,
+// gradient and Gauss-Newton system as one auto-differentiated residual block
+// per match robustified by ScaledTukeyLoss, for each pose parameterization.
+// The planar normal equations (EvaluatePlanar) are checked the same way.
+// Returns 0 if all checks pass.
+
+#include "LidarSlam/CeresCostFunctions.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace LidarSlam;
+
+namespace
+{
+constexpr double TOLERANCE = 1e-8;
+constexpr int NB_MATCHES = 500;
+
+//------------------------------------------------------------------------------
+//! Check that two values are equal up to TOLERANCE (relatively to their magnitude)
+bool Check(const std::string& name, double value, double reference)
+{
+  double error = std::abs(value - reference) / std::max(1., std::abs(reference));
+  if (error <= TOLERANCE)
+    return true;
+  std::cerr << "  " << name << " mismatch : " << value << " instead of " << reference << std::endl;
+  return false;
+}
+
+//------------------------------------------------------------------------------
+//! Generate random matches, some of them being outliers (saturated by the Tukey loss)
+std::vector<CeresTools::PointToModelMatch> RandomMatches(std::mt19937& gen)
+{
+  std::uniform_real_distribution<double> coord(-10., 10.);
+  std::uniform_real_distribution<double> unit(0., 1.);
+  std::vector<CeresTools::PointToModelMatch> matches(NB_MATCHES);
+  for (auto& match : matches)
+  {
+    // Symmetric semi-definite distance operator, as built by the matcher
+    Eigen::Matrix3d M = Eigen::Matrix3d::NullaryExpr([&]() { return unit(gen) - 0.5; });
+    match.A = M.transpose() * M;
+    match.P = Eigen::Vector3d::NullaryExpr([&]() { return coord(gen); });
+    match.X = match.P + Eigen::Vector3d::NullaryExpr([&]() { return 0.3 * (unit(gen) - 0.5); });
+    match.SaturationDistance = 0.2 + unit(gen);
+    match.Weight = unit(gen);
+  }
+  return matches;
+}
+
+//------------------------------------------------------------------------------
+//! Evaluate the cost, gradient and J^T J of a problem at its current parameters
+void EvaluateProblem(ceres::Problem& problem, double& cost, std::vector<double>& gradient, Eigen::MatrixXd& JtJ)
+{
+  std::vector<double> residuals;
+  ceres::CRSMatrix jacobian;
+  problem.Evaluate(ceres::Problem::EvaluateOptions(), &cost, &residuals, &gradient, &jacobian);
+
+  JtJ = Eigen::MatrixXd::Zero(jacobian.num_cols, jacobian.num_cols);
+  for (int row = 0; row < jacobian.num_rows; ++row)
+    for (int i = jacobian.rows[row]; i < jacobian.rows[row + 1]; ++i)
+      for (int j = jacobian.rows[row]; j < jacobian.rows[row + 1]; ++j)
+        JtJ(jacobian.cols[i], jacobian.cols[j]) += jacobian.values[i] * jacobian.values[j];
+}
+
+//------------------------------------------------------------------------------
+//! Compare the batched and per-match residuals for a given parameterization
+bool CheckParameterization(PoseParameterization parameterization, const std::vector<CeresTools::PointToModelMatch>& matches,
+                           std::vector<double> pose)
+{
+  ceres::Problem::Options options;
+  options.cost_function_ownership = ceres::Ownership::DO_NOT_TAKE_OWNERSHIP;
+  options.loss_function_ownership = ceres::Ownership::DO_NOT_TAKE_OWNERSHIP;
+
+  // Reference : one robustified auto-diff residual block per match
+  std::vector<double> refPose = pose;
+  ceres::Problem refProblem(options);
+  std::vector<CeresTools::Residual> refResiduals;
+  for (const auto& match : matches)
+  {
+    CeresTools::Residual res;
+    res.Cost = CeresCostFunctions::MahalanobisDistanceAffineIsometryResidual::Create(parameterization, match.A, match.P, match.X);
+    res.Robustifier = std::make_shared<CeresTools::ScaledTukeyLoss>(match.SaturationDistance, match.Weight);
+    refProblem.AddResidualBlock(res.Cost.get(), res.Robustifier.get(), refPose.data());
+    refResiduals.push_back(res);
+  }
+
+  // Batched analytic residual block
+  CeresCostFunctions::BatchedMahalanobisDistanceAffineIsometryResidual batched;
+  batched.SetPoseParameterization(parameterization);
+  for (const auto& match : matches)
+    batched.Add(match);
+  ceres::Problem problem(options);
+  problem.AddResidualBlock(&batched, nullptr, pose.data());
+
+  double refCost, cost;
+  std::vector<double> refGradient, gradient;
+  Eigen::MatrixXd refJtJ, JtJ;
+  EvaluateProblem(refProblem, refCost, refGradient, refJtJ);
+  EvaluateProblem(problem, cost, gradient, JtJ);
+
+  bool success = Check("cost", cost, refCost);
+  for (unsigned int i = 0; i < gradient.size(); ++i)
+    success &= Check("gradient[" + std::to_string(i) + "]", gradient[i], refGradient[i]);
+  for (int i = 0; i < JtJ.rows(); ++i)
+    for (int j = 0; j < JtJ.cols(); ++j)
+      success &= Check("JtJ(" + std::to_string(i) + ", " + std::to_string(j) + ")", JtJ(i, j), refJtJ(i, j));
+  return success;
+}
+
+//------------------------------------------------------------------------------
+//! Match residual after a planar increment (dX, dY, rZ) of the pose (R, T),
+//! rZ being a rotation about the world Z axis (cf. EvaluatePlanar)
+struct PlanarIncrementResidual
+{
+  PlanarIncrementResidual(const CeresTools::PointToModelMatch& match, const Eigen::Matrix3d& R, const Eigen::Vector3d& T)
+    : Match(match), RX(R * match.X), Translation(T)
+  {}
+
+  template <typename T>
+  bool operator()(const T* const d, T* residual) const
+  {
+    using Vector3T = Eigen::Matrix<T, 3, 1>;
+    const T c = ceres::cos(d[2]), s = ceres::sin(d[2]);
+    Vector3T Y(c * this->RX.x() - s * this->RX.y() + this->Translation.x() + d[0],
+               s * this->RX.x() + c * this->RX.y() + this->Translation.y() + d[1],
+               T(this->RX.z() + this->Translation.z()));
+    Eigen::Map<Vector3T> residualVec(residual);
+    residualVec = this->Match.A.cast<T>() * (Y - this->Match.P.cast<T>());
+    return true;
+  }
+
+  CeresTools::PointToModelMatch Match;
+  Eigen::Vector3d RX;
+  Eigen::Vector3d Translation;
+};
+
+//------------------------------------------------------------------------------
+//! Compare the batched planar normal equations with the per-match ones
+bool CheckPlanar(const std::vector<CeresTools::PointToModelMatch>& matches, const Eigen::Matrix3d& R, const Eigen::Vector3d& T)
+{
+  CeresCostFunctions::BatchedMahalanobisDistanceAffineIsometryResidual batched;
+  for (const auto& match : matches)
+    batched.Add(match);
+  Eigen::Matrix3d H;
+  Eigen::Vector3d g;
+  double cost = batched.EvaluatePlanar(R, T, &H, &g);
+
+  // Reference : robustified normal equations of each auto-diff residual at null increment
+  double refCost = 0.;
+  Eigen::Matrix3d refH = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d refG = Eigen::Vector3d::Zero();
+  for (const auto& match : matches)
+  {
+    ceres::AutoDiffCostFunction<PlanarIncrementResidual, 3, 3> residual(new PlanarIncrementResidual(match, R, T));
+    double d[3] = {0., 0., 0.};
+    double* parameters[1] = {d};
+    Eigen::Vector3d r;
+    Eigen::Matrix<double, 3, 3, Eigen::RowMajor> J;
+    double* jacobians[1] = {J.data()};
+    residual.Evaluate(parameters, r.data(), jacobians);
+    double rho[3];
+    CeresTools::ScaledTukeyLoss(match.SaturationDistance, match.Weight).Evaluate(r.squaredNorm(), rho);
+    refCost += 0.5 * rho[0];
+    refH += rho[1] * J.transpose() * J;
+    refG += rho[1] * J.transpose() * r;
+  }
+
+  bool success = Check("planar cost", cost, refCost);
+  for (int i = 0; i < 3; ++i)
+  {
+    success &= Check("planar g[" + std::to_string(i) + "]", g(i), refG(i));
+    for (int j = 0; j < 3; ++j)
+      success &= Check("planar H(" + std::to_string(i) + ", " + std::to_string(j) + ")", H(i, j), refH(i, j));
+  }
+  return success;
+}
+} // end of anonymous namespace
+
+//------------------------------------------------------------------------------
+int main()
+{
+  std::mt19937 gen(42);
+  const std::vector<CeresTools::PointToModelMatch> matches = RandomMatches(gen);
+  bool success = true;
+
+  // Euler angles parameterization (X, Y, Z, rX, rY, rZ)
+  std::vector<double> eulerPose = {0.05, -0.03, 0.02, 0.01, -0.02, 0.03};
+  bool eulerSuccess = CheckParameterization(PoseParameterization::EULER_ANGLES, matches, eulerPose);
+  std::cout << "Euler angles parameterization : " << (eulerSuccess ? "OK" : "FAILED") << std::endl;
+  success &= eulerSuccess;
+
+  // Quaternion parameterization (X, Y, Z, qX, qY, qZ, qW)
+  Eigen::Quaterniond q = Eigen::AngleAxisd(0.03, Eigen::Vector3d(1., 2., 3.).normalized()) * Eigen::Quaterniond::Identity();
+  std::vector<double> quatPose = {0.05, -0.03, 0.02, q.x(), q.y(), q.z(), q.w()};
+  bool quatSuccess = CheckParameterization(PoseParameterization::QUATERNION, matches, quatPose);
+  std::cout << "Quaternion parameterization : " << (quatSuccess ? "OK" : "FAILED") << std::endl;
+  success &= quatSuccess;
+
+  // Planar normal equations
+  Eigen::Matrix3d R = q.toRotationMatrix();
+  Eigen::Vector3d T(0.05, -0.03, 0.02);
+  bool planarSuccess = CheckPlanar(matches, R, T);
+  std::cout << "Planar normal equations : " << (planarSuccess ? "OK" : "FAILED") << std::endl;
+  success &= planarSuccess;
+
+  return success ? 0 : 1;
+}